@@ -11,12 +11,17 @@ LOCAL_PATH:= $(call my-dir)
 
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES:= QualcommCameraHardware.cpp
+LOCAL_SRC_FILES:= QualcommCameraHardware.cpp SoftJpegEncoder.cpp \
+    SoftJpegAdapter.cpp CameraControlQueue.cpp CameraTrace.cpp
 
 LOCAL_CFLAGS:= -DDLOPEN_LIBMMCAMERA=$(DLOPEN_LIBMMCAMERA)
 
 LOCAL_CFLAGS+= -DNUM_PREVIEW_BUFFERS=4 -D_ANDROID_
 
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_CFLAGS+= -mfpu=neon
+endif
+
 LOCAL_C_INCLUDES+= \
     $(TARGET_OUT_HEADERS)/mm-camera \
     $(TARGET_OUT_HEADERS)/mm-still/jpeg \
@@ -33,6 +38,54 @@ endif
 LOCAL_MODULE:= libcamera
 include $(BUILD_SHARED_LIBRARY)
 
+# Standalone benchmark for the software JPEG encoder; builds on the host.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= SoftJpegEncoder.cpp softjpeg_bench.cpp
+
+LOCAL_STATIC_LIBRARIES:= liblog
+LOCAL_LDLIBS:= -lpthread -lm
+
+LOCAL_MODULE:= softjpeg_bench
+LOCAL_MODULE_TAGS:= optional
+include $(BUILD_HOST_EXECUTABLE)
+
+ifeq ($(HOST_OS),linux)
+# Stand-in for the MSM camera driver and liboemcamera (see FakeMsmCamera.h).
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= FakeMsmCamera.cpp FakeOemCamera.cpp SoftJpegEncoder.cpp \
+    SoftJpegAdapter.cpp
+
+LOCAL_CFLAGS:= -DNUM_PREVIEW_BUFFERS=4
+
+LOCAL_STATIC_LIBRARIES:= libutils liblog
+LOCAL_LDLIBS:= -lpthread -ldl -lm
+
+LOCAL_MODULE:= liboemcamera
+LOCAL_MODULE_TAGS:= optional
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+# End-to-end HAL benchmark against the fake camera.  Linking the fake
+# liboemcamera puts its device hooks ahead of libc, and the HAL's dlopen()
+# of liboemcamera.so then finds the same library.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= camera_hal_bench.cpp QualcommCameraHardware.cpp \
+    SoftJpegEncoder.cpp SoftJpegAdapter.cpp CameraControlQueue.cpp \
+    CameraTrace.cpp
+
+LOCAL_CFLAGS:= -DDLOPEN_LIBMMCAMERA=1 -DNUM_PREVIEW_BUFFERS=4
+
+LOCAL_SHARED_LIBRARIES:= liboemcamera
+LOCAL_STATIC_LIBRARIES:= libui libbinder libutils libcutils liblog
+LOCAL_LDLIBS:= -lpthread -ldl -lm
+
+LOCAL_MODULE:= camera_hal_bench
+LOCAL_MODULE_TAGS:= optional
+include $(BUILD_HOST_EXECUTABLE)
+endif # HOST_OS
+
 endif # BUILD_TINY_ANDROID
 endif # BUILD_LIBCAMERA
 endif # BOARD_USES_QCOM_CAMERA_LIBS
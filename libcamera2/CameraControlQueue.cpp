@@ -0,0 +1,337 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "CameraControlQueue"
+#include <utils/Log.h>
+
+#include "CameraControlQueue.h"
+#include "CameraTrace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+extern "C" {
+#include <media/msm_camera.h>
+}
+
+namespace android {
+
+static const char *const priority_names[] = {
+    "critical", "normal"
+};
+
+CameraControlQueue::Command::Command()
+    : mType(0),
+      mLength(0),
+      mTimeoutMs(0),
+      mSuccessStatus(-1),
+      mFlags(0),
+      mPriority(PRIORITY_NORMAL),
+      mQueuedTime(0),
+      mDone(false),
+      mSucceeded(false),
+      mStatus(0)
+{
+}
+
+bool CameraControlQueue::Command::wait()
+{
+    Mutex::Autolock l(&mLock);
+    while (!mDone)
+        mWait.wait(mLock);
+    return mSucceeded;
+}
+
+bool CameraControlQueue::Command::done()
+{
+    Mutex::Autolock l(&mLock);
+    return mDone;
+}
+
+bool CameraControlQueue::Command::succeeded()
+{
+    Mutex::Autolock l(&mLock);
+    return mDone && mSucceeded;
+}
+
+int CameraControlQueue::Command::status()
+{
+    Mutex::Autolock l(&mLock);
+    return mStatus;
+}
+
+CameraControlQueue::CameraControlQueue()
+    : mCameraControlFd(-1),
+      mRunning(false),
+      mStopping(false),
+      mMaxDepth(0)
+{
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+        mTail[i] = NULL;
+    memset(mStats, 0, sizeof(mStats));
+}
+
+CameraControlQueue::~CameraControlQueue()
+{
+    stop();
+}
+
+bool CameraControlQueue::start(int camfd)
+{
+    Mutex::Autolock l(&mLock);
+    mCameraControlFd = camfd;
+    if (mRunning)
+        return true;
+    mStopping = false;
+    mRunning = !pthread_create(&mThread, NULL, control_thread, this);
+    if (!mRunning)
+        LOGE("start: could not create the control thread: %s",
+             strerror(errno));
+    return mRunning;
+}
+
+void CameraControlQueue::stop()
+{
+    mLock.lock();
+    if (!mRunning) {
+        mLock.unlock();
+        return;
+    }
+    mStopping = true;
+    mWait.signal();
+    mLock.unlock();
+
+    pthread_join(mThread, NULL);
+}
+
+void *CameraControlQueue::control_thread(void *user)
+{
+    LOGV("control_thread E");
+    static_cast<CameraControlQueue *>(user)->runQueue();
+    LOGV("control_thread X");
+    return NULL;
+}
+
+void CameraControlQueue::runQueue()
+{
+    mLock.lock();
+    for (;;) {
+        sp<Command> cmd;
+        for (int i = 0; i < PRIORITY_COUNT && cmd == 0; i++) {
+            if (mHead[i] != 0) {
+                cmd = mHead[i];
+                mHead[i] = cmd->mNext;
+                cmd->mNext.clear();
+                if (mHead[i] == 0)
+                    mTail[i] = NULL;
+            }
+        }
+        if (cmd == 0) {
+            if (mStopping)
+                break;
+            mWait.wait(mLock);
+            continue;
+        }
+        int camfd = mCameraControlFd;
+        mLock.unlock();
+        execute(cmd, camfd);
+        mLock.lock();
+    }
+    mRunning = false;
+    mLock.unlock();
+}
+
+void CameraControlQueue::execute(const sp<Command>& cmd, int camfd)
+{
+    struct msm_ctrl_cmd ctrlCmd;
+    bool noResponse = cmd->mFlags & FLAG_NO_RESPONSE;
+
+    ctrlCmd.timeout_ms = cmd->mTimeoutMs;
+    ctrlCmd.type       = cmd->mType;
+    ctrlCmd.length     = cmd->mLength;
+    ctrlCmd.value      = cmd->mLength ? cmd->mValue : NULL;
+    ctrlCmd.status     = 0;
+    // FIXME: this will be put in by the kernel
+    ctrlCmd.resp_fd    = noResponse ? -1 : camfd;
+
+    nsecs_t start = systemTime();
+    int rc;
+    {
+        CAMERA_TRACE_SCOPE("ctrlCommand", cmd->mType);
+        rc = ioctl(camfd, noResponse ? MSM_CAM_IOCTL_CTRL_COMMAND_2 :
+                   MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd);
+    }
+    nsecs_t end = systemTime();
+
+    bool succeeded = rc >= 0 && (cmd->mSuccessStatus < 0 ||
+                                 ctrlCmd.status == cmd->mSuccessStatus);
+    if (!succeeded)
+        LOGE("execute: error (%s): fd %d, type %d, length %d, status %d",
+             rc < 0 ? strerror(errno) : "bad status",
+             camfd, cmd->mType, cmd->mLength, ctrlCmd.status);
+
+    if (cmd->mType < kMaxCommandType) {
+        Mutex::Autolock l(&mStatsLock);
+        TypeStats *stats = &mStats[cmd->mType];
+        stats->count++;
+        if (!succeeded)
+            stats->failed++;
+        stats->queueTime += start - cmd->mQueuedTime;
+        stats->runTime += end - start;
+        if (end - start > stats->maxRunTime)
+            stats->maxRunTime = end - start;
+    }
+
+    Mutex::Autolock l(&cmd->mLock);
+    cmd->mStatus = ctrlCmd.status;
+    cmd->mSucceeded = succeeded;
+    cmd->mDone = true;
+    cmd->mWait.broadcast();
+}
+
+sp<CameraControlQueue::Command> CameraControlQueue::submit(
+    uint16_t type, const void *value, uint16_t length,
+    uint32_t timeoutMs, int32_t successStatus,
+    Priority priority, uint32_t flags)
+{
+    if (length > kMaxPayload) {
+        LOGE("submit: type %d payload of %d bytes is too large",
+             type, length);
+        return NULL;
+    }
+
+    Mutex::Autolock l(&mLock);
+
+    if (flags & FLAG_COALESCE) {
+        // Only a match behind the last command without FLAG_COALESCE may
+        // take the new payload.
+        Command *match = NULL;
+        for (Command *queued = mHead[priority].get(); queued != NULL;
+             queued = queued->mNext.get()) {
+            if (!(queued->mFlags & FLAG_COALESCE))
+                match = NULL;
+            else if (queued->mType == type && queued->mLength == length)
+                match = queued;
+        }
+        if (match != NULL) {
+            LOGV("submit: type %d coalesced", type);
+            if (length)
+                memcpy(match->mValue, value, length);
+            if (type < kMaxCommandType) {
+                Mutex::Autolock sl(&mStatsLock);
+                mStats[type].coalesced++;
+            }
+            return match;
+        }
+    }
+
+    sp<Command> cmd = new Command();
+    cmd->mType = type;
+    cmd->mLength = length;
+    cmd->mTimeoutMs = timeoutMs;
+    cmd->mSuccessStatus = successStatus;
+    cmd->mFlags = flags;
+    cmd->mPriority = priority;
+    if (length)
+        memcpy(cmd->mValue, value, length);
+    cmd->mQueuedTime = systemTime();
+
+    if (!mRunning) {
+        mLock.unlock();
+        execute(cmd, mCameraControlFd);
+        mLock.lock();
+        return cmd;
+    }
+
+    if (mTail[priority] != NULL)
+        mTail[priority]->mNext = cmd;
+    else
+        mHead[priority] = cmd;
+    mTail[priority] = cmd.get();
+
+    int depth = 0;
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+        for (Command *c = mHead[i].get(); c != NULL; c = c->mNext.get())
+            depth++;
+    {
+        Mutex::Autolock sl(&mStatsLock);
+        if (depth > mMaxDepth)
+            mMaxDepth = depth;
+    }
+
+    mWait.signal();
+    return cmd;
+}
+
+bool CameraControlQueue::run(uint16_t type, void *value, uint16_t length,
+                             uint32_t timeoutMs, int32_t successStatus,
+                             Priority priority, uint32_t flags)
+{
+    sp<Command> cmd = submit(type, value, length, timeoutMs, successStatus,
+                             priority, flags);
+    if (cmd == 0)
+        return false;
+    bool succeeded = cmd->wait();
+    if (length)
+        memcpy(value, cmd->value(), length);
+    return succeeded;
+}
+
+void CameraControlQueue::account(uint16_t type, nsecs_t latency,
+                                 bool succeeded)
+{
+    if (type >= kMaxCommandType)
+        return;
+    Mutex::Autolock l(&mStatsLock);
+    TypeStats *stats = &mStats[type];
+    stats->count++;
+    if (!succeeded)
+        stats->failed++;
+    stats->runTime += latency;
+    if (latency > stats->maxRunTime)
+        stats->maxRunTime = latency;
+}
+
+void CameraControlQueue::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    Mutex::Autolock l(&mStatsLock);
+    snprintf(buffer, 255, "control commands: max queue depth (%d), "
+             "priorities %s > %s\n", mMaxDepth, priority_names[0],
+             priority_names[1]);
+    result.append(buffer);
+    result.append("  type    count coalesced failed  queue_ms    avg_ms"
+                  "    max_ms\n");
+    for (int type = 0; type < kMaxCommandType; type++) {
+        const TypeStats *stats = &mStats[type];
+        if (stats->count == 0 && stats->coalesced == 0)
+            continue;
+        int n = stats->count ? stats->count : 1;
+        snprintf(buffer, 255, "  %4d %8d %9d %6d %9.2f %9.2f %9.2f\n",
+                 type, stats->count, stats->coalesced, stats->failed,
+                 stats->queueTime / n / 1000000.0,
+                 stats->runTime / n / 1000000.0,
+                 stats->maxRunTime / 1000000.0);
+        result.append(buffer);
+    }
+}
+
+}; // namespace android
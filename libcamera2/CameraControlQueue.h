@@ -0,0 +1,141 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_CONTROL_QUEUE_H
+#define ANDROID_HARDWARE_CAMERA_CONTROL_QUEUE_H
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/threads.h>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace android {
+
+// Runs the MSM_CAM_IOCTL_CTRL_COMMAND requests for one control fd on a
+// dedicated thread, so that the driver's 1-5 s command timeouts are not
+// spent on binder threads.  Commands are taken in priority order and in
+// submission order within a priority.  A command submitted with
+// FLAG_COALESCE replaces the payload of a still queued command of the same
+// type, and both submitters share its result, unless a command without the
+// flag was queued behind it, which the new payload must not overtake.
+//
+// Before start() and after stop(), commands run on the submitting thread.
+class CameraControlQueue {
+public:
+    enum Priority {
+        PRIORITY_CRITICAL,  // stopping preview or snapshot, cancelling AF
+        PRIORITY_NORMAL,    // preview and snapshot sequencing, parameters
+        PRIORITY_COUNT
+    };
+
+    enum {
+        FLAG_COALESCE    = 1 << 0,
+        FLAG_NO_RESPONSE = 1 << 1,  // MSM_CAM_IOCTL_CTRL_COMMAND_2, no resp_fd
+    };
+
+    static const int kMaxPayload = 64;
+    static const int kMaxCommandType = 64;
+
+    // A submitted command, and the future through which its result is
+    // delivered.
+    class Command : public RefBase {
+    public:
+        // Blocks until the command has run; returns succeeded().
+        bool wait();
+        bool done();
+        bool succeeded();
+        int status();           // driver status of the command
+        const void *value() const { return mValue; }
+
+    private:
+        friend class CameraControlQueue;
+        Command();
+
+        uint16_t mType;
+        uint16_t mLength;
+        uint32_t mTimeoutMs;
+        int32_t mSuccessStatus; // < 0: only the ioctl result counts
+        uint32_t mFlags;
+        Priority mPriority;
+        uint8_t mValue[kMaxPayload];
+        nsecs_t mQueuedTime;
+        sp<Command> mNext;
+
+        Mutex mLock;
+        Condition mWait;
+        bool mDone;
+        bool mSucceeded;
+        int mStatus;
+    };
+
+    CameraControlQueue();
+    ~CameraControlQueue();
+
+    bool start(int camfd);
+    // Runs the commands already queued, then stops the thread.
+    void stop();
+
+    sp<Command> submit(uint16_t type, const void *value, uint16_t length,
+                       uint32_t timeoutMs, int32_t successStatus,
+                       Priority priority, uint32_t flags = 0);
+
+    // Submits a command and waits for it.  The payload, which the driver
+    // may have filled in, is copied back to value.
+    bool run(uint16_t type, void *value, uint16_t length,
+             uint32_t timeoutMs, int32_t successStatus,
+             Priority priority, uint32_t flags = 0);
+
+    // Records the latency of a command that was issued elsewhere, e.g.
+    // auto focus, which blocks for the whole focus sweep on its own fd.
+    void account(uint16_t type, nsecs_t latency, bool succeeded);
+
+    void dump(String8& result) const;
+
+private:
+    static void *control_thread(void *user);
+    void runQueue();
+    void execute(const sp<Command>& cmd, int camfd);
+
+    Mutex mLock;
+    Condition mWait;
+    sp<Command> mHead[PRIORITY_COUNT];
+    Command *mTail[PRIORITY_COUNT];
+    int mCameraControlFd;
+    bool mRunning;
+    bool mStopping;
+    pthread_t mThread;
+
+    struct TypeStats {
+        int count;
+        int coalesced;
+        int failed;
+        nsecs_t queueTime;
+        nsecs_t runTime;
+        nsecs_t maxRunTime;
+    };
+    TypeStats mStats[kMaxCommandType];
+    int mMaxDepth;
+    mutable Mutex mStatsLock;
+
+    CameraControlQueue(const CameraControlQueue &);
+    CameraControlQueue &operator=(const CameraControlQueue &);
+};
+
+}; // namespace android
+
+#endif
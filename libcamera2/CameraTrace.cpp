@@ -0,0 +1,239 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "CameraTrace"
+#include <utils/Log.h>
+
+#include "CameraTrace.h"
+
+#include <utils/String8.h>
+#include <cutils/atomic.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TRACE_RING_SIZE 1024    // events per thread; a power of two
+#define TRACE_MAX_RINGS 32
+#define TRACE_MARKER "/sys/kernel/debug/tracing/trace_marker"
+
+namespace android {
+
+volatile int32_t CameraTrace::sMode;
+
+struct trace_event {
+    nsecs_t time;
+    const char *name;
+    int32_t arg;
+    char phase;     // Chrome trace phase: 'B'egin, 'E'nd or 'i'nstant
+};
+
+struct trace_ring {
+    // Events ever recorded.  Only the owning thread writes it, after the
+    // event itself.
+    volatile int32_t head;
+    int tid;
+    bool owned;         // a live thread records into this ring
+    nsecs_t released;   // when the owner exited
+    trace_event events[TRACE_RING_SIZE];
+};
+
+// Rings outlive their threads, so that the snapshot and autofocus threads
+// still show up in a dump after they exit.  Once all TRACE_MAX_RINGS are
+// allocated, a new thread takes over the ring released the longest ago.
+static trace_ring *rings[TRACE_MAX_RINGS];
+static int ring_count;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static int marker_fd = -1;
+
+static void release_ring(void *data)
+{
+    trace_ring *ring = (trace_ring *)data;
+    pthread_mutex_lock(&ring_lock);
+    ring->owned = false;
+    ring->released = systemTime();
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void create_ring_key()
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static trace_ring *claim_ring()
+{
+    trace_ring *ring = NULL;
+    pthread_mutex_lock(&ring_lock);
+    if (ring_count < TRACE_MAX_RINGS) {
+        ring = (trace_ring *)calloc(1, sizeof(trace_ring));
+        if (ring != NULL)
+            rings[ring_count++] = ring;
+    } else {
+        for (int i = 0; i < ring_count; i++) {
+            if (!rings[i]->owned &&
+                (ring == NULL || rings[i]->released < ring->released))
+                ring = rings[i];
+        }
+    }
+    if (ring != NULL) {
+        ring->head = 0;
+        ring->tid = syscall(__NR_gettid);
+        ring->owned = true;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (ring != NULL)
+        pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static void write_marker(char phase, const char *name, int32_t arg)
+{
+    char buffer[128];
+    int len;
+    if (phase == 'B')
+        len = snprintf(buffer, sizeof(buffer), "B|%d|%s", getpid(), name);
+    else if (phase == 'E')
+        len = snprintf(buffer, sizeof(buffer), "E");
+    else
+        len = snprintf(buffer, sizeof(buffer), "C|%d|%s|%d", getpid(),
+                       name, arg);
+    write(marker_fd, buffer, len);
+}
+
+static inline void record(char phase, const char *name, int32_t arg)
+{
+    trace_ring *ring = (trace_ring *)pthread_getspecific(ring_key);
+    if (ring == NULL && (ring = claim_ring()) == NULL)
+        return;
+
+    int32_t head = ring->head;
+    trace_event *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    event->time = systemTime();
+    event->name = name;
+    event->arg = arg;
+    event->phase = phase;
+    android_atomic_write(head + 1, &ring->head);
+
+    if (CameraTrace::sMode == CameraTrace::MODE_FTRACE)
+        write_marker(phase, name, arg);
+}
+
+void CameraTrace::setMode(int mode)
+{
+    pthread_once(&ring_key_once, create_ring_key);
+    if (mode == MODE_FTRACE && marker_fd < 0) {
+        marker_fd = open(TRACE_MARKER, O_WRONLY);
+        if (marker_fd < 0) {
+            LOGW("cannot open %s (%s), tracing to memory only",
+                 TRACE_MARKER, strerror(errno));
+            mode = MODE_RING;
+        }
+    }
+    if (mode < MODE_OFF || mode > MODE_FTRACE)
+        mode = MODE_OFF;
+    LOGI("trace mode %d", mode);
+    android_atomic_write(mode, &sMode);
+}
+
+void CameraTrace::begin(const char *name, int32_t arg)
+{
+    record('B', name, arg);
+}
+
+void CameraTrace::end(const char *name)
+{
+    record('E', name, 0);
+}
+
+void CameraTrace::instant(const char *name, int32_t arg)
+{
+    record('i', name, arg);
+}
+
+void CameraTrace::dumpChromeTrace(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+    bool first = true;
+    int pid = getpid();
+
+    trace_event *events =
+        (trace_event *)malloc(TRACE_RING_SIZE * sizeof(trace_event));
+    if (events == NULL)
+        return;
+
+    result.append("{\"traceEvents\":[");
+    pthread_mutex_lock(&ring_lock);
+    for (int r = 0; r < ring_count; r++) {
+        trace_ring *ring = rings[r];
+
+        // The owner keeps recording while we copy; drop whatever it may
+        // have overwritten in the meantime.
+        int32_t head = ring->head;
+        int32_t start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (int32_t i = start; i < head; i++)
+            events[i - start] = ring->events[i & (TRACE_RING_SIZE - 1)];
+        int32_t after = ring->head;
+        if (after < head)
+            continue;   // ring taken over by another thread
+        int32_t valid = after > TRACE_RING_SIZE ?
+            after - TRACE_RING_SIZE : 0;
+        if (valid < start)
+            valid = start;
+
+        for (int32_t i = valid; i < head; i++) {
+            const trace_event *event = &events[i - start];
+            int len = snprintf(buffer, SIZE,
+                               "%s\n{\"name\":\"%s\",\"ph\":\"%c\","
+                               "\"ts\":%lld.%03d,\"pid\":%d,\"tid\":%d",
+                               first ? "" : ",", event->name, event->phase,
+                               (long long)(event->time / 1000),
+                               (int)(event->time % 1000), pid, ring->tid);
+            if (event->phase == 'B')
+                snprintf(buffer + len, SIZE - len,
+                         ",\"args\":{\"arg\":%d}}", event->arg);
+            else if (event->phase == 'i')
+                snprintf(buffer + len, SIZE - len,
+                         ",\"s\":\"t\",\"args\":{\"arg\":%d}}", event->arg);
+            else
+                snprintf(buffer + len, SIZE - len, "}");
+            result.append(buffer);
+            first = false;
+
+            if (result.size() > 8192) {
+                write(fd, result.string(), result.size());
+                result.setTo("");
+            }
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+    free(events);
+
+    result.append("\n],\"displayTimeUnit\":\"ms\"}\n");
+    write(fd, result.string(), result.size());
+}
+
+}; // namespace android
@@ -0,0 +1,86 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_TRACE_H
+#define ANDROID_HARDWARE_CAMERA_TRACE_H
+
+#include <utils/Timers.h>
+#include <stdint.h>
+
+namespace android {
+
+// In-memory event trace.  Every thread records into its own ring, so
+// recording takes no lock: it is a timestamp, four stores and the release
+// of the ring head.  Only the oldest events are lost when a ring wraps.
+// dumpChromeTrace() writes what the rings hold in the Chrome trace event
+// format (load it in chrome://tracing).
+//
+// Event names must be string literals; only the pointer is recorded.
+//
+// The debug.camera.trace property selects the mode when the camera opens:
+// 0 disables tracing, 1 records into the rings, and 2 also mirrors every
+// event to the ftrace trace_marker, for systrace.
+class CameraTrace {
+public:
+    enum Mode {
+        MODE_OFF,
+        MODE_RING,
+        MODE_FTRACE
+    };
+
+    static void setMode(int mode);
+    static bool enabled() { return sMode != MODE_OFF; }
+
+    static void begin(const char *name, int32_t arg);
+    static void end(const char *name);
+    static void instant(const char *name, int32_t arg);
+
+    static void dumpChromeTrace(int fd);
+
+    static volatile int32_t sMode;
+};
+
+class CameraTraceScope {
+public:
+    CameraTraceScope(const char *name, int32_t arg = 0) : mName(NULL) {
+        if (CameraTrace::enabled()) {
+            mName = name;
+            CameraTrace::begin(name, arg);
+        }
+    }
+    ~CameraTraceScope() {
+        if (mName)
+            CameraTrace::end(mName);
+    }
+private:
+    const char *mName;
+};
+
+}; // namespace android
+
+#define CAMERA_TRACE_CONCAT2(a, b) a##b
+#define CAMERA_TRACE_CONCAT(a, b) CAMERA_TRACE_CONCAT2(a, b)
+
+// Records a span from here to the end of the enclosing scope.
+#define CAMERA_TRACE_SCOPE(name, arg) \
+    android::CameraTraceScope CAMERA_TRACE_CONCAT(__camera_trace_, \
+                                                  __LINE__)(name, arg)
+#define CAMERA_TRACE_INSTANT(name, arg) do {                                  \
+        if (android::CameraTrace::enabled())                                  \
+            android::CameraTrace::instant(name, arg);                         \
+    } while (0)
+
+#endif
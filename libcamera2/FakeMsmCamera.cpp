@@ -0,0 +1,545 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// The driver half of the fake camera: device files and ioctls.  See
+// FakeMsmCamera.h.
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FakeMsmCamera"
+#include <utils/Log.h>
+
+#include "FakeMsmCamera.h"
+
+#include <utils/Timers.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+extern "C" {
+#include <linux/android_pmem.h>
+}
+
+#define MAX_FDS 256
+#define MAX_PMEM_BUFFERS 32
+#define PMEM_POOL_SIZE (64 * 1024 * 1024)
+// Driver zoom value at which the VFE crops to half the width and height.
+#define ZOOM_DENOMINATOR 30
+
+namespace fakecam {
+
+enum FdKind {
+    FD_NONE,
+    FD_CONTROL,
+    FD_PMEM
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static FdKind fds[MAX_FDS];
+static struct msm_pmem_info buffers[MAX_PMEM_BUFFERS];
+static int buffer_count;
+static cam_ctrl_dimension_t dimension;
+static int32_t zoom;
+static bool preview_running;
+static bool snapshot_pending;
+static bool snapshot_stopped;
+static nsecs_t snapshot_start;
+static int snapshot_count;
+static bool af_cancelled;
+
+typedef int (*open_fn)(const char *, int, ...);
+typedef int (*close_fn)(int);
+typedef int (*dup_fn)(int);
+typedef int (*ioctl_fn)(int, unsigned long, ...);
+
+template <class T> static T real(const char *name)
+{
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (sym == NULL)
+        LOGE("no next definition of %s: %s", name, dlerror());
+    return (T)sym;
+}
+
+int config(const char *name, int defaultValue)
+{
+    const char *value = getenv(name);
+    return value ? atoi(value) : defaultValue;
+}
+
+static void msleep(int ms)
+{
+    if (ms > 0)
+        usleep(ms * 1000);
+}
+
+// Waits on cond, with lock held, until deadline or a broadcast.
+static void wait_until(nsecs_t deadline)
+{
+    nsecs_t remaining = deadline - systemTime();
+    if (remaining <= 0)
+        return;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    remaining += ts.tv_nsec;
+    ts.tv_sec += remaining / 1000000000LL;
+    ts.tv_nsec = remaining % 1000000000LL;
+    pthread_cond_timedwait(&cond, &lock, &ts);
+}
+
+static FdKind kind_of(int fd)
+{
+    if (fd < 0 || fd >= MAX_FDS)
+        return FD_NONE;
+    pthread_mutex_lock(&lock);
+    FdKind kind = fds[fd];
+    pthread_mutex_unlock(&lock);
+    return kind;
+}
+
+static int track(int fd, FdKind kind)
+{
+    if (fd < 0)
+        return fd;
+    if (fd >= MAX_FDS) {
+        LOGE("fd %d out of range", fd);
+        real<close_fn>("close")(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    pthread_mutex_lock(&lock);
+    fds[fd] = kind;
+    pthread_mutex_unlock(&lock);
+    return fd;
+}
+
+static bool is_device(const char *path)
+{
+    return !strcmp(path, MSM_CAMERA_CONTROL) ||
+        !strcmp(path, "/dev/oncrpc") ||
+        !strncmp(path, "/dev/pmem", 9);
+}
+
+static int create_pmem()
+{
+    int fd = -1;
+#ifdef __NR_memfd_create
+    fd = syscall(__NR_memfd_create, "fakecam-pmem", 0);
+#endif
+    if (fd < 0) {
+        char path[] = "/dev/shm/fakecam-pmem-XXXXXX";
+        fd = mkstemp(path);
+        if (fd >= 0)
+            unlink(path);
+    }
+    if (fd >= 0 && ftruncate(fd, PMEM_POOL_SIZE) < 0) {
+        LOGE("cannot size pmem pool: %s", strerror(errno));
+        real<close_fn>("close")(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns true if path is one of ours; *fd is then the new fd or -1.
+static bool open_device(const char *path, int *fd)
+{
+    if (!strcmp(path, MSM_CAMERA_CONTROL)) {
+        *fd = track(real<open_fn>("open")("/dev/null", O_RDWR), FD_CONTROL);
+        LOGV("open %s: fd %d", path, *fd);
+        return true;
+    }
+    if (!strncmp(path, "/dev/pmem", 9)) {
+        *fd = track(create_pmem(), FD_PMEM);
+        LOGV("open %s: fd %d", path, *fd);
+        return true;
+    }
+    return false;
+}
+
+static void compute_crop(common_crop_t *crop)
+{
+    memset(crop, 0, sizeof(*crop));
+    pthread_mutex_lock(&lock);
+    int32_t z = zoom;
+    cam_ctrl_dimension_t dim = dimension;
+    pthread_mutex_unlock(&lock);
+    if (z <= 0)
+        return;
+    crop->out1_w = dim.ui_thumbnail_width;
+    crop->out1_h = dim.ui_thumbnail_height;
+    crop->in1_w = (crop->out1_w * ZOOM_DENOMINATOR /
+                   (ZOOM_DENOMINATOR + z)) & ~1;
+    crop->in1_h = (crop->out1_h * ZOOM_DENOMINATOR /
+                   (ZOOM_DENOMINATOR + z)) & ~1;
+    crop->out2_w = dim.picture_width;
+    crop->out2_h = dim.picture_height;
+    crop->in2_w = (crop->out2_w * ZOOM_DENOMINATOR /
+                   (ZOOM_DENOMINATOR + z)) & ~1;
+    crop->in2_h = (crop->out2_h * ZOOM_DENOMINATOR /
+                   (ZOOM_DENOMINATOR + z)) & ~1;
+    crop->update_flag = 1;
+}
+
+static void *shutter_thread(void *)
+{
+    msleep(config("FAKECAM_EXPOSURE_MS", 150) / 2);
+    pthread_mutex_lock(&lock);
+    bool deliver = snapshot_pending && !snapshot_stopped;
+    pthread_mutex_unlock(&lock);
+    if (deliver) {
+        common_crop_t crop;
+        compute_crop(&crop);
+        deliver_shutter(&crop);
+    }
+    return NULL;
+}
+
+static void run_auto_focus(struct msm_ctrl_cmd *cmd)
+{
+    pthread_mutex_lock(&lock);
+    af_cancelled = false;
+    nsecs_t deadline = systemTime() + ms2ns(config("FAKECAM_AF_MS", 300));
+    while (!af_cancelled && systemTime() < deadline)
+        wait_until(deadline);
+    cmd->status = af_cancelled ? CAMERA_EXIT_CB_ABORT : CAMERA_EXIT_CB_DONE;
+    pthread_mutex_unlock(&lock);
+}
+
+static int ctrl_command(struct msm_ctrl_cmd *cmd, bool noResponse)
+{
+    LOGV("ctrl_command: type %d, length %d", cmd->type, cmd->length);
+    if (!noResponse)
+        msleep(config("FAKECAM_CTRL_MS", 2));
+    cmd->status = CAM_CTRL_SUCCESS;
+
+    switch (cmd->type) {
+    case CAMERA_SET_PARM_DIMENSION:
+        if (cmd->length != sizeof(cam_ctrl_dimension_t))
+            break;
+        pthread_mutex_lock(&lock);
+        memcpy(&dimension, cmd->value, sizeof(dimension));
+        pthread_mutex_unlock(&lock);
+        break;
+    case CAMERA_SET_PARM_ZOOM:
+        if (cmd->length < sizeof(int32_t))
+            break;
+        pthread_mutex_lock(&lock);
+        zoom = *(int32_t *)cmd->value;
+        pthread_mutex_unlock(&lock);
+        break;
+    case CAMERA_START_PREVIEW:
+    case CAMERA_STOP_PREVIEW:
+    case CAMERA_EXIT:
+        pthread_mutex_lock(&lock);
+        preview_running = cmd->type == CAMERA_START_PREVIEW;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        break;
+    case CAMERA_PREPARE_SNAPSHOT:
+        msleep(config("FAKECAM_PREPARE_MS", 50));
+        break;
+    case CAMERA_START_SNAPSHOT: {
+        pthread_mutex_lock(&lock);
+        snapshot_pending = true;
+        snapshot_stopped = false;
+        snapshot_start = systemTime();
+        pthread_mutex_unlock(&lock);
+
+        pthread_t thr;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thr, &attr, shutter_thread, NULL))
+            LOGE("cannot start the shutter thread");
+        break;
+    }
+    case CAMERA_STOP_SNAPSHOT:
+        pthread_mutex_lock(&lock);
+        snapshot_stopped = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        break;
+    case CAMERA_SET_PARM_AUTO_FOCUS:
+        run_auto_focus(cmd);
+        break;
+    case CAMERA_AUTO_FOCUS_CANCEL:
+        pthread_mutex_lock(&lock);
+        af_cancelled = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        break;
+    }
+    return 0;
+}
+
+static int register_pmem(struct msm_pmem_info *info, bool add)
+{
+    pthread_mutex_lock(&lock);
+    int i;
+    for (i = 0; i < buffer_count; i++)
+        if (buffers[i].vaddr == info->vaddr)
+            break;
+    if (!add) {
+        if (i < buffer_count)
+            buffers[i] = buffers[--buffer_count];
+    } else if (i < buffer_count) {
+        buffers[i] = *info;
+    } else if (buffer_count < MAX_PMEM_BUFFERS) {
+        buffers[buffer_count++] = *info;
+    } else {
+        pthread_mutex_unlock(&lock);
+        LOGE("too many pmem buffers registered");
+        errno = ENOMEM;
+        return -1;
+    }
+    pthread_mutex_unlock(&lock);
+    LOGV("%sregister_pmem: type %d, vaddr %p, len %d, active %d",
+         add ? "" : "un", info->type, info->vaddr, info->len, info->active);
+    return 0;
+}
+
+static void fill_picture(int type, int width, int height, int shot)
+{
+    pthread_mutex_lock(&lock);
+    struct msm_pmem_info info;
+    int i;
+    for (i = 0; i < buffer_count; i++)
+        if (buffers[i].type == type)
+            break;
+    if (i < buffer_count)
+        info = buffers[i];
+    pthread_mutex_unlock(&lock);
+
+    uint32_t size = width * height * 3 / 2;
+    if (i == buffer_count || size == 0 || size > info.len)
+        return;
+
+    uint8_t *y = (uint8_t *)info.vaddr;
+    for (int row = 0; row < height; row++)
+        for (int col = 0; col < width; col++)
+            y[row * width + col] = (uint8_t)((row + col) / 4 + shot * 16);
+    memset(y + width * height, 128, width * height / 2);
+}
+
+static int get_picture(struct msm_ctrl_cmd *cmd)
+{
+    pthread_mutex_lock(&lock);
+    nsecs_t deadline = snapshot_start +
+        ms2ns(config("FAKECAM_EXPOSURE_MS", 150));
+    while (snapshot_pending && !snapshot_stopped && systemTime() < deadline)
+        wait_until(deadline);
+    bool ok = snapshot_pending && !snapshot_stopped;
+    snapshot_pending = false;
+    int shot = snapshot_count++;
+    cam_ctrl_dimension_t dim = dimension;
+    pthread_mutex_unlock(&lock);
+
+    if (!ok) {
+        LOGV("get_picture: snapshot stopped");
+        errno = EINTR;
+        return -1;
+    }
+
+    fill_picture(MSM_PMEM_MAINIMG, dim.picture_width, dim.picture_height,
+                 shot);
+    fill_picture(MSM_PMEM_THUMBNAIL, dim.ui_thumbnail_width,
+                 dim.ui_thumbnail_height, shot);
+
+    common_crop_t crop;
+    compute_crop(&crop);
+    if (cmd->value && cmd->length >= sizeof(crop))
+        memcpy(cmd->value, &crop, sizeof(crop));
+    return 0;
+}
+
+static int control_ioctl(unsigned long request, void *arg)
+{
+    switch (request) {
+    case MSM_CAM_IOCTL_CTRL_COMMAND:
+        return ctrl_command((struct msm_ctrl_cmd *)arg, false);
+    case MSM_CAM_IOCTL_CTRL_COMMAND_2:
+        return ctrl_command((struct msm_ctrl_cmd *)arg, true);
+    case MSM_CAM_IOCTL_REGISTER_PMEM:
+        return register_pmem((struct msm_pmem_info *)arg, true);
+    case MSM_CAM_IOCTL_UNREGISTER_PMEM:
+        return register_pmem((struct msm_pmem_info *)arg, false);
+    case MSM_CAM_IOCTL_GET_PICTURE:
+        return get_picture((struct msm_ctrl_cmd *)arg);
+    case MSM_CAM_IOCTL_GET_SENSOR_INFO: {
+        struct msm_camsensor_info *info = (struct msm_camsensor_info *)arg;
+        memset(info, 0, sizeof(*info));
+        strncpy(info->name, "fakecam", sizeof(info->name) - 1);
+        info->flash_enabled = config("FAKECAM_FLASH", 0);
+        return 0;
+    }
+    }
+    LOGW("unsupported control ioctl %lx", request);
+    errno = EINVAL;
+    return -1;
+}
+
+static int pmem_ioctl(unsigned long request, void *arg)
+{
+    // Connecting, mapping and unmapping need no bookkeeping here.  Every
+    // open gets a memfd of its own, so a heap connected to a pool does not
+    // share its memory through its fd; the fake VFE only writes through
+    // the addresses registered with MSM_CAM_IOCTL_REGISTER_PMEM, which are
+    // the pool's mapping in this process.
+    if (request == PMEM_GET_SIZE) {
+        struct pmem_region *region = (struct pmem_region *)arg;
+        region->offset = 0;
+        region->len = PMEM_POOL_SIZE;
+    }
+    return 0;
+}
+
+bool wait_preview(volatile bool *terminate)
+{
+    pthread_mutex_lock(&lock);
+    while (!preview_running && !*terminate)
+        pthread_cond_wait(&cond, &lock);
+    bool running = !*terminate;
+    pthread_mutex_unlock(&lock);
+    return running;
+}
+
+void kick_preview()
+{
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+int preview_buffers(struct msm_pmem_info *out, int max)
+{
+    int n = 0;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < buffer_count && n < max; i++)
+        if (buffers[i].type == MSM_PMEM_OUTPUT2 && buffers[i].active)
+            out[n++] = buffers[i];
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+void preview_dimensions(int *width, int *height)
+{
+    pthread_mutex_lock(&lock);
+    *width = dimension.display_width;
+    *height = dimension.display_height;
+    pthread_mutex_unlock(&lock);
+}
+
+}; // namespace fakecam
+
+using namespace fakecam;
+
+extern "C" int open(const char *path, int flags, ...)
+{
+    va_list ap;
+    va_start(ap, flags);
+    int mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+
+    int fd;
+    if (path && open_device(path, &fd))
+        return fd;
+    return real<open_fn>("open")(path, flags, mode);
+}
+
+extern "C" int open64(const char *path, int flags, ...)
+{
+    va_list ap;
+    va_start(ap, flags);
+    int mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+
+    int fd;
+    if (path && open_device(path, &fd))
+        return fd;
+    return real<open_fn>("open64")(path, flags, mode);
+}
+
+extern "C" int close(int fd)
+{
+    if (fd >= 0 && fd < MAX_FDS) {
+        pthread_mutex_lock(&lock);
+        fds[fd] = FD_NONE;
+        pthread_mutex_unlock(&lock);
+    }
+    return real<close_fn>("close")(fd);
+}
+
+extern "C" int dup(int fd) __THROW
+{
+    return track(real<dup_fn>("dup")(fd), kind_of(fd));
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list ap;
+    va_start(ap, request);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+
+    switch (kind_of(fd)) {
+    case FD_CONTROL:
+        return control_ioctl(request, arg);
+    case FD_PMEM:
+        return pmem_ioctl(request, arg);
+    default:
+        return real<ioctl_fn>("ioctl")(fd, request, arg);
+    }
+}
+
+static void fake_device_stat(struct stat *buf)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->st_mode = S_IFCHR | 0660;
+}
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+extern "C" int stat(const char *path, struct stat *buf) __THROW
+{
+    if (path && is_device(path)) {
+        fake_device_stat(buf);
+        return 0;
+    }
+    typedef int (*stat_fn)(const char *, struct stat *);
+    return real<stat_fn>("stat")(path, buf);
+}
+#else
+// Older C libraries implement stat() inline on top of __xstat().
+extern "C" int __xstat(int ver, const char *path, struct stat *buf) __THROW
+{
+    if (path && is_device(path)) {
+        fake_device_stat(buf);
+        return 0;
+    }
+    typedef int (*xstat_fn)(int, const char *, struct stat *);
+    return real<xstat_fn>("__xstat")(ver, path, buf);
+}
+#endif
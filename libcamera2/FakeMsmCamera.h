@@ -0,0 +1,84 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_FAKE_MSM_CAMERA_H
+#define ANDROID_HARDWARE_FAKE_MSM_CAMERA_H
+
+// Host stand-in for the MSM camera driver and liboemcamera.
+//
+// The library builds as liboemcamera.so.  Loaded ahead of libc (linked into
+// the process, or through LD_PRELOAD) it takes over open(), close(), dup(),
+// ioctl() and stat() for /dev/msm_camera/control0, /dev/pmem_* and
+// /dev/oncrpc, and answers the ioctls the HAL issues:
+// MSM_CAM_IOCTL_CTRL_COMMAND(_2), MSM_CAM_IOCTL_(UN)REGISTER_PMEM,
+// MSM_CAM_IOCTL_GET_PICTURE and MSM_CAM_IOCTL_GET_SENSOR_INFO.  pmem is
+// backed by memfd (or an unlinked /dev/shm file on older kernels), one per
+// open, and the fake VFE writes the buffers the HAL registers through the
+// HAL's own mappings.  The HAL's dlopen("liboemcamera.so") then finds this same
+// library, whose cam_frame() produces the preview frames and whose
+// jpeg_encoder_* entry points encode with SoftJpegEncoder.
+//
+// Behavior is set through the environment:
+//
+//   FAKECAM_FPS            preview frame rate (30)
+//   FAKECAM_FRAME_DELAY_MS capture-to-callback delay of a preview frame (0)
+//   FAKECAM_FRAMES         file of YUV420SP frames at the preview size to
+//                          replay in a loop; synthetic frames if unset
+//   FAKECAM_CTRL_MS        latency of every control command (2)
+//   FAKECAM_PREPARE_MS     CAMERA_PREPARE_SNAPSHOT latency (50)
+//   FAKECAM_EXPOSURE_MS    CAMERA_START_SNAPSHOT to picture ready (150)
+//   FAKECAM_AF_MS          auto focus sweep (300)
+//   FAKECAM_FLASH          sensor reports a flash when 1 (0)
+
+#include <stdint.h>
+
+extern "C" {
+#include <media/msm_camera.h>
+}
+
+#include "QualcommCameraHardware.h"
+
+extern "C" {
+
+// Capture and delivery times, in systemTime() nanoseconds, of the last
+// preview frame written to the buffer starting at vaddr.  Returns false if
+// no frame was delivered in that buffer.
+bool fakecam_frame_time(const void *vaddr, int64_t *captured,
+                        int64_t *delivered);
+
+}
+
+namespace fakecam {
+
+// Between the driver and the liboemcamera halves of the library.
+
+int config(const char *name, int defaultValue);
+
+// Blocks until the driver has preview started (true) or *terminate is set
+// (false).
+bool wait_preview(volatile bool *terminate);
+// Wakes up wait_preview() callers to re-check their terminate flag.
+void kick_preview();
+// The registered preview buffers the VFE may write to.
+int preview_buffers(struct msm_pmem_info *buffers, int max);
+void preview_dimensions(int *width, int *height);
+
+// Implemented by the liboemcamera half.
+void deliver_shutter(common_crop_t *crop);
+
+}; // namespace fakecam
+
+#endif
@@ -0,0 +1,302 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// The liboemcamera half of the fake camera: the frame loop, the JPEG
+// encoder and the callback hooks the HAL fills in.  See FakeMsmCamera.h.
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FakeOemCamera"
+#include <utils/Log.h>
+
+#include "FakeMsmCamera.h"
+#include "SoftJpegAdapter.h"
+
+#include <utils/Timers.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PREVIEW_BUFFERS 8
+
+#ifndef HAVE_CAMERA_SIZE_TYPE
+struct camera_size_type {
+    int width;
+    int height;
+};
+#endif
+
+using android::SoftJpegAdapter;
+
+extern "C" {
+void (*mmcamera_camframe_callback)(struct msm_frame *frame);
+void (*mmcamera_jpegfragment_callback)(uint8_t *buff_ptr,
+                                       uint32_t buff_size);
+void (*mmcamera_jpeg_callback)(jpeg_event_t status);
+void (*mmcamera_shutter_callback)(common_crop_t *crop);
+}
+
+struct frame_time {
+    const void *vaddr;
+    nsecs_t captured;
+    nsecs_t delivered;
+};
+
+static pthread_mutex_t frame_time_lock = PTHREAD_MUTEX_INITIALIZER;
+static frame_time frame_times[MAX_PREVIEW_BUFFERS];
+static int frame_time_count;
+
+static volatile bool camframe_terminated;
+
+static const camera_size_type snapshot_sizes[] = {
+    { 2048, 1536 }, // QXGA
+    { 1600, 1200 }, // UXGA
+    { 1024,  768 }, // XGA
+    {  640,  480 }, // VGA
+};
+
+static void record_frame_time(const void *vaddr, nsecs_t captured,
+                              nsecs_t delivered)
+{
+    pthread_mutex_lock(&frame_time_lock);
+    int i;
+    for (i = 0; i < frame_time_count; i++)
+        if (frame_times[i].vaddr == vaddr)
+            break;
+    if (i == frame_time_count && frame_time_count < MAX_PREVIEW_BUFFERS)
+        frame_time_count++;
+    if (i < frame_time_count) {
+        frame_times[i].vaddr = vaddr;
+        frame_times[i].captured = captured;
+        frame_times[i].delivered = delivered;
+    }
+    pthread_mutex_unlock(&frame_time_lock);
+}
+
+bool fakecam_frame_time(const void *vaddr, int64_t *captured,
+                        int64_t *delivered)
+{
+    bool found = false;
+    pthread_mutex_lock(&frame_time_lock);
+    for (int i = 0; i < frame_time_count; i++) {
+        if (frame_times[i].vaddr == vaddr) {
+            *captured = frame_times[i].captured;
+            *delivered = frame_times[i].delivered;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&frame_time_lock);
+    return found;
+}
+
+// A gray ramp with a bar that moves one step per frame.
+static void synthesize_frame(uint8_t *dst, int width, int height, int n)
+{
+    int bar = (n * 8) % width;
+    for (int row = 0; row < height; row++) {
+        uint8_t *y = dst + row * width;
+        for (int col = 0; col < width; col++)
+            y[col] = (uint8_t)(16 + (row * 200) / height);
+        if (bar + 16 <= width)
+            memset(y + bar, 235, 16);
+    }
+    memset(dst + width * height, 128, width * height / 2);
+}
+
+static bool replay_frame(FILE *f, uint8_t *dst, size_t size)
+{
+    if (fread(dst, 1, size, f) == size)
+        return true;
+    rewind(f);
+    return fread(dst, 1, size, f) == size;
+}
+
+extern "C" void *cam_frame(void *data)
+{
+    LOGV("cam_frame E");
+    camframe_terminated = false;
+
+    const char *path = getenv("FAKECAM_FRAMES");
+    FILE *replay = path ? fopen(path, "rb") : NULL;
+    if (path && !replay)
+        LOGE("cannot open %s, using synthetic frames", path);
+
+    int fps = fakecam::config("FAKECAM_FPS", 30);
+    nsecs_t interval = s2ns(1) / (fps > 0 ? fps : 30);
+    nsecs_t next = systemTime();
+    int n = 0;
+
+    while (fakecam::wait_preview(&camframe_terminated)) {
+        struct msm_pmem_info buffers[MAX_PREVIEW_BUFFERS];
+        int count = fakecam::preview_buffers(buffers, MAX_PREVIEW_BUFFERS);
+        int width, height;
+        fakecam::preview_dimensions(&width, &height);
+
+        // Keep the cadence, but do not burst to catch up after a stall.
+        nsecs_t now = systemTime();
+        if (next > now)
+            usleep(ns2us(next - now));
+        else
+            next = now;
+        next += interval;
+
+        size_t size = width * height * 3 / 2;
+        if (count == 0 || size == 0)
+            continue;
+        struct msm_pmem_info *buffer = &buffers[n % count];
+        if (size > buffer->len)
+            continue;
+
+        uint8_t *dst = (uint8_t *)buffer->vaddr;
+        if (!replay || !replay_frame(replay, dst, size))
+            synthesize_frame(dst, width, height, n);
+        nsecs_t captured = systemTime();
+        int delay = fakecam::config("FAKECAM_FRAME_DELAY_MS", 0);
+        if (delay > 0)
+            usleep(delay * 1000);
+
+        struct msm_frame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.path = MSM_FRAME_ENC;
+        frame.buffer = (unsigned long)buffer->vaddr;
+        frame.y_off = buffer->y_off;
+        frame.cbcr_off = buffer->cbcr_off;
+        frame.fd = buffer->fd;
+
+        record_frame_time(buffer->vaddr, captured, systemTime());
+        if (mmcamera_camframe_callback)
+            mmcamera_camframe_callback(&frame);
+        n++;
+    }
+
+    if (replay)
+        fclose(replay);
+    LOGV("cam_frame X: %d frames", n);
+    return NULL;
+}
+
+extern "C" int camframe_terminate(void)
+{
+    camframe_terminated = true;
+    fakecam::kick_preview();
+    return 0;
+}
+
+// The control commands are answered by the driver half as they arrive, so
+// there is no config thread to run.
+extern "C" void *cam_conf(void *data)
+{
+    return NULL;
+}
+
+extern "C" int launch_cam_conf_thread(void)
+{
+    return 0;
+}
+
+extern "C" int release_cam_conf_thread(void)
+{
+    return 0;
+}
+
+extern "C" const camera_size_type *default_sensor_get_snapshot_sizes(int *len)
+{
+    *len = sizeof(snapshot_sizes) / sizeof(snapshot_sizes[0]);
+    return snapshot_sizes;
+}
+
+extern "C" int8_t zoom_crop_upscale(uint32_t width, uint32_t height,
+                                    uint32_t cropped_width,
+                                    uint32_t cropped_height,
+                                    uint8_t *img_buf)
+{
+    LOGW("zoom_crop_upscale: not emulated");
+    return false;
+}
+
+void fakecam::deliver_shutter(common_crop_t *crop)
+{
+    if (mmcamera_shutter_callback)
+        mmcamera_shutter_callback(crop);
+}
+
+// JPEG encoding, with the same contract as the DSP encoder.
+
+static SoftJpegAdapter *encoder;
+
+static void jpeg_fragment(const uint8_t *buf, uint32_t size, void *user)
+{
+    if (mmcamera_jpegfragment_callback)
+        mmcamera_jpegfragment_callback((uint8_t *)buf, size);
+}
+
+static void jpeg_done(bool success, void *user)
+{
+    if (mmcamera_jpeg_callback)
+        mmcamera_jpeg_callback(success ? JPEG_EVENT_DONE : JPEG_EVENT_ERROR);
+}
+
+static SoftJpegAdapter *get_encoder()
+{
+    if (encoder == NULL)
+        encoder = new SoftJpegAdapter(jpeg_fragment, jpeg_done);
+    return encoder;
+}
+
+extern "C" bool jpeg_encoder_init()
+{
+    return get_encoder()->init(fakecam::config("FAKECAM_JPEG_THREADS", 1));
+}
+
+extern "C" void jpeg_encoder_join()
+{
+    if (encoder)
+        encoder->join();
+}
+
+extern "C" bool jpeg_encoder_encode(const cam_ctrl_dimension_t *dimen,
+                                    const uint8_t *thumbnailbuf,
+                                    int thumbnailfd,
+                                    const uint8_t *snapshotbuf,
+                                    int snapshotfd,
+                                    common_crop_t *scaling_parms)
+{
+    return get_encoder()->encode(dimen, thumbnailbuf, snapshotbuf,
+                                 scaling_parms);
+}
+
+extern "C" int8_t jpeg_encoder_setMainImageQuality(uint32_t quality)
+{
+    return get_encoder()->setMainImageQuality(quality);
+}
+
+extern "C" int8_t jpeg_encoder_setThumbnailQuality(uint32_t quality)
+{
+    return get_encoder()->setThumbnailQuality(quality);
+}
+
+extern "C" int8_t jpeg_encoder_setRotation(uint32_t rotation)
+{
+    return get_encoder()->setRotation(rotation);
+}
+
+extern "C" int8_t jpeg_encoder_setLocation(const camera_position_type *pt)
+{
+    return get_encoder()->setLocation(pt);
+}
@@ -19,6 +19,8 @@
 #include <utils/Log.h>
 
 #include "QualcommCameraHardware.h"
+#include "SoftJpegAdapter.h"
+#include "CameraTrace.h"
 
 #include <utils/Errors.h>
 #include <utils/threads.h>
@@ -64,6 +66,17 @@ extern "C" {
 #define DEFAULT_PICTURE_HEIGHT 1536
 #define THUMBNAIL_BUFFER_SIZE (THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * 3/2)
 #define MAX_ZOOM_LEVEL 5
+#define ZOOM_STEP 6
+#define SMOOTH_ZOOM_STEP_MS 33
+#define CAF_MIN_INTERVAL_MS 1000    // between continuous focus sweeps
+#define CAF_CAPTURE_WAIT_MS 2000    // for a running sweep, on capture
+#define CAF_SAMPLE_FRAMES 3         // preview frames per scene sample
+#define CAF_SAMPLE_STEP 8           // pixels between luma samples
+#define CAF_SCENE_THRESHOLD 12      // mean zone luma difference
+#define CAF_SCENE_FRAMES 2          // samples over the threshold
+#define STAGED_PREPARE_MS 3000      // a staged prepare_snapshot goes stale
+#define STANDBY_POLL_MS 500         // memory checks while parked
+#define STANDBY_MIN_FREE_KB 16384   // free + cached to stay parked
 #define NOT_FOUND -1
 
 #if DLOPEN_LIBMMCAMERA
@@ -118,6 +131,43 @@ extern void (*mmcamera_shutter_callback)(common_crop_t *crop);
 
 } // extern "C"
 
+#if DLOPEN_LIBMMCAMERA
+// Everything the HAL looks up in liboemcamera.  The addresses are resolved
+// by the first open in the process, which also keeps the library loaded
+// from then on (see startCamera()), so later opens only copy them.
+#define LINK_SYMBOLS(X) \
+    X(cam_frame) \
+    X(camframe_terminate) \
+    X(jpeg_encoder_init) \
+    X(jpeg_encoder_encode) \
+    X(jpeg_encoder_join) \
+    X(mmcamera_camframe_callback) \
+    X(mmcamera_jpegfragment_callback) \
+    X(mmcamera_jpeg_callback) \
+    X(mmcamera_shutter_callback) \
+    X(jpeg_encoder_setMainImageQuality) \
+    X(jpeg_encoder_setThumbnailQuality) \
+    X(jpeg_encoder_setRotation) \
+    X(jpeg_encoder_setLocation) \
+    X(cam_conf) \
+    X(default_sensor_get_snapshot_sizes) \
+    X(launch_cam_conf_thread) \
+    X(release_cam_conf_thread) \
+    X(zoom_crop_upscale)
+
+#define LINK_SYMBOL_ENTRY(name) { #name, (void **)&LINK_##name },
+
+struct link_symbol {
+    const char *name;
+    void **link;
+};
+
+static const link_symbol link_symbols[] = { LINK_SYMBOLS(LINK_SYMBOL_ENTRY) };
+#define LINK_SYMBOL_COUNT (sizeof(link_symbols) / sizeof(link_symbols[0]))
+static void *link_symbol_values[LINK_SYMBOL_COUNT];
+static void *libmmcamera_resident;
+#endif
+
 #ifndef HAVE_CAMERA_SIZE_TYPE
 struct camera_size_type {
     int width;
@@ -125,36 +175,38 @@ struct camera_size_type {
 };
 #endif
 
+// The parameter tables below are written as X-macros so that the same list
+// expands both into the lookup table and, through string-literal
+// concatenation, into the comma-separated supported-values string.  The
+// "," prefix of the first entry is skipped with [1].
+#define SIZE_ENTRY(w, h) { w, h },
+#define SIZE_STR(w, h) "," #w "x" #h
+#define STR_MAP_ENTRY(desc, val) { desc, val },
+#define STR_MAP_STR(desc, val) "," desc
+
 #define DEFAULT_PREVIEW_SETTING 2
+#define PREVIEW_SIZES(X) \
+    X(1280, 720) /* 720P, reserved */ \
+    X(800, 480)  /* WVGA */ \
+    X(720, 480) \
+    X(640, 480)  /* VGA */ \
+    X(576, 432) \
+    X(480, 320)  /* HVGA */ \
+    X(384, 288) \
+    X(352, 288)  /* CIF */ \
+    X(320, 240)  /* QVGA */ \
+    X(240, 160)  /* SQVGA */ \
+    X(176, 144)  /* QCIF */
+
 static const camera_size_type preview_sizes[] = {
-    { 1280, 720 }, // 720P, reserved
-    { 800, 480 }, // WVGA
-    { 720, 480 },
-    { 640, 480 }, // VGA
-    { 576, 432 },
-    { 480, 320 }, // HVGA
-    { 384, 288 },
-    { 352, 288 }, // CIF
-    { 320, 240 }, // QVGA
-    { 240, 160 }, // SQVGA
-    { 176, 144 }, // QCIF
+    PREVIEW_SIZES(SIZE_ENTRY)
 };
 #define PREVIEW_SIZE_COUNT (sizeof(preview_sizes)/sizeof(camera_size_type))
+static const char *const preview_size_values = &(PREVIEW_SIZES(SIZE_STR))[1];
 
 static const camera_size_type* picture_sizes;
 static int PICTURE_SIZE_COUNT;
 
-static int attr_lookup(const str_map arr[], int len, const char *name)
-{
-    if (name) {
-        for (int i = 0; i < len; i++) {
-            if (!strcmp(arr[i].desc, name))
-                return arr[i].val;
-        }
-    }
-    return NOT_FOUND;
-}
-
 // round to the next power of two
 static inline unsigned clp2(unsigned x)
 {
@@ -167,36 +219,135 @@ static inline unsigned clp2(unsigned x)
     return x + 1;
 }
 
+// A hash index over a small table, with a seed chosen when the index is
+// built so that every entry gets a slot of its own.  A lookup is then one
+// hash and one comparison against the entry in that slot.
+#define PARAM_INDEX_SLOTS 64
+
+struct param_index {
+    bool built;
+    uint32_t seed;
+    uint32_t mask;
+    int8_t slot[PARAM_INDEX_SLOTS];
+};
+
+static inline uint32_t hash_str(uint32_t seed, const char *str)
+{
+    uint32_t h = 2166136261u ^ seed; // FNV-1a
+    while (*str) {
+        h ^= (uint8_t)*str++;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static inline uint32_t hash_size(uint32_t seed, int width, int height)
+{
+    uint32_t h = (((uint32_t)width << 16) | (uint32_t)height) ^
+        (seed * 0x9e3779b9u);
+    h ^= h >> 16; // murmur3 finalizer
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    return h ^ (h >> 16);
+}
+
+static uint32_t hash_str_map_entry(uint32_t seed, const void *table, int i)
+{
+    return hash_str(seed, ((const str_map *)table)[i].desc);
+}
+
+static uint32_t hash_size_entry(uint32_t seed, const void *table, int i)
+{
+    const camera_size_type *size = &((const camera_size_type *)table)[i];
+    return hash_size(seed, size->width, size->height);
+}
+
+static bool build_param_index(param_index *index,
+                              const void *table, int len,
+                              uint32_t (*hash_entry)(uint32_t seed,
+                                                     const void *table,
+                                                     int i))
+{
+    index->built = false;
+    if (len <= 0 || len > PARAM_INDEX_SLOTS)
+        return false;
+
+    unsigned slots = clp2(len * 2);
+    if (slots > PARAM_INDEX_SLOTS)
+        slots = PARAM_INDEX_SLOTS;
+    index->mask = slots - 1;
+
+    for (uint32_t seed = 0; seed < 4096; seed++) {
+        int i;
+        memset(index->slot, -1, sizeof(index->slot));
+        for (i = 0; i < len; i++) {
+            uint32_t slot = hash_entry(seed, table, i) & index->mask;
+            if (index->slot[slot] >= 0)
+                break;
+            index->slot[slot] = i;
+        }
+        if (i == len) {
+            index->seed = seed;
+            index->built = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the position of width x height in sizes, or NOT_FOUND.
+static int lookup_size(const param_index *index,
+                       const camera_size_type *sizes, int len,
+                       int width, int height)
+{
+    if (index->built) {
+        int i = index->slot[hash_size(index->seed, width, height) &
+                            index->mask];
+        return (i >= 0 && i < len && sizes[i].width == width &&
+                sizes[i].height == height) ? i : NOT_FOUND;
+    }
+    for (int i = 0; i < len; i++)
+        if (sizes[i].width == width && sizes[i].height == height)
+            return i;
+    return NOT_FOUND;
+}
+
 namespace android {
+// The strings are the values of the CameraParameters constants; they are
+// spelled out because the supported-values strings are built from them at
+// compile time.
+
 // from aeecamera.h
-static const str_map whitebalance[] = {
-    { CameraParameters::WHITE_BALANCE_AUTO,            CAMERA_WB_AUTO },
-    { CameraParameters::WHITE_BALANCE_INCANDESCENT,    CAMERA_WB_INCANDESCENT },
-    { CameraParameters::WHITE_BALANCE_FLUORESCENT,     CAMERA_WB_FLUORESCENT },
-    { CameraParameters::WHITE_BALANCE_DAYLIGHT,        CAMERA_WB_DAYLIGHT },
-    { CameraParameters::WHITE_BALANCE_CLOUDY_DAYLIGHT, CAMERA_WB_CLOUDY_DAYLIGHT }
-};
+#define WHITE_BALANCE_MODES(X) \
+    X("auto",            CAMERA_WB_AUTO) \
+    X("incandescent",    CAMERA_WB_INCANDESCENT) \
+    X("fluorescent",     CAMERA_WB_FLUORESCENT) \
+    X("daylight",        CAMERA_WB_DAYLIGHT) \
+    X("cloudy-daylight", CAMERA_WB_CLOUDY_DAYLIGHT)
 
 // from camera_effect_t. This list must match aeecamera.h
-static const str_map effects[] = {
-    { CameraParameters::EFFECT_NONE,       CAMERA_EFFECT_OFF },
-    { CameraParameters::EFFECT_MONO,       CAMERA_EFFECT_MONO },
-    { CameraParameters::EFFECT_NEGATIVE,   CAMERA_EFFECT_NEGATIVE },
-    { CameraParameters::EFFECT_SOLARIZE,   CAMERA_EFFECT_SOLARIZE },
-    { CameraParameters::EFFECT_SEPIA,      CAMERA_EFFECT_SEPIA },
-    { CameraParameters::EFFECT_POSTERIZE,  CAMERA_EFFECT_POSTERIZE },
-    { CameraParameters::EFFECT_WHITEBOARD, CAMERA_EFFECT_WHITEBOARD },
-    { CameraParameters::EFFECT_BLACKBOARD, CAMERA_EFFECT_BLACKBOARD },
-    { CameraParameters::EFFECT_AQUA,       CAMERA_EFFECT_AQUA }
-};
+#define EFFECTS(X) \
+    X("none",       CAMERA_EFFECT_OFF) \
+    X("mono",       CAMERA_EFFECT_MONO) \
+    X("negative",   CAMERA_EFFECT_NEGATIVE) \
+    X("solarize",   CAMERA_EFFECT_SOLARIZE) \
+    X("sepia",      CAMERA_EFFECT_SEPIA) \
+    X("posterize",  CAMERA_EFFECT_POSTERIZE) \
+    X("whiteboard", CAMERA_EFFECT_WHITEBOARD) \
+    X("blackboard", CAMERA_EFFECT_BLACKBOARD) \
+    X("aqua",       CAMERA_EFFECT_AQUA)
 
 // from qcamera/common/camera.h
-static const str_map antibanding[] = {
-    { CameraParameters::ANTIBANDING_OFF,  CAMERA_ANTIBANDING_OFF },
-    { CameraParameters::ANTIBANDING_50HZ, CAMERA_ANTIBANDING_50HZ },
-    { CameraParameters::ANTIBANDING_60HZ, CAMERA_ANTIBANDING_60HZ },
-    { CameraParameters::ANTIBANDING_AUTO, CAMERA_ANTIBANDING_AUTO }
-};
+#define ANTIBANDING_MODES(X) \
+    X("off",  CAMERA_ANTIBANDING_OFF) \
+    X("50hz", CAMERA_ANTIBANDING_50HZ) \
+    X("60hz", CAMERA_ANTIBANDING_60HZ) \
+    X("auto", CAMERA_ANTIBANDING_AUTO)
+
+static const str_map whitebalance[] = { WHITE_BALANCE_MODES(STR_MAP_ENTRY) };
+static const str_map effects[] = { EFFECTS(STR_MAP_ENTRY) };
+static const str_map antibanding[] = { ANTIBANDING_MODES(STR_MAP_ENTRY) };
 
 /* Mapping from MCC to antibanding type */
 struct country_map {
@@ -436,25 +587,94 @@ static camera_antibanding_type camera_get_location(void) {
 
 // from camera.h, led_mode_t
 #define DONT_CARE 0
-static const str_map flash[] = {
-    { CameraParameters::FLASH_MODE_OFF,  DONT_CARE },
-    { CameraParameters::FLASH_MODE_AUTO, DONT_CARE },
-    { CameraParameters::FLASH_MODE_ON, DONT_CARE }
+#define FLASH_MODES(X) \
+    X("off",  DONT_CARE) \
+    X("auto", DONT_CARE) \
+    X("on",   DONT_CARE)
+
+// Focus modes as autoFocus() and the AF worker see them.
+enum {
+    FOCUS_AUTO,
+    FOCUS_INFINITY,
+    FOCUS_CONTINUOUS
+};
+
+#define FOCUS_MODES(X) \
+    X("auto",     FOCUS_AUTO) \
+    X("infinity", FOCUS_INFINITY) \
+    X(QCAMERA_FOCUS_MODE_CONTINUOUS, FOCUS_CONTINUOUS)
+
+static const str_map flash[] = { FLASH_MODES(STR_MAP_ENTRY) };
+static const str_map focus_modes[] = { FOCUS_MODES(STR_MAP_ENTRY) };
+
+// Parameter schema: every enumerated parameter with its key, the key of its
+// supported values, the table it is validated against, and that table's
+// prebuilt supported-values string.  The hash indices are built once per
+// process.
+enum {
+    PARAM_WHITE_BALANCE,
+    PARAM_EFFECT,
+    PARAM_ANTIBANDING,
+    PARAM_FLASH,
+    PARAM_FOCUS_MODE,
+    PARAM_COUNT
+};
+
+struct str_param {
+    const char *key;
+    const char *supported_key;
+    const str_map *map;
+    int len;
+    const char *values;
+    param_index index;
 };
 
-static const str_map focus_modes[] = {
-    { CameraParameters::FOCUS_MODE_AUTO,     DONT_CARE },
-    { CameraParameters::FOCUS_MODE_INFINITY, DONT_CARE }
+#define STR_PARAM(key, supported_key, map, list) \
+    { key, supported_key, map, sizeof(map) / sizeof(str_map), \
+      &(list(STR_MAP_STR))[1] }
+
+static str_param str_params[PARAM_COUNT] = {
+    STR_PARAM(CameraParameters::KEY_WHITE_BALANCE,
+              CameraParameters::KEY_SUPPORTED_WHITE_BALANCE,
+              whitebalance, WHITE_BALANCE_MODES),
+    STR_PARAM(CameraParameters::KEY_EFFECT,
+              CameraParameters::KEY_SUPPORTED_EFFECTS,
+              effects, EFFECTS),
+    STR_PARAM(CameraParameters::KEY_ANTIBANDING,
+              CameraParameters::KEY_SUPPORTED_ANTIBANDING,
+              antibanding, ANTIBANDING_MODES),
+    STR_PARAM(CameraParameters::KEY_FLASH_MODE,
+              CameraParameters::KEY_SUPPORTED_FLASH_MODES,
+              flash, FLASH_MODES),
+    STR_PARAM(CameraParameters::KEY_FOCUS_MODE,
+              CameraParameters::KEY_SUPPORTED_FOCUS_MODES,
+              focus_modes, FOCUS_MODES),
 };
 
+static int lookup_str_param(int param, const char *name)
+{
+    const str_param *p = &str_params[param];
+    if (name == NULL)
+        return NOT_FOUND;
+    if (p->index.built) {
+        int i = p->index.slot[hash_str(p->index.seed, name) & p->index.mask];
+        return (i >= 0 && !strcmp(p->map[i].desc, name)) ?
+            p->map[i].val : NOT_FOUND;
+    }
+    for (int i = 0; i < p->len; i++)
+        if (!strcmp(p->map[i].desc, name))
+            return p->map[i].val;
+    return NOT_FOUND;
+}
+
 static bool parameter_string_initialized = false;
-static String8 preview_size_values;
 static String8 picture_size_values;
-static String8 antibanding_values;
-static String8 effect_values;
-static String8 whitebalance_values;
-static String8 flash_values;
-static String8 focus_mode_values;
+static bool default_parameters_initialized = false;
+static CameraParameters default_parameters;
+static bool sensor_info_cached = false;
+static struct msm_camsensor_info sensor_info;
+static param_index preview_size_index;
+static param_index picture_size_index;
 
 static String8 create_sizes_str(const camera_size_type *sizes, int len) {
     String8 str;
@@ -471,40 +691,214 @@ static String8 create_sizes_str(const camera_size_type *sizes, int len) {
     return str;
 }
 
-static String8 create_values_str(const str_map *values, int len) {
-    String8 str;
-
-    if (len > 0) {
-        str.append(values[0].desc);
-    }
-    for (int i = 1; i < len; i++) {
-        str.append(",");
-        str.append(values[i].desc);
-    }
-    return str;
-}
-
 static Mutex singleton_lock;
 static bool singleton_releasing;
+
+// Camera open latency, from createInstance() entry to the defaults being
+// applied; under singleton_lock.  The first open of the process is the
+// cold one.
+static struct {
+    int count;
+    nsecs_t first;
+    nsecs_t last;
+    nsecs_t total;
+    nsecs_t max;
+    nsecs_t waited;     // for the previous release
+} open_stats;
+
+static void record_open_time(nsecs_t elapsed, nsecs_t waited)
+{
+    if (open_stats.count++ == 0)
+        open_stats.first = elapsed;
+    open_stats.last = elapsed;
+    open_stats.total += elapsed;
+    if (elapsed > open_stats.max)
+        open_stats.max = elapsed;
+    open_stats.waited += waited;
+    LOGI("camera opened in %lld ms (%lld ms waiting for release)",
+         ns2ms(elapsed), ns2ms(waited));
+}
 static Condition singleton_wait;
 
+// Warm standby state (see park()); under singleton_lock.
+static sp<QualcommCameraHardware> standby_instance;
+static nsecs_t standby_deadline;
+static bool standby_thread_running;
+static Condition standby_wait;
+void *standby_thread(void *user);
+void *release_thread(void *user);
+static struct {
+    int parked;
+    int resumed;
+    int expired;
+    int lowMemory;
+} standby_stats;
+
+// Background teardown time, from release() to endRelease(); under
+// singleton_lock.
+static struct {
+    int count;
+    nsecs_t total;
+    nsecs_t max;
+} release_stats;
+
+// Whether there is memory to spare for a parked camera: free plus page
+// cache, from /proc/meminfo.
+static bool standby_memory_available()
+{
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo == NULL)
+        return true;
+    char line[128];
+    long available = 0, kb;
+    while (fgets(line, sizeof(line), meminfo)) {
+        if (sscanf(line, "MemFree: %ld kB", &kb) == 1 ||
+            sscanf(line, "Cached: %ld kB", &kb) == 1)
+            available += kb;
+    }
+    fclose(meminfo);
+    return available >= STANDBY_MIN_FREE_KB;
+}
+
 static void receive_camframe_callback(struct msm_frame *frame);
 static void receive_jpeg_fragment_callback(uint8_t *buff_ptr, uint32_t buff_size);
 static void receive_jpeg_callback(jpeg_event_t status);
 static void receive_shutter_callback(common_crop_t *crop);
 
+#if DLOPEN_LIBMMCAMERA
+// In-tree software JPEG encoder.  It is plugged in behind the
+// LINK_jpeg_encoder_* pointers when persist.camera.jpeg.encoder is "soft",
+// when liboemcamera does not export the encoder, or when the DSP encoder
+// fails to initialize, and reports through the same fragment and completion
+// callbacks.
+static SoftJpegAdapter *soft_jpeg_encoder;
+static bool soft_jpeg_encoder_selected;
+
+static void soft_jpeg_fragment_callback(const uint8_t *buf, uint32_t size,
+                                        void *user)
+{
+    receive_jpeg_fragment_callback((uint8_t *)buf, size);
+}
+
+static void soft_jpeg_done_callback(bool success, void *user)
+{
+    receive_jpeg_callback(success ? JPEG_EVENT_DONE : JPEG_EVENT_ERROR);
+}
+
+static bool soft_jpeg_encoder_init()
+{
+    if (soft_jpeg_encoder == NULL)
+        soft_jpeg_encoder = new SoftJpegAdapter(soft_jpeg_fragment_callback,
+                                                soft_jpeg_done_callback);
+
+    char value[PROP_VALUE_MAX];
+    int threads = 0;
+    if (__system_property_get("persist.camera.jpeg.threads", value))
+        threads = atoi(value);
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    return soft_jpeg_encoder->init(threads);
+}
+
+static void soft_jpeg_encoder_join()
+{
+    if (soft_jpeg_encoder)
+        soft_jpeg_encoder->join();
+}
+
+static bool soft_jpeg_encoder_encode(const cam_ctrl_dimension_t *dimen,
+                                     const uint8_t *thumbnailbuf,
+                                     int thumbnailfd,
+                                     const uint8_t *snapshotbuf,
+                                     int snapshotfd,
+                                     common_crop_t *scaling_parms)
+{
+    return soft_jpeg_encoder->encode(dimen, thumbnailbuf, snapshotbuf,
+                                     scaling_parms);
+}
+
+static int8_t soft_jpeg_encoder_setMainImageQuality(uint32_t quality)
+{
+    return soft_jpeg_encoder->setMainImageQuality(quality);
+}
+
+static int8_t soft_jpeg_encoder_setThumbnailQuality(uint32_t quality)
+{
+    return soft_jpeg_encoder->setThumbnailQuality(quality);
+}
+
+static int8_t soft_jpeg_encoder_setRotation(uint32_t rotation)
+{
+    return soft_jpeg_encoder->setRotation(rotation);
+}
+
+static int8_t soft_jpeg_encoder_setLocation(const camera_position_type *pt)
+{
+    return soft_jpeg_encoder->setLocation(pt);
+}
+
+static void select_soft_jpeg_encoder()
+{
+    LOGI("using the software JPEG encoder");
+    LINK_jpeg_encoder_init = soft_jpeg_encoder_init;
+    LINK_jpeg_encoder_join = soft_jpeg_encoder_join;
+    LINK_jpeg_encoder_encode = soft_jpeg_encoder_encode;
+    LINK_jpeg_encoder_setMainImageQuality =
+        soft_jpeg_encoder_setMainImageQuality;
+    LINK_jpeg_encoder_setThumbnailQuality =
+        soft_jpeg_encoder_setThumbnailQuality;
+    LINK_jpeg_encoder_setRotation = soft_jpeg_encoder_setRotation;
+    LINK_jpeg_encoder_setLocation = soft_jpeg_encoder_setLocation;
+    soft_jpeg_encoder_selected = true;
+}
+#endif // DLOPEN_LIBMMCAMERA
+
 QualcommCameraHardware::QualcommCameraHardware()
     : mParameters(),
+      mParametersVersion(0),
       mCameraRunning(false),
       mPreviewInitialized(false),
       mFrameThreadRunning(false),
       mSnapshotThreadRunning(false),
+      mSnapshotThreadRestart(false),
+      mCaptureState(CAPTURE_IDLE),
+      mCaptureCancelled(false),
+      mCaptureQueued(false),
+      mPrepareCaptureMode(false),
+      mCaptureStaged(false),
+      mStagedJpegHeap(false),
+      mStageStart(0),
+      mStageEnd(0),
+      mStageRequested(0),
+      mStageSaved(0),
+      mParked(false),
+      mReleasing(false),
+      mReleaseStart(0),
+      mSmoothZoomRunning(false),
+      mSmoothZoomStopping(false),
+      mSmoothZoomTarget(0),
+      mShotCount(0),
+      mPendingParmCount(0),
+      mSentParmCount(0),
+      mParmsForceApply(true),
       mReleasedRecordingFrame(false),
       mPreviewFrameSize(0),
       mRawSize(0),
       mCameraControlFd(-1),
       mAutoFocusThreadRunning(false),
+      mAutoFocusExiting(false),
+      mAutoFocusPending(false),
+      mAutoFocusActive(false),
+      mAutoFocusNotify(false),
+      mAutoFocusMode(-1),
       mAutoFocusFd(-1),
+      mContinuousFocusMode(false),
+      mContinuousFocus(false),
+      mFocusConverged(false),
+      mLastFocusSweep(0),
+      mFocusZonesValid(false),
+      mSceneChangeFrames(0),
+      mFocusFrameCount(0),
       mInPreviewCallback(false),
       mMsgEnabled(0),
       mNotifyCallback(0),
@@ -513,7 +907,12 @@ QualcommCameraHardware::QualcommCameraHardware()
       mCallbackCookie(0)
 {
     memset(&mDimension, 0, sizeof(mDimension));
+    memset(&mCaptureDimension, 0, sizeof(mCaptureDimension));
+    memset(&mFocusStats, 0, sizeof(mFocusStats));
+    memset(&mPrepareStats, 0, sizeof(mPrepareStats));
     memset(&mCrop, 0, sizeof(mCrop));
+    memset(mShotProfiles, 0, sizeof(mShotProfiles));
+    memset(&mParameterStats, 0, sizeof(mParameterStats));
     LOGV("constructor EX");
 }
 
@@ -521,77 +920,89 @@ void QualcommCameraHardware::initDefaultParameters()
 {
     LOGV("initDefaultParameters E");
 
-    // Initialize constant parameter strings. This will happen only once in the
-    // lifetime of the mediaserver process.
+    // Initialize the picture size string, which depends on the sensor, and
+    // the lookup indices. This will happen only once in the lifetime of the
+    // mediaserver process.
     if (!parameter_string_initialized) {
-        antibanding_values = create_values_str(
-            antibanding, sizeof(antibanding) / sizeof(str_map));
-        effect_values = create_values_str(
-            effects, sizeof(effects) / sizeof(str_map));
-        whitebalance_values = create_values_str(
-            whitebalance, sizeof(whitebalance) / sizeof(str_map));
-        preview_size_values = create_sizes_str(
-            preview_sizes, PREVIEW_SIZE_COUNT);
         picture_size_values = create_sizes_str(
             picture_sizes, PICTURE_SIZE_COUNT);
-        flash_values = create_values_str(
-            flash, sizeof(flash) / sizeof(str_map));
-        focus_mode_values = create_values_str(
-            focus_modes, sizeof(focus_modes) / sizeof(str_map));
+        for (int i = 0; i < PARAM_COUNT; i++) {
+            if (!build_param_index(&str_params[i].index, str_params[i].map,
+                                   str_params[i].len, hash_str_map_entry))
+                LOGW("no hash index for %s", str_params[i].key);
+        }
+        build_param_index(&preview_size_index, preview_sizes,
+                          PREVIEW_SIZE_COUNT, hash_size_entry);
+        build_param_index(&picture_size_index, picture_sizes,
+                          PICTURE_SIZE_COUNT, hash_size_entry);
         parameter_string_initialized = true;
     }
 
+    // The defaults depend only on the sensor, so they too are built once
+    // per process.  Copies of a CameraParameters share its storage.
     const camera_size_type *ps = &preview_sizes[DEFAULT_PREVIEW_SETTING];
-    mParameters.setPreviewSize(ps->width, ps->height);
-    mDimension.display_width = ps->width;
-    mDimension.display_height = ps->height;
-    mParameters.setPreviewFrameRate(15);
-    mParameters.setPreviewFormat("yuv420sp"); // informative
+    if (default_parameters_initialized) {
+        mParameters = default_parameters;
+    } else {
+        mParameters.setPreviewSize(ps->width, ps->height);
+        mParameters.setPreviewFrameRate(15);
+        mParameters.setPreviewFormat("yuv420sp"); // informative
+
+        mParameters.setPictureSize(DEFAULT_PICTURE_WIDTH,
+                                   DEFAULT_PICTURE_HEIGHT);
+        mParameters.setPictureFormat("jpeg"); // informative
+
+        // max quality
+        mParameters.set(CameraParameters::KEY_JPEG_QUALITY, "100");
+        mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH,
+                        THUMBNAIL_WIDTH_STR); // informative
+        mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT,
+                        THUMBNAIL_HEIGHT_STR); // informative
+        mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY, "90");
+
+        mParameters.set(CameraParameters::KEY_ANTIBANDING,
+                        CameraParameters::ANTIBANDING_AUTO);
+        mParameters.set(CameraParameters::KEY_EFFECT,
+                        CameraParameters::EFFECT_NONE);
+        mParameters.set(CameraParameters::KEY_WHITE_BALANCE,
+                        CameraParameters::WHITE_BALANCE_AUTO);
+        mParameters.set(CameraParameters::KEY_FOCUS_MODE,
+                        CameraParameters::FOCUS_MODE_AUTO);
+        mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FORMATS,
+                        "yuv420sp");
+        mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES,
+                        preview_size_values);
+        mParameters.set(CameraParameters::KEY_SUPPORTED_PICTURE_SIZES,
+                        picture_size_values.string());
+        for (int i = 0; i < PARAM_COUNT; i++) {
+            if (i != PARAM_FLASH || mSensorInfo.flash_enabled)
+                mParameters.set(str_params[i].supported_key,
+                                str_params[i].values);
+        }
+
+        if (mSensorInfo.flash_enabled) {
+            mParameters.set(CameraParameters::KEY_FLASH_MODE,
+                            CameraParameters::FLASH_MODE_OFF);
+        }
 
-    mParameters.setPictureSize(DEFAULT_PICTURE_WIDTH, DEFAULT_PICTURE_HEIGHT);
-    mParameters.setPictureFormat("jpeg"); // informative
+        mParameters.set("zoom-supported", "true");
+        mParameters.set("max-zoom", MAX_ZOOM_LEVEL);
+        mParameters.set("zoom", 0);
+        mParameters.set("smooth-zoom-supported", "true");
+        mParameters.set("prepare-capture", "false");
+
+        // Without the sensor info the flash settings are guesses, so they
+        // are built again by the next open.
+        if (sensor_info_cached) {
+            default_parameters = mParameters;
+            default_parameters_initialized = true;
+        }
+    }
 
-    mParameters.set(CameraParameters::KEY_JPEG_QUALITY, "100"); // max quality
-    mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH,
-                    THUMBNAIL_WIDTH_STR); // informative
-    mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT,
-                    THUMBNAIL_HEIGHT_STR); // informative
+    mDimension.display_width = ps->width;
+    mDimension.display_height = ps->height;
     mDimension.ui_thumbnail_width = THUMBNAIL_WIDTH;
     mDimension.ui_thumbnail_height = THUMBNAIL_HEIGHT;
-    mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY, "90");
-
-    mParameters.set(CameraParameters::KEY_ANTIBANDING,
-                    CameraParameters::ANTIBANDING_AUTO);
-    mParameters.set(CameraParameters::KEY_EFFECT,
-                    CameraParameters::EFFECT_NONE);
-    mParameters.set(CameraParameters::KEY_WHITE_BALANCE,
-                    CameraParameters::WHITE_BALANCE_AUTO);
-    mParameters.set(CameraParameters::KEY_FOCUS_MODE,
-                    CameraParameters::FOCUS_MODE_AUTO);
-    mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FORMATS,
-                    "yuv420sp");
-    mParameters.set(CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES,
-                    preview_size_values.string());
-    mParameters.set(CameraParameters::KEY_SUPPORTED_PICTURE_SIZES,
-                    picture_size_values.string());
-    mParameters.set(CameraParameters::KEY_SUPPORTED_ANTIBANDING,
-                    antibanding_values);
-    mParameters.set(CameraParameters::KEY_SUPPORTED_EFFECTS, effect_values);
-    mParameters.set(CameraParameters::KEY_SUPPORTED_WHITE_BALANCE,
-                    whitebalance_values);
-    mParameters.set(CameraParameters::KEY_SUPPORTED_FOCUS_MODES,
-                    focus_mode_values);
-
-    if (mSensorInfo.flash_enabled) {
-        mParameters.set(CameraParameters::KEY_FLASH_MODE,
-                        CameraParameters::FLASH_MODE_OFF);
-        mParameters.set(CameraParameters::KEY_SUPPORTED_FLASH_MODES,
-                        flash_values);
-    }
-
-    mParameters.set("zoom-supported", "true");
-    mParameters.set("max-zoom", MAX_ZOOM_LEVEL);
-    mParameters.set("zoom", 0);
 
     if (setParameters(mParameters) != NO_ERROR) {
         LOGE("Failed to set default parameters?!");
@@ -613,66 +1024,34 @@ bool QualcommCameraHardware::startCamera()
         return false;
     }
 
-    *(void **)&LINK_cam_frame =
-        ::dlsym(libmmcamera, "cam_frame");
-    *(void **)&LINK_camframe_terminate =
-        ::dlsym(libmmcamera, "camframe_terminate");
-
-    *(void **)&LINK_jpeg_encoder_init =
-        ::dlsym(libmmcamera, "jpeg_encoder_init");
-
-    *(void **)&LINK_jpeg_encoder_encode =
-        ::dlsym(libmmcamera, "jpeg_encoder_encode");
-
-    *(void **)&LINK_jpeg_encoder_join =
-        ::dlsym(libmmcamera, "jpeg_encoder_join");
-
-    *(void **)&LINK_mmcamera_camframe_callback =
-        ::dlsym(libmmcamera, "mmcamera_camframe_callback");
+    if (libmmcamera_resident == NULL) {
+        for (size_t i = 0; i < LINK_SYMBOL_COUNT; i++)
+            link_symbol_values[i] =
+                ::dlsym(libmmcamera, link_symbols[i].name);
+        libmmcamera_resident = ::dlopen("liboemcamera.so", RTLD_NOW);
+    }
+    for (size_t i = 0; i < LINK_SYMBOL_COUNT; i++)
+        *link_symbols[i].link = link_symbol_values[i];
 
     *LINK_mmcamera_camframe_callback = receive_camframe_callback;
-
-    *(void **)&LINK_mmcamera_jpegfragment_callback =
-        ::dlsym(libmmcamera, "mmcamera_jpegfragment_callback");
-
     *LINK_mmcamera_jpegfragment_callback = receive_jpeg_fragment_callback;
-
-    *(void **)&LINK_mmcamera_jpeg_callback =
-        ::dlsym(libmmcamera, "mmcamera_jpeg_callback");
-
     *LINK_mmcamera_jpeg_callback = receive_jpeg_callback;
-
-    *(void **)&LINK_mmcamera_shutter_callback =
-        ::dlsym(libmmcamera, "mmcamera_shutter_callback");
-
     *LINK_mmcamera_shutter_callback = receive_shutter_callback;
 
-    *(void**)&LINK_jpeg_encoder_setMainImageQuality =
-        ::dlsym(libmmcamera, "jpeg_encoder_setMainImageQuality");
-
-    *(void**)&LINK_jpeg_encoder_setThumbnailQuality =
-        ::dlsym(libmmcamera, "jpeg_encoder_setThumbnailQuality");
-
-    *(void**)&LINK_jpeg_encoder_setRotation =
-        ::dlsym(libmmcamera, "jpeg_encoder_setRotation");
-
-    *(void**)&LINK_jpeg_encoder_setLocation =
-        ::dlsym(libmmcamera, "jpeg_encoder_setLocation");
-
-    *(void **)&LINK_cam_conf =
-        ::dlsym(libmmcamera, "cam_conf");
-
-    *(void **)&LINK_default_sensor_get_snapshot_sizes =
-        ::dlsym(libmmcamera, "default_sensor_get_snapshot_sizes");
-
-    *(void **)&LINK_launch_cam_conf_thread =
-        ::dlsym(libmmcamera, "launch_cam_conf_thread");
-
-    *(void **)&LINK_release_cam_conf_thread =
-        ::dlsym(libmmcamera, "release_cam_conf_thread");
-
-    *(void **)&LINK_zoom_crop_upscale =
-        ::dlsym(libmmcamera, "zoom_crop_upscale");
+    soft_jpeg_encoder_selected = false;
+    {
+        char value[PROP_VALUE_MAX];
+        if ((__system_property_get("persist.camera.jpeg.encoder", value) &&
+             !strcmp(value, "soft")) ||
+            !LINK_jpeg_encoder_init || !LINK_jpeg_encoder_encode ||
+            !LINK_jpeg_encoder_join ||
+            !LINK_jpeg_encoder_setMainImageQuality ||
+            !LINK_jpeg_encoder_setThumbnailQuality ||
+            !LINK_jpeg_encoder_setRotation ||
+            !LINK_jpeg_encoder_setLocation) {
+            select_soft_jpeg_encoder();
+        }
+    }
 
 #else
     mmcamera_camframe_callback = receive_camframe_callback;
@@ -689,6 +1068,8 @@ bool QualcommCameraHardware::startCamera()
              strerror(errno));
         return false;
     }
+    if (!mControlQueue.start(mCameraControlFd))
+        LOGW("startCamera: control commands will run synchronously");
 
     /* This will block until the control thread is launched. After that, sensor
      * information becomes available.
@@ -699,21 +1080,34 @@ bool QualcommCameraHardware::startCamera()
         return false;
     }
 
-    memset(&mSensorInfo, 0, sizeof(mSensorInfo));
-    if (ioctl(mCameraControlFd,
-              MSM_CAM_IOCTL_GET_SENSOR_INFO,
-              &mSensorInfo) < 0)
-        LOGW("%s: cannot retrieve sensor info!", __FUNCTION__);
-    else
-        LOGI("%s: camsensor name %s, flash %d", __FUNCTION__,
-             mSensorInfo.name, mSensorInfo.flash_enabled);
+    // The sensor does not change, so neither its description nor its
+    // picture sizes are queried again once known.
+    if (!sensor_info_cached) {
+        memset(&sensor_info, 0, sizeof(sensor_info));
+        if (ioctl(mCameraControlFd,
+                  MSM_CAM_IOCTL_GET_SENSOR_INFO,
+                  &sensor_info) < 0)
+            LOGW("%s: cannot retrieve sensor info!", __FUNCTION__);
+        else {
+            LOGI("%s: camsensor name %s, flash %d", __FUNCTION__,
+                 sensor_info.name, sensor_info.flash_enabled);
+            sensor_info_cached = true;
+        }
+    }
+    mSensorInfo = sensor_info;
 
-    picture_sizes = LINK_default_sensor_get_snapshot_sizes(&PICTURE_SIZE_COUNT);
+    if (!picture_sizes || !PICTURE_SIZE_COUNT)
+        picture_sizes =
+            LINK_default_sensor_get_snapshot_sizes(&PICTURE_SIZE_COUNT);
     if (!picture_sizes || !PICTURE_SIZE_COUNT) {
         LOGE("startCamera X: could not get snapshot sizes");
         return false;
     }
 
+    char value[PROP_VALUE_MAX];
+    if (__system_property_get("debug.camera.trace", value))
+        CameraTrace::setMode(atoi(value));
+
     LOGV("startCamera X");
     return true;
 }
@@ -725,6 +1119,15 @@ status_t QualcommCameraHardware::dump(int fd,
     char buffer[SIZE];
     String8 result;
 
+    // "dumpsys media.camera trace" writes the event trace alone, so that
+    // the output loads as is in chrome://tracing.
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == String16("trace")) {
+            CameraTrace::dumpChromeTrace(fd);
+            return NO_ERROR;
+        }
+    }
+
     // Dump internal primitives.
     result.append("QualcommCameraHardware::dump");
     snprintf(buffer, 255, "mMsgEnabled (%d)\n", mMsgEnabled);
@@ -741,6 +1144,76 @@ status_t QualcommCameraHardware::dump(int fd,
              "and jpeg max size (%d)\n", mPreviewFrameSize, mRawSize,
              mJpegSize, mJpegMaxSize);
     result.append(buffer);
+    snprintf(buffer, 255, "capture state (%d), queued (%d)\n",
+             mCaptureState, mCaptureQueued);
+    result.append(buffer);
+    snprintf(buffer, 255,
+             "setParameters calls (%d), setters run (%d) skipped (%d), "
+             "parameters version (%d)\n",
+             mParameterStats.calls, mParameterStats.settersRun,
+             mParameterStats.settersSkipped, mParametersVersion);
+    result.append(buffer);
+    snprintf(buffer, 255,
+             "driver parm commands sent (%d), avoided (%d): unchanged (%d) "
+             "coalesced (%d) setter skipped (%d)\n",
+             mParameterStats.commandsSent,
+             mParameterStats.commandsUnchanged +
+             mParameterStats.commandsCoalesced +
+             mParameterStats.commandsSkipped,
+             mParameterStats.commandsUnchanged,
+             mParameterStats.commandsCoalesced,
+             mParameterStats.commandsSkipped);
+    result.append(buffer);
+#if DLOPEN_LIBMMCAMERA
+    snprintf(buffer, 255, "jpeg encoder (%s)\n",
+             soft_jpeg_encoder_selected ? "software" : "dsp");
+    result.append(buffer);
+#endif
+    snprintf(buffer, 255,
+             "continuous focus (%d): sweeps (%d) converged (%d), scene "
+             "changes (%d), autoFocus without sweep (%d), captures "
+             "converged (%d) waited (%d)\n", mContinuousFocus,
+             mFocusStats.sweeps, mFocusStats.converged,
+             mFocusStats.sceneChanges, mFocusStats.requestsSkipped,
+             mFocusStats.capturesSkipped, mFocusStats.capturesWaited);
+    result.append(buffer);
+    snprintf(buffer, 255,
+             "prepare capture (%d): staged (%d) used (%d) discarded (%d), "
+             "saved (%lld ms)\n", mPrepareCaptureMode,
+             mPrepareStats.staged, mPrepareStats.used,
+             mPrepareStats.discarded, ns2ms(mPrepareStats.saved));
+    result.append(buffer);
+    snprintf(buffer, 255, "event trace mode (%d)\n", CameraTrace::sMode);
+    result.append(buffer);
+    {
+        Mutex::Autolock lock(&singleton_lock);
+        if (open_stats.count) {
+            snprintf(buffer, 255,
+                     "camera open: first (%lld ms) last (%lld ms) avg (%lld "
+                     "ms) max (%lld ms) over %d opens, waiting for release "
+                     "(%lld ms)\n", ns2ms(open_stats.first),
+                     ns2ms(open_stats.last),
+                     ns2ms(open_stats.total / open_stats.count),
+                     ns2ms(open_stats.max), open_stats.count,
+                     ns2ms(open_stats.waited));
+            result.append(buffer);
+        }
+        snprintf(buffer, 255,
+                 "standby: parked (%d) resumed (%d) expired (%d) low memory "
+                 "(%d)\n", standby_stats.parked, standby_stats.resumed,
+                 standby_stats.expired, standby_stats.lowMemory);
+        result.append(buffer);
+        if (release_stats.count) {
+            snprintf(buffer, 255,
+                     "release: avg (%lld ms) max (%lld ms) over %d "
+                     "releases\n",
+                     ns2ms(release_stats.total / release_stats.count),
+                     ns2ms(release_stats.max), release_stats.count);
+            result.append(buffer);
+        }
+    }
+    mControlQueue.dump(result);
+    dumpProfile(result);
     write(fd, result.string(), result.size());
 
     // Dump internal objects.
@@ -757,6 +1230,169 @@ status_t QualcommCameraHardware::dump(int fd,
     return NO_ERROR;
 }
 
+static const char *const snapshot_stage_names[] = {
+    "takePicture",
+    "prepare_snapshot",
+    "stop_preview",
+    "init_raw",
+    "start_snapshot",
+    "shutter",
+    "get_picture",
+    "crop",
+    "raw_callback",
+    "jpeg_encode",
+    "jpeg_done",
+    "jpeg_callback",
+};
+
+void QualcommCameraHardware::profileBegin()
+{
+    Mutex::Autolock l(&mProfileLock);
+    ShotProfile *shot = &mShotProfiles[mShotCount++ % kProfiledShots];
+    memset(shot, 0, sizeof(*shot));
+    shot->stamp[STAGE_TAKE_PICTURE] = systemTime();
+    CAMERA_TRACE_INSTANT(snapshot_stage_names[STAGE_TAKE_PICTURE],
+                         mShotCount);
+}
+
+void QualcommCameraHardware::profileStage(SnapshotStage stage)
+{
+    nsecs_t now = systemTime();
+    CAMERA_TRACE_INSTANT(snapshot_stage_names[stage], stage);
+    Mutex::Autolock l(&mProfileLock);
+    if (mShotCount > 0) {
+        ShotProfile *shot = &mShotProfiles[(mShotCount - 1) % kProfiledShots];
+        if (!shot->complete)
+            shot->stamp[stage] = now;
+    }
+}
+
+void QualcommCameraHardware::profileFragment(nsecs_t copyTime)
+{
+    Mutex::Autolock l(&mProfileLock);
+    if (mShotCount > 0) {
+        ShotProfile *shot = &mShotProfiles[(mShotCount - 1) % kProfiledShots];
+        shot->fragmentCopyTime += copyTime;
+        shot->fragments++;
+    }
+}
+
+void QualcommCameraHardware::profileEnd()
+{
+    Mutex::Autolock l(&mProfileLock);
+    if (mShotCount > 0)
+        mShotProfiles[(mShotCount - 1) % kProfiledShots].complete = true;
+}
+
+// Time spent in a stage is measured from the latest earlier event of the
+// same capture, since the shutter callback may arrive from the config
+// thread either before or after native_get_picture() returns.
+static nsecs_t stage_duration(const nsecs_t *stamp, int count, int stage)
+{
+    nsecs_t prev = 0;
+    if (!stamp[stage])
+        return -1;
+    for (int i = 0; i < count; i++) {
+        if (stamp[i] && stamp[i] <= stamp[stage] && i != stage &&
+            stamp[i] > prev)
+            prev = stamp[i];
+    }
+    return prev ? stamp[stage] - prev : -1;
+}
+
+static void sort_durations(nsecs_t *v, int n)
+{
+    for (int i = 1; i < n; i++) {
+        nsecs_t key = v[i];
+        int j = i - 1;
+        for (; j >= 0 && v[j] > key; j--)
+            v[j + 1] = v[j];
+        v[j + 1] = key;
+    }
+}
+
+// Nearest-rank percentile of a sorted array.
+static nsecs_t percentile(const nsecs_t *v, int n, int pct)
+{
+    int rank = (pct * n + 99) / 100;
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+void QualcommCameraHardware::dumpProfile(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    nsecs_t durations[kProfiledShots];
+
+    Mutex::Autolock l(&mProfileLock);
+
+    int shots = mShotCount < kProfiledShots ? mShotCount : kProfiledShots;
+    int complete = 0;
+    for (int i = 0; i < shots; i++)
+        if (mShotProfiles[i].complete)
+            complete++;
+    snprintf(buffer, 255,
+             "snapshot profile: %d captures, %d of the last %d complete\n",
+             mShotCount, complete, shots);
+    result.append(buffer);
+    if (!complete)
+        return;
+
+    snprintf(buffer, 255, "  %-18s %8s %8s %8s %8s  (ms)\n",
+             "stage", "last", "p50", "p90", "max");
+    result.append(buffer);
+
+    const ShotProfile *last = NULL;
+    for (int i = 0; i < shots; i++) {
+        const ShotProfile *shot =
+            &mShotProfiles[(mShotCount - 1 - i) % kProfiledShots];
+        if (shot->complete) {
+            last = shot;
+            break;
+        }
+    }
+
+    // Rows STAGE_COUNT and STAGE_COUNT + 1 are the fragment copies and the
+    // total shot-to-shot time.
+    for (int stage = 1; stage < STAGE_COUNT + 2; stage++) {
+        int n = 0;
+        nsecs_t lastValue = -1;
+        for (int i = 0; i < shots; i++) {
+            const ShotProfile *shot = &mShotProfiles[i];
+            if (!shot->complete)
+                continue;
+            nsecs_t d;
+            if (stage == STAGE_COUNT) {
+                d = shot->fragments ? shot->fragmentCopyTime : -1;
+            } else if (stage == STAGE_COUNT + 1) {
+                d = 0;
+                for (int j = 0; j < STAGE_COUNT; j++)
+                    if (shot->stamp[j] - shot->stamp[STAGE_TAKE_PICTURE] > d)
+                        d = shot->stamp[j] - shot->stamp[STAGE_TAKE_PICTURE];
+            } else {
+                d = stage_duration(shot->stamp, STAGE_COUNT, stage);
+            }
+            if (d < 0)
+                continue;
+            durations[n++] = d;
+            if (shot == last)
+                lastValue = d;
+        }
+        if (!n)
+            continue;
+        sort_durations(durations, n);
+
+        const char *name = stage == STAGE_COUNT ? "fragment_copy" :
+            stage == STAGE_COUNT + 1 ? "total" : snapshot_stage_names[stage];
+        snprintf(buffer, 255, "  %-18s %8.1f %8.1f %8.1f %8.1f\n", name,
+                 lastValue < 0 ? 0.0 : lastValue / 1000000.0,
+                 percentile(durations, n, 50) / 1000000.0,
+                 percentile(durations, n, 90) / 1000000.0,
+                 durations[n - 1] / 1000000.0);
+        result.append(buffer);
+    }
+}
+
 static bool native_set_afmode(int camfd, isp3a_af_mode_t af_type)
 {
     int rc;
@@ -777,44 +1413,30 @@ static bool native_set_afmode(int camfd, isp3a_af_mode_t af_type)
     return rc >= 0 && ctrlCmd.status == CAMERA_EXIT_CB_DONE;
 }
 
-static bool native_cancel_afmode(int camfd, int af_fd)
-{
-    int rc;
-    struct msm_ctrl_cmd ctrlCmd;
-
-    ctrlCmd.timeout_ms = 0;
-    ctrlCmd.type = CAMERA_AUTO_FOCUS_CANCEL;
-    ctrlCmd.length = 0;
-    ctrlCmd.value = NULL;
-    ctrlCmd.resp_fd = -1; // there's no response fd
+// The control commands below go through the control queue, which runs
+// them on its own thread; the callers still wait for the result.  Stopping
+// preview or snapshot and cancelling AF jump ahead of queued parameters;
+// starting preview and snapshot run after the parameters queued before
+// them.
 
-    if ((rc = ioctl(camfd, MSM_CAM_IOCTL_CTRL_COMMAND_2, &ctrlCmd)) < 0)
-    {
-        LOGE("native_cancel_afmode: ioctl fd %d error %s\n",
-             camfd,
-             strerror(errno));
+static bool native_cancel_afmode(CameraControlQueue &control)
+{
+    if (!control.run(CAMERA_AUTO_FOCUS_CANCEL, NULL, 0, 0, -1,
+                     CameraControlQueue::PRIORITY_CRITICAL,
+                     CameraControlQueue::FLAG_NO_RESPONSE)) {
+        LOGE("native_cancel_afmode: failed");
         return false;
     }
-
     return true;
 }
 
-static bool native_start_preview(int camfd)
+static bool native_start_preview(CameraControlQueue &control)
 {
-    struct msm_ctrl_cmd ctrlCmd;
-
-    ctrlCmd.timeout_ms = 5000;
-    ctrlCmd.type       = CAMERA_START_PREVIEW;
-    ctrlCmd.length     = 0;
-    ctrlCmd.resp_fd    = camfd; // FIXME: this will be put in by the kernel
-
-    if (ioctl(camfd, MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd) < 0) {
-        LOGE("native_start_preview: MSM_CAM_IOCTL_CTRL_COMMAND fd %d error %s",
-             camfd,
-             strerror(errno));
+    if (!control.run(CAMERA_START_PREVIEW, NULL, 0, 5000, -1,
+                     CameraControlQueue::PRIORITY_NORMAL)) {
+        LOGE("native_start_preview: failed");
         return false;
     }
-
     return true;
 }
 
@@ -848,79 +1470,44 @@ static bool native_get_picture (int camfd, common_crop_t *crop)
     return true;
 }
 
-static bool native_stop_preview(int camfd)
+static bool native_stop_preview(CameraControlQueue &control)
 {
-    struct msm_ctrl_cmd ctrlCmd;
-    ctrlCmd.timeout_ms = 5000;
-    ctrlCmd.type       = CAMERA_STOP_PREVIEW;
-    ctrlCmd.length     = 0;
-    ctrlCmd.resp_fd    = camfd; // FIXME: this will be put in by the kernel
-
-    if(ioctl(camfd, MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd) < 0) {
-        LOGE("native_stop_preview: ioctl fd %d error %s",
-             camfd,
-             strerror(errno));
+    if (!control.run(CAMERA_STOP_PREVIEW, NULL, 0, 5000, -1,
+                     CameraControlQueue::PRIORITY_CRITICAL)) {
+        LOGE("native_stop_preview: failed");
         return false;
     }
-
     return true;
 }
 
-static bool native_prepare_snapshot(int camfd)
+static bool native_prepare_snapshot(CameraControlQueue &control)
 {
-    int ioctlRetVal = true;
-    struct msm_ctrl_cmd ctrlCmd;
-
-    ctrlCmd.timeout_ms = 1000;
-    ctrlCmd.type       = CAMERA_PREPARE_SNAPSHOT;
-    ctrlCmd.length     = 0;
-    ctrlCmd.value      = NULL;
-    ctrlCmd.resp_fd = camfd;
-
-    if (ioctl(camfd, MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd) < 0) {
-        LOGE("native_prepare_snapshot: ioctl fd %d error %s",
-             camfd,
-             strerror(errno));
+    if (!control.run(CAMERA_PREPARE_SNAPSHOT, NULL, 0, 1000, -1,
+                     CameraControlQueue::PRIORITY_NORMAL)) {
+        LOGE("native_prepare_snapshot: failed");
         return false;
     }
     return true;
 }
 
-static bool native_start_snapshot(int camfd)
+static bool native_start_snapshot(CameraControlQueue &control)
 {
-    struct msm_ctrl_cmd ctrlCmd;
-
-    ctrlCmd.timeout_ms = 5000;
-    ctrlCmd.type       = CAMERA_START_SNAPSHOT;
-    ctrlCmd.length     = 0;
-    ctrlCmd.resp_fd    = camfd; // FIXME: this will be put in by the kernel
-
-    if(ioctl(camfd, MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd) < 0) {
-        LOGE("native_start_snapshot: ioctl fd %d error %s",
-             camfd,
-             strerror(errno));
+    if (!control.run(CAMERA_START_SNAPSHOT, NULL, 0, 5000, -1,
+                     CameraControlQueue::PRIORITY_NORMAL)) {
+        LOGE("native_start_snapshot: failed");
         return false;
     }
-
     return true;
 }
 
-static bool native_stop_snapshot (int camfd)
+static bool native_stop_snapshot(CameraControlQueue &control)
 {
-    struct msm_ctrl_cmd ctrlCmd;
-
-    ctrlCmd.timeout_ms = 0;
-    ctrlCmd.type       = CAMERA_STOP_SNAPSHOT;
-    ctrlCmd.length     = 0;
-    ctrlCmd.resp_fd    = -1;
-
-    if (ioctl(camfd, MSM_CAM_IOCTL_CTRL_COMMAND_2, &ctrlCmd) < 0) {
-        LOGE("native_stop_snapshot: ioctl fd %d error %s",
-             camfd,
-             strerror(errno));
+    if (!control.run(CAMERA_STOP_SNAPSHOT, NULL, 0, 0, -1,
+                     CameraControlQueue::PRIORITY_CRITICAL,
+                     CameraControlQueue::FLAG_NO_RESPONSE)) {
+        LOGE("native_stop_snapshot: failed");
         return false;
     }
-
     return true;
 }
 
@@ -957,7 +1544,7 @@ bool QualcommCameraHardware::native_jpeg_encode(void)
 
     jpeg_set_location();
 
-    if (!LINK_jpeg_encoder_encode(&mDimension,
+    if (!LINK_jpeg_encoder_encode(&mCaptureDimension,
                                   (uint8_t *)mThumbnailHeap->mHeap->base(),
                                   mThumbnailHeap->mHeap->getHeapID(),
                                   (uint8_t *)mRawHeap->mHeap->base(),
@@ -972,25 +1559,105 @@ bool QualcommCameraHardware::native_jpeg_encode(void)
 bool QualcommCameraHardware::native_set_parm(
     cam_ctrl_type type, uint16_t length, void *value)
 {
-    struct msm_ctrl_cmd ctrlCmd;
-
-    ctrlCmd.timeout_ms = 5000;
-    ctrlCmd.type       = (uint16_t)type;
-    ctrlCmd.length     = length;
-    // FIXME: this will be put in by the kernel
-    ctrlCmd.resp_fd    = mCameraControlFd;
-    ctrlCmd.value = value;
-
     LOGV("%s: fd %d, type %d, length %d", __FUNCTION__,
          mCameraControlFd, type, length);
-    if (ioctl(mCameraControlFd, MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd) < 0 ||
-                ctrlCmd.status != CAM_CTRL_SUCCESS) {
-        LOGE("%s: error (%s): fd %d, type %d, length %d, status %d",
-             __FUNCTION__, strerror(errno),
-             mCameraControlFd, type, length, ctrlCmd.status);
-        return false;
+    return mControlQueue.run(type, value, length, 5000, CAM_CTRL_SUCCESS,
+                             CameraControlQueue::PRIORITY_NORMAL);
+}
+
+void QualcommCameraHardware::queueParm(cam_ctrl_type type, int32_t value)
+{
+    for (int i = 0; i < mPendingParmCount; i++) {
+        if (mPendingParms[i].type == type) {
+            mPendingParms[i].value = value;
+            mParameterStats.commandsCoalesced++;
+            return;
+        }
     }
-    return true;
+    if (mPendingParmCount == kMaxParmCommands) {
+        LOGE("%s: too many pending commands, dropping type %d",
+             __FUNCTION__, type);
+        return;
+    }
+    mPendingParms[mPendingParmCount].type = type;
+    mPendingParms[mPendingParmCount].value = value;
+    mPendingParmCount++;
+}
+
+// Returns the first driver error among the commands sent by this call if
+// wait is set, NO_ERROR otherwise.
+status_t QualcommCameraHardware::flushParmCommands(bool wait)
+{
+    ParmCommand submitted[kMaxParmCommands];
+    int submittedCount = 0;
+
+    // Forget the values whose commands failed, so that they are retried.
+    for (int sent = 0; sent < mSentParmCount; ) {
+        ParmCommand *cmd = &mSentParms[sent];
+        if (cmd->result != 0 && cmd->result->done() &&
+            !cmd->result->succeeded()) {
+            LOGW("%s: type %d (%d) failed, will retry", __FUNCTION__,
+                 cmd->type, cmd->value);
+            *cmd = mSentParms[--mSentParmCount];
+            mSentParms[mSentParmCount].result.clear();
+            continue;
+        }
+        sent++;
+    }
+
+    for (int i = 0; i < mPendingParmCount; i++) {
+        ParmCommand *cmd = &mPendingParms[i];
+        int sent;
+        for (sent = 0; sent < mSentParmCount; sent++)
+            if (mSentParms[sent].type == cmd->type)
+                break;
+        if (sent < mSentParmCount && mSentParms[sent].value == cmd->value) {
+            LOGV("%s: type %d unchanged (%d)", __FUNCTION__,
+                 cmd->type, cmd->value);
+            mParameterStats.commandsUnchanged++;
+            continue;
+        }
+
+        mParameterStats.commandsSent++;
+        sp<CameraControlQueue::Command> result =
+            mControlQueue.submit(cmd->type, &cmd->value, sizeof(cmd->value),
+                                 5000, CAM_CTRL_SUCCESS,
+                                 CameraControlQueue::PRIORITY_NORMAL,
+                                 CameraControlQueue::FLAG_COALESCE);
+        if (result != 0) {
+            submitted[submittedCount] = *cmd;
+            submitted[submittedCount++].result = result;
+        }
+        if (sent == mSentParmCount) {
+            if (mSentParmCount == kMaxParmCommands)
+                continue;
+            mSentParmCount++;
+        }
+        mSentParms[sent].type = cmd->type;
+        mSentParms[sent].value = cmd->value;
+        mSentParms[sent].result = result;
+    }
+    mPendingParmCount = 0;
+
+    status_t rc = NO_ERROR;
+    for (int i = 0; wait && i < submittedCount; i++) {
+        if (!submitted[i].result->wait()) {
+            LOGE("%s: type %d (%d) failed", __FUNCTION__,
+                 submitted[i].type, submitted[i].value);
+            rc = UNKNOWN_ERROR;
+        }
+    }
+    return rc;
+}
+
+// Forget what the driver was sent, so that the next setParameters() applies
+// every parameter again.
+void QualcommCameraHardware::invalidateSentParms()
+{
+    for (int sent = 0; sent < mSentParmCount; sent++)
+        mSentParms[sent].result.clear();
+    mSentParmCount = 0;
+    mParmsForceApply = true;
 }
 
 void QualcommCameraHardware::jpeg_set_location()
@@ -1092,6 +1759,7 @@ bool QualcommCameraHardware::initPreview()
 {
     // See comments in deinitPreview() for why we have to wait for the frame
     // thread here, and why we can't use pthread_join().
+    CAMERA_TRACE_SCOPE("initPreview", 0);
     int previewWidth, previewHeight;
     mParameters.getPreviewSize(&previewWidth, &previewHeight);
     LOGI("initPreview E: preview size=%dx%d", previewWidth, previewHeight);
@@ -1103,13 +1771,10 @@ bool QualcommCameraHardware::initPreview()
     }
     mFrameThreadWaitLock.unlock();
 
-    mSnapshotThreadWaitLock.lock();
-    while (mSnapshotThreadRunning) {
-        LOGV("initPreview: waiting for old snapshot thread to complete.");
-        mSnapshotThreadWait.wait(mSnapshotThreadWaitLock);
-        LOGV("initPreview: old snapshot thread completed.");
-    }
-    mSnapshotThreadWaitLock.unlock();
+    // We do not wait for the snapshot thread here: startPreviewInternal()
+    // only gets this far once the capture is idle or encoding, and the
+    // snapshot thread may itself be waiting for mLock to start a queued
+    // capture.
 
     int cnt = 0;
     mPreviewFrameSize = previewWidth * previewHeight * 3/2;
@@ -1184,17 +1849,21 @@ void QualcommCameraHardware::deinitPreview(void)
     LOGI("deinitPreview X");
 }
 
+// Runs on the snapshot thread without mLock, for the picture size in
+// mCaptureDimension.
 bool QualcommCameraHardware::initRaw(bool initJpegHeap)
 {
-    int rawWidth, rawHeight;
-    mParameters.getPictureSize(&rawWidth, &rawHeight);
+    CAMERA_TRACE_SCOPE("initRaw", initJpegHeap);
+    int rawWidth = mCaptureDimension.picture_width;
+    int rawHeight = mCaptureDimension.picture_height;
     LOGV("initRaw E: picture size=%dx%d", rawWidth, rawHeight);
 
-    // mDimension will be filled with thumbnail_width, thumbnail_height,
-    // orig_picture_dx, and orig_picture_dy after this function call. We need to
-    // keep it for jpeg_encoder_encode.
+    // mCaptureDimension will be filled with thumbnail_width,
+    // thumbnail_height, orig_picture_dx, and orig_picture_dy after this
+    // function call. We need to keep it for jpeg_encoder_encode.
     bool ret = native_set_parm(CAMERA_SET_PARM_DIMENSION,
-                               sizeof(cam_ctrl_dimension_t), &mDimension);
+                               sizeof(cam_ctrl_dimension_t),
+                               &mCaptureDimension);
     if(!ret) {
         LOGE("initRaw X: failed to set dimension");
         return false;
@@ -1285,6 +1954,7 @@ bool QualcommCameraHardware::initRaw(bool initJpegHeap)
 
 void QualcommCameraHardware::deinitRaw()
 {
+    CAMERA_TRACE_SCOPE("deinitRaw", 0);
     LOGV("deinitRaw E");
 
     mThumbnailHeap.clear();
@@ -1298,40 +1968,145 @@ void QualcommCameraHardware::deinitRaw()
 void QualcommCameraHardware::release()
 {
     LOGD("release E");
-    Mutex::Autolock l(&mLock);
 
-#if DLOPEN_LIBMMCAMERA
-    if (libmmcamera == NULL) {
-        LOGE("ERROR: multiple release!");
-        return;
+    {
+        Mutex::Autolock lock(&singleton_lock);
+        if (mReleasing) {
+            LOGE("ERROR: multiple release!");
+            return;
+        }
+        mReleasing = true;
+        mReleaseStart = systemTime();
+        // createInstance() waits for us until the driver session is over.
+        singleton_releasing = true;
     }
-#else
-#warning "Cannot detect multiple release when not dlopen()ing libqcamera!"
-#endif
 
-    int cnt, rc;
-    struct msm_ctrl_cmd ctrlCmd;
+    {
+        // The client is gone once we return; nothing may call back into it.
+        // The capture callbacks run under mCallbackLock, so this waits for
+        // one that is running, but not for the capture itself, which
+        // cancelPicture() on the reaper abandons.
+        Mutex::Autolock cbLock(&mCallbackLock);
+        mMsgEnabled = 0;
+        mNotifyCallback = 0;
+        mDataCallback = 0;
+        mDataCallbackTimestamp = 0;
+        mCallbackCookie = 0;
+    }
 
-    if (mCameraRunning) {
-        if(mDataCallbackTimestamp && (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME)) {
-            mRecordFrameLock.lock();
-            mReleasedRecordingFrame = true;
-            mRecordWait.signal();
-            mRecordFrameLock.unlock();
-        }
-        stopPreviewInternal();
+    // A preview callback may be blocked waiting for the client to return
+    // a recording frame; it never will.
+    mRecordFrameLock.lock();
+    mReleasedRecordingFrame = true;
+    mRecordWait.signal();
+    mRecordFrameLock.unlock();
+
+    // The reaper owns a reference of its own, so the teardown finishes
+    // even if the client drops the last one as soon as we return.
+    sp<QualcommCameraHardware> *ref = new sp<QualcommCameraHardware>(this);
+    pthread_t thr;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thr, &attr, release_thread, ref)) {
+        LOGE("failed to start release thread, releasing synchronously");
+        delete ref;
+        runRelease();
     }
 
+    LOGD("release X");
+}
+
+void *release_thread(void *user)
+{
+    LOGV("release_thread E");
+    sp<QualcommCameraHardware> *ref = (sp<QualcommCameraHardware> *)user;
+    (*ref)->runRelease();
+    delete ref;
+    LOGV("release_thread X");
+    return NULL;
+}
+
+// The teardown proper, on release_thread.  The client has been detached
+// already.
+void QualcommCameraHardware::runRelease()
+{
+    LOGV("runRelease E");
+
+    // The snapshot thread takes mLock while it stops preview and allocates
+    // the snapshot buffers, so wait for it before taking mLock ourselves.
+    cancelPicture();
+    mSnapshotThreadWaitLock.lock();
+    while (mSnapshotThreadRunning) {
+        LOGV("release: waiting for snapshot thread to complete.");
+        mSnapshotThreadWait.wait(mSnapshotThreadWaitLock);
+    }
+    mSnapshotThreadWaitLock.unlock();
+
+    // The smooth zoom worker takes mLock for every step.
+    stopSmoothZoom(true);
+    stopAutoFocusWorker();
+
+    Mutex::Autolock l(&mLock);
+
+    if (mCameraRunning)
+        stopPreviewInternal();
+
     LINK_jpeg_encoder_join();
     deinitRaw();
 
-    ctrlCmd.timeout_ms = 5000;
-    ctrlCmd.length = 0;
-    ctrlCmd.type = (uint16_t)CAMERA_EXIT;
-    ctrlCmd.resp_fd = mCameraControlFd; // FIXME: this will be put in by the kernel
-    if (ioctl(mCameraControlFd, MSM_CAM_IOCTL_CTRL_COMMAND, &ctrlCmd) < 0)
-        LOGE("ioctl CAMERA_EXIT fd %d error %s",
-             mCameraControlFd, strerror(errno));
+    char value[PROP_VALUE_MAX];
+    int standby = __system_property_get("persist.camera.standby.ms", value) ?
+        atoi(value) : 0;
+    if (standby > 0 && standby_memory_available()) {
+        park(standby);
+        LOGD("release: parked for %d ms", standby);
+    } else {
+        shutdown();
+    }
+    endRelease();
+
+    LOGV("runRelease X");
+}
+
+// Lets the next open go ahead once the driver session has ended (or the
+// instance is parked).  An instance that is shut down stops being the
+// singleton here rather than in its destructor: whoever still holds a
+// reference to it, a callback in flight or the reaper itself, no longer
+// holds up the next open, which gets a new instance.
+void QualcommCameraHardware::endRelease()
+{
+    Mutex::Autolock lock(&singleton_lock);
+    if (!mParked && singleton.unsafe_get() == this)
+        singleton.clear();
+
+    // Not set when standby_thread ends a parked session.
+    if (mReleaseStart) {
+        nsecs_t elapsed = systemTime() - mReleaseStart;
+        release_stats.count++;
+        release_stats.total += elapsed;
+        if (elapsed > release_stats.max)
+            release_stats.max = elapsed;
+        LOGD("camera %s %lld ms after release()",
+             mParked ? "parked" : "shut down", ns2ms(elapsed));
+        mReleaseStart = 0;
+    }
+
+    singleton_releasing = false;
+    singleton_wait.broadcast();
+}
+
+// Ends the driver session.  Everything else has stopped by now.
+void QualcommCameraHardware::shutdown()
+{
+    LOGV("shutdown E");
+
+    // Let the queued commands reach the driver before it exits; CAMERA_EXIT
+    // then runs on this thread.
+    mControlQueue.stop();
+    if (!mControlQueue.run(CAMERA_EXIT, NULL, 0, 5000, -1,
+                           CameraControlQueue::PRIORITY_NORMAL))
+        LOGE("CAMERA_EXIT fd %d failed", mCameraControlFd);
 
     LINK_release_cam_conf_thread();
 
@@ -1345,20 +2120,96 @@ void QualcommCameraHardware::release()
         libmmcamera = NULL;
     }
 #endif
+    mParked = false;
+
+    LOGV("shutdown X");
+}
+
+// Called from runRelease() with mLock held, once all activity has stopped.
+void QualcommCameraHardware::park(int standbyMs)
+{
+    mParked = true;
 
     Mutex::Autolock lock(&singleton_lock);
-    singleton_releasing = true;
+    standby_instance = this;
+    standby_deadline = systemTime() + ms2ns(standbyMs);
+    standby_stats.parked++;
+    if (!standby_thread_running) {
+        pthread_t thr;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        standby_thread_running =
+            !pthread_create(&thr, &attr, standby_thread, NULL);
+        if (!standby_thread_running)
+            LOGE("failed to start standby thread; camera stays parked "
+                 "until the next open");
+    }
+}
 
-    LOGD("release X");
+// Called from createInstance() for a parked instance.  The new client gets
+// the same state as from a fresh open, bar the driver session.
+void QualcommCameraHardware::resume()
+{
+    LOGV("resume E");
+    {
+        Mutex::Autolock l(&mLock);
+        mParked = false;
+        invalidateSentParms();
+    }
+    {
+        Mutex::Autolock lock(&singleton_lock);
+        mReleasing = false;
+    }
+    initDefaultParameters();
+    LOGV("resume X");
+}
+
+void *standby_thread(void *user)
+{
+    LOGV("standby_thread E");
+    singleton_lock.lock();
+    while (standby_instance != 0) {
+        nsecs_t remaining = standby_deadline - systemTime();
+        bool lowMemory = !standby_memory_available();
+        if (remaining <= 0 || lowMemory) {
+            sp<QualcommCameraHardware> obj = standby_instance;
+            standby_instance.clear();
+            if (lowMemory)
+                standby_stats.lowMemory++;
+            else
+                standby_stats.expired++;
+            // createInstance() waits for us, as for any release.
+            singleton_releasing = true;
+            standby_thread_running = false;
+            singleton_lock.unlock();
+
+            LOGD("standby: shutting the camera down%s",
+                 lowMemory ? " (low memory)" : "");
+            obj->shutdown();
+            obj->endRelease();
+            obj.clear();
+            LOGV("standby_thread X");
+            return NULL;
+        }
+        if (remaining > ms2ns(STANDBY_POLL_MS))
+            remaining = ms2ns(STANDBY_POLL_MS);
+        standby_wait.waitRelative(singleton_lock, remaining);
+    }
+    standby_thread_running = false;
+    singleton_lock.unlock();
+    LOGV("standby_thread X: resumed");
+    return NULL;
 }
 
 QualcommCameraHardware::~QualcommCameraHardware()
 {
     LOGD("~QualcommCameraHardware E");
     Mutex::Autolock lock(&singleton_lock);
-    singleton.clear();
-    singleton_releasing = false;
-    singleton_wait.signal();
+    // Released instances have given up the singleton in endRelease(); by
+    // now it may well be a newer instance.
+    if (singleton.unsafe_get() == this)
+        singleton.clear();
     LOGD("~QualcommCameraHardware X");
 }
 
@@ -1381,6 +2232,18 @@ status_t QualcommCameraHardware::startPreviewInternal()
         return NO_ERROR;
     }
 
+    {
+        Mutex::Autolock l(&mCaptureLock);
+        // A capture staging when preview stopped drops itself.
+        if (mCaptureState != CAPTURE_IDLE &&
+            mCaptureState != CAPTURE_ENCODING &&
+            mCaptureState != CAPTURE_STAGING) {
+            LOGE("startPreview X: picture in progress (state %d)",
+                 mCaptureState);
+            return INVALID_OPERATION;
+        }
+    }
+
     if (!mPreviewInitialized) {
         mPreviewInitialized = initPreview();
         if (!mPreviewInitialized) {
@@ -1389,7 +2252,8 @@ status_t QualcommCameraHardware::startPreviewInternal()
         }
     }
 
-    mCameraRunning = native_start_preview(mCameraControlFd);
+    mCameraRunning = native_start_preview(mControlQueue);
+    invalidateSentParms();
     if(!mCameraRunning) {
         deinitPreview();
         mPreviewInitialized = false;
@@ -1397,6 +2261,7 @@ status_t QualcommCameraHardware::startPreviewInternal()
         return UNKNOWN_ERROR;
     }
 
+    updateContinuousFocus();
     LOGV("startPreview X");
     return NO_ERROR;
 }
@@ -1419,7 +2284,9 @@ void QualcommCameraHardware::stopPreviewInternal()
             }
         }
 
-        mCameraRunning = !native_stop_preview(mCameraControlFd);
+        unstageCapture();
+        mCameraRunning = !native_stop_preview(mControlQueue);
+        updateContinuousFocus();
         if (!mCameraRunning && mPreviewInitialized) {
             deinitPreview();
             mPreviewInitialized = false;
@@ -1429,6 +2296,43 @@ void QualcommCameraHardware::stopPreviewInternal()
     LOGV("stopPreviewInternal X: %d", mCameraRunning);
 }
 
+// Stops preview for a capture in CAPTURE_ALLOCATING.  Only the bookkeeping
+// is done under mLock: startPreview() refuses to run until the capture is
+// done, so the driver calls and the frame thread teardown need not hold it.
+void QualcommCameraHardware::stopPreviewForCapture()
+{
+    mLock.lock();
+    bool running = mCameraRunning;
+    bool cancelFocus = false;
+    if (running) {
+        cancelFocus = mNotifyCallback && (mMsgEnabled & CAMERA_MSG_FOCUS);
+        mCameraRunning = false;
+        updateContinuousFocus();
+    }
+    mLock.unlock();
+    LOGV("stopPreviewForCapture E: %d", running);
+    if (!running)
+        return;
+
+    if (cancelFocus)
+        cancelAutoFocusInternal();
+    if (!native_stop_preview(mControlQueue)) {
+        LOGE("stopPreviewForCapture: failed to stop preview");
+        Mutex::Autolock l(&mLock);
+        mCameraRunning = true;
+        updateContinuousFocus();
+        return;
+    }
+
+    mLock.lock();
+    bool initialized = mPreviewInitialized;
+    mPreviewInitialized = false;
+    mLock.unlock();
+    if (initialized)
+        deinitPreview();
+    LOGV("stopPreviewForCapture X");
+}
+
 void QualcommCameraHardware::stopPreview()
 {
     LOGV("stopPreview: E");
@@ -1441,101 +2345,329 @@ void QualcommCameraHardware::stopPreview()
     LOGV("stopPreview: X");
 }
 
-void QualcommCameraHardware::runAutoFocus()
+// Runs one AF sweep on the worker thread.  This blocks until either AF
+// completes or is cancelled.
+bool QualcommCameraHardware::runAutoFocus(isp3a_af_mode_t mode)
 {
-    bool status = true;
-    void *libhandle = NULL;
+    CAMERA_TRACE_SCOPE("autoFocus", mode);
+    LOGV("af start (fd %d)", mAutoFocusFd);
+    nsecs_t start = systemTime();
+    bool status = native_set_afmode(mAutoFocusFd, mode);
+    mControlQueue.account(CAMERA_SET_PARM_AUTO_FOCUS,
+                          systemTime() - start, status);
+    LOGV("af done: %d", (int)status);
+    return status;
+}
 
-    mAutoFocusThreadLock.lock();
-    // Skip autofocus if focus mode is infinity.
-    if (strcmp(mParameters.get(CameraParameters::KEY_FOCUS_MODE),
-               CameraParameters::FOCUS_MODE_INFINITY) == 0) {
-        goto done;
-    }
+void QualcommCameraHardware::runAutoFocusWorker(void *libhandle)
+{
+    LOGV("runAutoFocusWorker E");
 
-    mAutoFocusFd = open(MSM_CAMERA_CONTROL, O_RDWR);
-    if (mAutoFocusFd < 0) {
-        LOGE("autofocus: cannot open %s: %s",
-             MSM_CAMERA_CONTROL,
-             strerror(errno));
-        mAutoFocusThreadRunning = false;
+    mAutoFocusThreadLock.lock();
+    for (;;) {
+        int mode = -1;
+        while (!mAutoFocusExiting) {
+            if (mAutoFocusPending) {
+                mAutoFocusPending = false;
+                mAutoFocusNotify = true;
+                mode = mAutoFocusMode;
+                break;
+            }
+            if (mContinuousFocus && !mFocusConverged) {
+                nsecs_t wait = mLastFocusSweep + ms2ns(CAF_MIN_INTERVAL_MS) -
+                    systemTime();
+                if (wait <= 0) {
+                    mAutoFocusNotify = false;
+                    mode = AF_MODE_AUTO;
+                    break;
+                }
+                mAutoFocusWait.waitRelative(mAutoFocusThreadLock, wait);
+                continue;
+            }
+            mAutoFocusWait.wait(mAutoFocusThreadLock);
+        }
+        if (mAutoFocusExiting)
+            break;
+        mAutoFocusActive = true;
         mAutoFocusThreadLock.unlock();
-        return;
-    }
 
-#if DLOPEN_LIBMMCAMERA
-    // We need to maintain a reference to libqcamera.so for the duration of the
-    // AF thread, because we do not know when it will exit relative to the
-    // lifetime of this object.  We do not want to dlclose() libqcamera while
-    // LINK_cam_frame is still running.
-    libhandle = ::dlopen("liboemcamera.so", RTLD_NOW);
-    LOGV("AF: loading libqcamera at %p", libhandle);
-    if (!libhandle) {
-        LOGE("FATAL ERROR: could not dlopen liboemcamera.so: %s", dlerror());
-        close(mAutoFocusFd);
-        mAutoFocusFd = -1;
-        mAutoFocusThreadRunning = false;
+        // Focus mode infinity, or a converged continuous focus, needs no
+        // sweep.
+        bool status = mode < 0 || runAutoFocus((isp3a_af_mode_t)mode);
+
+        mCallbackLock.lock();
+        bool autoFocusEnabled =
+            mNotifyCallback && (mMsgEnabled & CAMERA_MSG_FOCUS);
+        notify_callback cb = mNotifyCallback;
+        void *data = mCallbackCookie;
+        mCallbackLock.unlock();
+
+        mAutoFocusThreadLock.lock();
+        mAutoFocusActive = false;
+        if (mode >= 0) {
+            mLastFocusSweep = systemTime();
+            if (mContinuousFocus) {
+                mFocusConverged = status;
+                mFocusZonesValid = false;
+                mSceneChangeFrames = 0;
+                if (!mAutoFocusNotify) {
+                    mFocusStats.sweeps++;
+                    if (status)
+                        mFocusStats.converged++;
+                }
+            }
+        }
+        bool notify = mAutoFocusNotify && !mAutoFocusExiting;
+        mAutoFocusNotify = false;
+        mAutoFocusWait.broadcast();
         mAutoFocusThreadLock.unlock();
-        return;
+        if (notify && autoFocusEnabled)
+            cb(CAMERA_MSG_FOCUS, status, 0, data);
+        mAutoFocusThreadLock.lock();
     }
-#endif
 
-    /* This will block until either AF completes or is cancelled. */
-    LOGV("af start (fd %d)", mAutoFocusFd);
-    status = native_set_afmode(mAutoFocusFd, AF_MODE_AUTO);
-    LOGV("af done: %d", (int)status);
     close(mAutoFocusFd);
     mAutoFocusFd = -1;
-
-done:
     mAutoFocusThreadRunning = false;
+    mAutoFocusWait.broadcast();
     mAutoFocusThreadLock.unlock();
 
-    mCallbackLock.lock();
-    bool autoFocusEnabled = mNotifyCallback && (mMsgEnabled & CAMERA_MSG_FOCUS);
-    notify_callback cb = mNotifyCallback;
-    void *data = mCallbackCookie;
-    mCallbackLock.unlock();
-    if (autoFocusEnabled)
-        cb(CAMERA_MSG_FOCUS, status, 0, data);
-
 #if DLOPEN_LIBMMCAMERA
     if (libhandle) {
         ::dlclose(libhandle);
         LOGV("AF: dlclose(libqcamera)");
     }
 #endif
+    LOGV("runAutoFocusWorker X");
+}
+
+// Called with mLock held whenever the focus mode or the preview state
+// changes.
+void QualcommCameraHardware::updateContinuousFocus()
+{
+    bool enable = mContinuousFocusMode && mCameraRunning;
+    if (enable && !startAutoFocusWorker())
+        enable = false;
+
+    mAutoFocusThreadLock.lock();
+    if (enable == mContinuousFocus) {
+        mAutoFocusThreadLock.unlock();
+        return;
+    }
+    LOGV("continuous focus %s", enable ? "on" : "off");
+    mContinuousFocus = enable;
+    mFocusConverged = false;
+    mFocusZonesValid = false;
+    mSceneChangeFrames = 0;
+    // A sweep of its own that nobody waits for is cut short.
+    bool cancel = !enable && mAutoFocusActive && !mAutoFocusNotify;
+    mAutoFocusWait.broadcast();
+    mAutoFocusThreadLock.unlock();
+
+    if (cancel)
+        native_cancel_afmode(mControlQueue);
+}
+
+// Mean luma of a 4x4 grid of zones, from every CAF_SAMPLE_STEP-th pixel of
+// every CAF_SAMPLE_STEP-th row.
+static void focus_zone_luma(const uint8_t *luma, int width, int height,
+                            uint8_t *zones)
+{
+    uint32_t sum[16];
+    uint32_t count[16];
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+    for (int row = 0; row < height; row += CAF_SAMPLE_STEP) {
+        const uint8_t *line = luma + row * width;
+        int zoneRow = (row * 4 / height) * 4;
+        for (int col = 0; col < width; col += CAF_SAMPLE_STEP) {
+            int zone = zoneRow + col * 4 / width;
+            sum[zone] += line[col];
+            count[zone]++;
+        }
+    }
+    for (int i = 0; i < 16; i++)
+        zones[i] = count[i] ? sum[i] / count[i] : 0;
+}
+
+// Runs on the frame thread, for every CAF_SAMPLE_FRAMES-th frame while
+// continuous focus has converged.  The reference zones are taken from the
+// first frame after a sweep; the scene has changed once CAF_SCENE_FRAMES
+// samples in a row differ from them by more than CAF_SCENE_THRESHOLD.
+void QualcommCameraHardware::updateFocusScene(const uint8_t *luma)
+{
+    if (!mContinuousFocus || ++mFocusFrameCount % CAF_SAMPLE_FRAMES)
+        return;
+
+    int width = mDimension.display_width;
+    int height = mDimension.display_height;
+    if (width < 4 || height < 4 ||
+        (unsigned)(width * height * 3 / 2) > mPreviewFrameSize)
+        return;
+
+    if (!mFocusConverged || mAutoFocusActive)
+        return;
+    uint8_t zones[kFocusZones];
+    focus_zone_luma(luma, width, height, zones);
+
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    if (!mContinuousFocus || !mFocusConverged || mAutoFocusActive)
+        return;
+    if (!mFocusZonesValid) {
+        memcpy(mFocusZones, zones, sizeof(zones));
+        mFocusZonesValid = true;
+        return;
+    }
+
+    int difference = 0;
+    for (int i = 0; i < kFocusZones; i++)
+        difference += abs((int)zones[i] - (int)mFocusZones[i]);
+    if (difference / kFocusZones <= CAF_SCENE_THRESHOLD) {
+        mSceneChangeFrames = 0;
+        return;
+    }
+    if (++mSceneChangeFrames < CAF_SCENE_FRAMES)
+        return;
+
+    LOGV("continuous focus: scene changed (%d)", difference / kFocusZones);
+    mFocusStats.sceneChanges++;
+    mFocusConverged = false;
+    mFocusZonesValid = false;
+    mSceneChangeFrames = 0;
+    mAutoFocusWait.broadcast();
+}
+
+// Called by the snapshot thread before it prepares a capture.  A capture
+// never starts a sweep of its own in continuous focus mode; it only lets a
+// running one finish, so that the exposure is not taken mid-sweep.
+void QualcommCameraHardware::waitForContinuousFocus()
+{
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    if (!mContinuousFocus)
+        return;
+    if (!mAutoFocusActive) {
+        if (mFocusConverged)
+            mFocusStats.capturesSkipped++;
+        return;
+    }
+
+    mFocusStats.capturesWaited++;
+    nsecs_t deadline = systemTime() + ms2ns(CAF_CAPTURE_WAIT_MS);
+    while (mAutoFocusActive) {
+        nsecs_t remaining = deadline - systemTime();
+        if (remaining <= 0) {
+            LOGW("capture: continuous focus did not settle");
+            break;
+        }
+        mAutoFocusWait.waitRelative(mAutoFocusThreadLock, remaining);
+    }
 }
 
 status_t QualcommCameraHardware::cancelAutoFocusInternal()
 {
     LOGV("cancelAutoFocusInternal E");
 
-#if 0
+    mAutoFocusThreadLock.lock();
+    mAutoFocusPending = false;
+    mAutoFocusThreadLock.unlock();
+
+    status_t rc = native_cancel_afmode(mControlQueue) ?
+        NO_ERROR :
+        UNKNOWN_ERROR;
+
+    LOGV("cancelAutoFocusInternal X: %d", rc);
+    return rc;
+}
+
+void *auto_focus_thread(void *user)
+{
+    LOGV("auto_focus_thread E");
+    sp<QualcommCameraHardware> obj = QualcommCameraHardware::getInstance();
+    if (obj != 0) {
+        obj->runAutoFocusWorker(user);
+    }
+    else LOGW("not starting autofocus: the object went away!");
+    LOGV("auto_focus_thread X");
+    return NULL;
+}
+
+// Called with mLock held by the first autoFocus() or continuous focus,
+// rather than at open, since preview does not need the worker.
+bool QualcommCameraHardware::startAutoFocusWorker()
+{
+    {
+        Mutex::Autolock l(&mAutoFocusThreadLock);
+        if (mAutoFocusThreadRunning)
+            return true;
+    }
+
+    mAutoFocusFd = open(MSM_CAMERA_CONTROL, O_RDWR);
     if (mAutoFocusFd < 0) {
-        LOGV("cancelAutoFocusInternal X: not in progress");
-        return NO_ERROR;
+        LOGE("autofocus: cannot open %s: %s",
+             MSM_CAMERA_CONTROL,
+             strerror(errno));
+        return false;
+    }
+
+    void *libhandle = NULL;
+#if DLOPEN_LIBMMCAMERA
+    // The worker keeps a reference to libqcamera.so of its own, so that the
+    // library stays loaded for as long as a sweep may be blocked in it.
+    libhandle = ::dlopen("liboemcamera.so", RTLD_NOW);
+    LOGV("AF: loading libqcamera at %p", libhandle);
+    if (!libhandle) {
+        LOGE("FATAL ERROR: could not dlopen liboemcamera.so: %s", dlerror());
+        close(mAutoFocusFd);
+        mAutoFocusFd = -1;
+        return false;
     }
 #endif
 
-    status_t rc = native_cancel_afmode(mCameraControlFd, mAutoFocusFd) ?
-        NO_ERROR :
-        UNKNOWN_ERROR;
+    // The worker is detached; stopAutoFocusWorker() waits for it through
+    // mAutoFocusThreadRunning.
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    mAutoFocusExiting = false;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    mAutoFocusThreadRunning =
+        !pthread_create(&mAutoFocusThread, &attr,
+                        auto_focus_thread, libhandle);
+    if (!mAutoFocusThreadRunning) {
+        LOGE("failed to start autofocus thread");
+        close(mAutoFocusFd);
+        mAutoFocusFd = -1;
+#if DLOPEN_LIBMMCAMERA
+        ::dlclose(libhandle);
+#endif
+        return false;
+    }
+    return true;
+}
+
+// Ends the worker, cutting short a sweep in progress.  No focus callback is
+// delivered for it.
+void QualcommCameraHardware::stopAutoFocusWorker()
+{
+    mAutoFocusThreadLock.lock();
+    if (!mAutoFocusThreadRunning) {
+        mAutoFocusThreadLock.unlock();
+        return;
+    }
+    mAutoFocusExiting = true;
+    mAutoFocusPending = false;
+    bool active = mAutoFocusActive;
+    mAutoFocusWait.broadcast();
+    mAutoFocusThreadLock.unlock();
 
-    LOGV("cancelAutoFocusInternal X: %d", rc);
-    return rc;
-}
+    if (active)
+        native_cancel_afmode(mControlQueue);
 
-void *auto_focus_thread(void *user)
-{
-    LOGV("auto_focus_thread E");
-    sp<QualcommCameraHardware> obj = QualcommCameraHardware::getInstance();
-    if (obj != 0) {
-        obj->runAutoFocus();
+    Mutex::Autolock l(&mAutoFocusThreadLock);
+    while (mAutoFocusThreadRunning) {
+        LOGV("waiting for autofocus thread to exit.");
+        mAutoFocusWait.wait(mAutoFocusThreadLock);
     }
-    else LOGW("not starting autofocus: the object went away!");
-    LOGV("auto_focus_thread X");
-    return NULL;
 }
 
 status_t QualcommCameraHardware::autoFocus()
@@ -1548,25 +2680,36 @@ status_t QualcommCameraHardware::autoFocus()
         return UNKNOWN_ERROR;
     }
 
+    int mode = AF_MODE_AUTO;
+    if (strcmp(mParameters.get(CameraParameters::KEY_FOCUS_MODE),
+               CameraParameters::FOCUS_MODE_INFINITY) == 0)
+        mode = -1;
+
+    startAutoFocusWorker();
     {
-        mAutoFocusThreadLock.lock();
+        Mutex::Autolock afLock(&mAutoFocusThreadLock);
         if (!mAutoFocusThreadRunning) {
-            // Create a detached thread here so that we don't have to wait
-            // for it when we cancel AF.
-            pthread_t thr;
-            pthread_attr_t attr;
-            pthread_attr_init(&attr);
-            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-            mAutoFocusThreadRunning =
-                !pthread_create(&thr, &attr,
-                                auto_focus_thread, NULL);
-            if (!mAutoFocusThreadRunning) {
-                LOGE("failed to start autofocus thread");
-                mAutoFocusThreadLock.unlock();
-                return UNKNOWN_ERROR;
+            LOGE("autoFocus X: autofocus thread is not running");
+            return UNKNOWN_ERROR;
+        }
+        if (mAutoFocusActive) {
+            // Report the sweep that is running, continuous or not.
+            mAutoFocusNotify = true;
+        } else if (!mAutoFocusPending) {
+            if (mContinuousFocus && mFocusConverged) {
+                mode = -1;
+                mFocusStats.requestsSkipped++;
             }
+            mAutoFocusMode = mode;
+            mAutoFocusPending = true;
+            mAutoFocusWait.broadcast();
         }
-        mAutoFocusThreadLock.unlock();
+    }
+
+    if (mPrepareCaptureMode && mCameraRunning) {
+        Mutex::Autolock cl(&mCaptureLock);
+        if (mCaptureState == CAPTURE_IDLE)
+            stageCaptureLocked();
     }
 
     LOGV("autoFocus X");
@@ -1582,6 +2725,7 @@ status_t QualcommCameraHardware::cancelAutoFocus()
     if (mCameraRunning && mNotifyCallback && (mMsgEnabled & CAMERA_MSG_FOCUS)) {
         rc = cancelAutoFocusInternal();
     }
+    unstageCapture();
 
     LOGV("cancelAutoFocus X");
     return rc;
@@ -1590,15 +2734,36 @@ status_t QualcommCameraHardware::cancelAutoFocus()
 void QualcommCameraHardware::runSnapshotThread(void *data)
 {
     LOGV("runSnapshotThread E");
-    if (native_start_snapshot(mCameraControlFd))
-        receiveRawPicture();
-    else
-        LOGE("main: native_start_snapshot failed!");
 
-    mSnapshotThreadWaitLock.lock();
-    mSnapshotThreadRunning = false;
-    mSnapshotThreadWait.signal();
-    mSnapshotThreadWaitLock.unlock();
+    for (;;) {
+        mCaptureLock.lock();
+        bool staging = mCaptureState == CAPTURE_STAGING;
+        mCaptureLock.unlock();
+
+        // A staged capture waits for takePicture() without a thread.
+        if (!staging || runStaging()) {
+            for (;;) {
+                if (runCapture())
+                    break;  // receiveJpegPicture() finishes this capture
+                if (!finishCapture(false))
+                    break;  // nothing queued
+            }
+        }
+
+        // startCaptureWorkerLocked() hands a capture to this thread, if it
+        // has not exited yet, rather than wait for it.
+        mSnapshotThreadWaitLock.lock();
+        bool restart = mSnapshotThreadRestart;
+        mSnapshotThreadRestart = false;
+        if (!restart) {
+            mSnapshotThreadRunning = false;
+            mSnapshotThreadWait.signal();
+        }
+        mSnapshotThreadWaitLock.unlock();
+        if (!restart)
+            break;
+        LOGV("runSnapshotThread: taking over the next capture");
+    }
 
     LOGV("runSnapshotThread X");
 }
@@ -1615,35 +2780,60 @@ void *snapshot_thread(void *user)
     return NULL;
 }
 
-status_t QualcommCameraHardware::takePicture()
+bool QualcommCameraHardware::advanceCapture(CaptureState next)
 {
-    LOGV("takePicture(%d)", mMsgEnabled);
-    Mutex::Autolock l(&mLock);
-
-    // Wait for old snapshot thread to complete.
-    mSnapshotThreadWaitLock.lock();
-    while (mSnapshotThreadRunning) {
-        LOGV("takePicture: waiting for old snapshot thread to complete.");
-        mSnapshotThreadWait.wait(mSnapshotThreadWaitLock);
-        LOGV("takePicture: old snapshot thread completed.");
+    Mutex::Autolock l(&mCaptureLock);
+    if (mCaptureCancelled) {
+        LOGV("capture cancelled in state %d", mCaptureState);
+        return false;
     }
+    LOGV("capture state %d -> %d", mCaptureState, next);
+    mCaptureState = next;
+    return true;
+}
 
-    if(!native_prepare_snapshot(mCameraControlFd)) {
-        mSnapshotThreadWaitLock.unlock();
-        return UNKNOWN_ERROR;
-    }
+bool QualcommCameraHardware::captureCancelled()
+{
+    Mutex::Autolock l(&mCaptureLock);
+    return mCaptureCancelled;
+}
 
-    stopPreviewInternal();
+// Returns the capture to CAPTURE_IDLE.  If another capture was queued, it
+// becomes CAPTURE_QUEUED, and either a new snapshot thread is started for
+// it (startQueued) or true is returned so that the calling snapshot thread
+// runs it.
+bool QualcommCameraHardware::finishCapture(bool startQueued)
+{
+    Mutex::Autolock l(&mCaptureLock);
+    LOGV("capture state %d -> %d", mCaptureState, CAPTURE_IDLE);
+    mCaptureState = CAPTURE_IDLE;
+    mCaptureCancelled = false;
+    if (!mCaptureQueued)
+        return false;
 
-    if (!initRaw(mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE))) {
-        LOGE("initRaw failed.  Not taking picture.");
-        mSnapshotThreadWaitLock.unlock();
-        return UNKNOWN_ERROR;
+    mCaptureQueued = false;
+    mCaptureState = CAPTURE_QUEUED;
+    profileBegin();
+    if (startQueued) {
+        startCaptureWorkerLocked();
+        return false;
     }
+    return true;
+}
 
-    mShutterLock.lock();
-    mShutterPending = true;
-    mShutterLock.unlock();
+// Must be called with mCaptureLock held and the capture in CAPTURE_QUEUED
+// or CAPTURE_STAGING.  Callers may hold mLock and mCallbackLock as well, so
+// this never waits for a previous snapshot thread: one that is still on its
+// way out runs the capture instead.
+bool QualcommCameraHardware::startCaptureWorkerLocked()
+{
+    mSnapshotThreadWaitLock.lock();
+    if (mSnapshotThreadRunning) {
+        LOGV("handing the capture to the running snapshot thread.");
+        mSnapshotThreadRestart = true;
+        mSnapshotThreadWaitLock.unlock();
+        return true;
+    }
 
     pthread_attr_t attr;
     pthread_attr_init(&attr);
@@ -1652,21 +2842,314 @@ status_t QualcommCameraHardware::takePicture()
                                              &attr,
                                              snapshot_thread,
                                              NULL);
+    bool started = mSnapshotThreadRunning;
     mSnapshotThreadWaitLock.unlock();
 
+    if (!started) {
+        LOGE("failed to start snapshot thread");
+        mCaptureState = CAPTURE_IDLE;
+    }
+    return started;
+}
+
+// Must be called with mCaptureLock held, the capture in CAPTURE_IDLE and
+// preview running.
+void QualcommCameraHardware::stageCaptureLocked()
+{
+    LOGV("capture state %d -> %d", mCaptureState, CAPTURE_STAGING);
+    mCaptureCancelled = false;
+    mCaptureStaged = false;
+    mCaptureState = CAPTURE_STAGING;
+    mStageStart = systemTime();
+    if (startCaptureWorkerLocked())
+        mPrepareStats.staged++;
+}
+
+// Runs on the snapshot thread for a capture in CAPTURE_STAGING.  Returns
+// true when takePicture() came in meanwhile and the capture is to run now.
+bool QualcommCameraHardware::runStaging()
+{
+    bool staged = native_prepare_snapshot(mControlQueue);
+    if (!staged)
+        LOGW("runStaging: native_prepare_snapshot failed");
+    else {
+        // The heaps are allocated without mLock; stopping preview meanwhile
+        // cancels the capture, which drops them below.
+        mLock.lock();
+        staged = !captureCancelled() && mCameraRunning;
+        if (staged) {
+            mStagedJpegHeap =
+                mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE);
+            mCaptureDimension = mDimension;
+        }
+        mLock.unlock();
+        if (staged)
+            staged = initRaw(mStagedJpegHeap);
+    }
+
+    mCaptureLock.lock();
+    if (staged && !mCaptureCancelled) {
+        mStageEnd = systemTime();
+        mCaptureStaged = true;
+        if (!mCaptureQueued) {
+            LOGV("capture state %d -> %d", mCaptureState, CAPTURE_STAGED);
+            mCaptureState = CAPTURE_STAGED;
+            mCaptureLock.unlock();
+            return false;
+        }
+        // takePicture() has been waiting since mStageRequested.
+        mStageSaved = mStageRequested - mStageStart;
+        mCaptureQueued = false;
+        mCaptureState = CAPTURE_QUEUED;
+        mCaptureLock.unlock();
+        profileBegin();
+        return true;
+    }
+    mCaptureStaged = false;
+    mPrepareStats.discarded++;
+    mCaptureLock.unlock();
+
+    if (staged)
+        deinitRaw();
+    return finishCapture(false);
+}
+
+// Drops a capture in CAPTURE_STAGED, and makes one in CAPTURE_STAGING drop
+// itself.
+void QualcommCameraHardware::unstageCapture()
+{
+    mCaptureLock.lock();
+    if (mCaptureState == CAPTURE_STAGING) {
+        mCaptureCancelled = true;
+        mCaptureLock.unlock();
+        return;
+    }
+    bool staged = mCaptureState == CAPTURE_STAGED;
+    if (staged) {
+        LOGV("capture state %d -> %d", mCaptureState, CAPTURE_IDLE);
+        mCaptureState = CAPTURE_IDLE;
+        mCaptureStaged = false;
+        mPrepareStats.discarded++;
+    }
+    mCaptureLock.unlock();
+
+    if (staged)
+        deinitRaw();
+}
+
+// takePicture() has already returned by the time a capture fails, so the
+// failure is reported through CAMERA_MSG_ERROR unless it was cancelled.
+// The Locked variant is for callers that hold mCallbackLock.
+void QualcommCameraHardware::notifyCaptureErrorLocked()
+{
+    if (!captureCancelled() && mNotifyCallback &&
+        (mMsgEnabled & CAMERA_MSG_ERROR))
+        mNotifyCallback(CAMERA_MSG_ERROR, 1 /* CAMERA_ERROR_UNKNOWN */, 0,
+                        mCallbackCookie);
+}
+
+void QualcommCameraHardware::notifyCaptureError()
+{
+    Mutex::Autolock cbLock(&mCallbackLock);
+    notifyCaptureErrorLocked();
+}
+
+// Runs one capture on the snapshot thread.  Returns true once the JPEG
+// encoder owns the capture; it is then completed by receiveJpegPicture().
+bool QualcommCameraHardware::runCapture()
+{
+    mCaptureLock.lock();
+    bool staged = mCaptureStaged;
+    nsecs_t saved = mStageSaved;
+    mCaptureStaged = false;
+    mCaptureLock.unlock();
+
+    if (!advanceCapture(CAPTURE_PREPARING)) {
+        if (staged)
+            deinitRaw();
+        return false;
+    }
+    waitForContinuousFocus();
+    // The exposure settings of a staged prepare go stale after a while.
+    if (!staged || systemTime() - mStageEnd > ms2ns(STAGED_PREPARE_MS)) {
+        nsecs_t start = systemTime();
+        if (!native_prepare_snapshot(mControlQueue)) {
+            LOGE("runCapture: native_prepare_snapshot failed!");
+            if (staged)
+                deinitRaw();
+            notifyCaptureError();
+            return false;
+        }
+        saved -= systemTime() - start;
+        profileStage(STAGE_PREPARE_SNAPSHOT);
+    }
+
+    if (!advanceCapture(CAPTURE_ALLOCATING)) {
+        if (staged)
+            deinitRaw();
+        return false;
+    }
+    // mLock only guards reading the parameters; stopping preview and
+    // allocating the heaps run without it.
+    bool initJpegHeap, reuseHeaps;
+    {
+        Mutex::Autolock l(&mLock);
+        initJpegHeap =
+            mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE);
+        // The staged heaps are in place already.
+        reuseHeaps = staged && (mStagedJpegHeap || !initJpegHeap);
+        if (!reuseHeaps)
+            mCaptureDimension = mDimension;
+    }
+    stopPreviewForCapture();
+    profileStage(STAGE_STOP_PREVIEW);
+
+    bool initialized = true;
+    if (reuseHeaps) {
+        // Nothing to allocate.
+    } else if (!initRaw(initJpegHeap)) {
+        LOGE("initRaw failed.  Not taking picture.");
+        initialized = false;
+    }
+    else profileStage(STAGE_INIT_RAW);
+    if (staged) {
+        Mutex::Autolock cl(&mCaptureLock);
+        mPrepareStats.used++;
+        if (saved > 0)
+            mPrepareStats.saved += saved;
+    }
+    if (!initialized) {
+        notifyCaptureError();
+        return false;
+    }
+
+    mShutterLock.lock();
+    mShutterPending = true;
+    mShutterLock.unlock();
+
+    if (!advanceCapture(CAPTURE_EXPOSING)) {
+        deinitRaw();
+        return false;
+    }
+    if (!native_start_snapshot(mControlQueue)) {
+        LOGE("runCapture: native_start_snapshot failed!");
+        deinitRaw();
+        notifyCaptureError();
+        return false;
+    }
+    profileStage(STAGE_START_SNAPSHOT);
+
+    return receiveRawPicture();
+}
+
+status_t QualcommCameraHardware::takePicture()
+{
+    LOGV("takePicture(%d)", mMsgEnabled);
+    Mutex::Autolock l(&mLock);
+
+    if (mCameraControlFd < 0) {
+        LOGE("takePicture X: camera is not open");
+        return INVALID_OPERATION;
+    }
+
+    Mutex::Autolock cl(&mCaptureLock);
+    if (mCaptureState == CAPTURE_STAGED) {
+        LOGV("takePicture: capture staged %lld ms ago",
+             ns2ms(systemTime() - mStageEnd));
+        mStageSaved = mStageEnd - mStageStart;
+        profileBegin();
+        mCaptureCancelled = false;
+        mCaptureState = CAPTURE_QUEUED;
+        bool started = startCaptureWorkerLocked();
+        LOGV("takePicture: X");
+        return started ? NO_ERROR : UNKNOWN_ERROR;
+    }
+    if (mCaptureState == CAPTURE_STAGING && !mCaptureQueued) {
+        // runStaging() works out the time saved from this.
+        mStageRequested = systemTime();
+    }
+    if (mCaptureState != CAPTURE_IDLE) {
+        if (mCaptureQueued) {
+            LOGE("takePicture X: a picture is already queued");
+            return INVALID_OPERATION;
+        }
+        LOGV("takePicture X: queued behind capture in state %d",
+             mCaptureState);
+        mCaptureQueued = true;
+        return NO_ERROR;
+    }
+
+    profileBegin();
+    mCaptureCancelled = false;
+    mCaptureState = CAPTURE_QUEUED;
+    bool started = startCaptureWorkerLocked();
+
     LOGV("takePicture: X");
-    return mSnapshotThreadRunning ? NO_ERROR : UNKNOWN_ERROR;
+    return started ? NO_ERROR : UNKNOWN_ERROR;
 }
 
 status_t QualcommCameraHardware::cancelPicture()
 {
-    status_t rc;
+    status_t rc = NO_ERROR;
     LOGV("cancelPicture: E");
-    rc = native_stop_snapshot(mCameraControlFd) ? NO_ERROR : UNKNOWN_ERROR;
+
+    unstageCapture();
+
+    // The stop command can block for as long as the driver takes to answer,
+    // so it goes out after mCaptureLock is released; the capture callbacks
+    // see mCaptureCancelled meanwhile.
+    bool exposing = false;
+    {
+        Mutex::Autolock l(&mCaptureLock);
+        mCaptureQueued = false;
+        if (mCaptureState != CAPTURE_IDLE) {
+            mCaptureCancelled = true;
+            exposing = mCaptureState == CAPTURE_EXPOSING;
+        }
+    }
+
+    if (exposing)
+        rc = native_stop_snapshot(mControlQueue) ? NO_ERROR : UNKNOWN_ERROR;
+
     LOGV("cancelPicture: X: %d", rc);
     return rc;
 }
 
+const QualcommCameraHardware::ParameterSetter
+QualcommCameraHardware::kParameterSetters[] = {
+    { &QualcommCameraHardware::setPreviewSize, false,
+      { CameraParameters::KEY_PREVIEW_SIZE } },
+    { &QualcommCameraHardware::setPictureSize, false,
+      { CameraParameters::KEY_PICTURE_SIZE } },
+    { &QualcommCameraHardware::setJpegQuality, false,
+      { CameraParameters::KEY_JPEG_QUALITY,
+        CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY } },
+    { &QualcommCameraHardware::setAntibanding, true,
+      { CameraParameters::KEY_ANTIBANDING } },
+    { &QualcommCameraHardware::setEffect, true,
+      { CameraParameters::KEY_EFFECT } },
+    { &QualcommCameraHardware::setWhiteBalance, true,
+      { CameraParameters::KEY_WHITE_BALANCE } },
+    { &QualcommCameraHardware::setFlash, true,
+      { CameraParameters::KEY_FLASH_MODE } },
+    { &QualcommCameraHardware::setGpsLocation, false,
+      { CameraParameters::KEY_GPS_LATITUDE,
+        CameraParameters::KEY_GPS_LONGITUDE,
+        CameraParameters::KEY_GPS_ALTITUDE,
+        CameraParameters::KEY_GPS_TIMESTAMP } },
+    { &QualcommCameraHardware::setRotation, false,
+      { CameraParameters::KEY_ROTATION } },
+    { &QualcommCameraHardware::setZoom, true,
+      { "zoom" } },
+    { &QualcommCameraHardware::setFocusMode, false,
+      { CameraParameters::KEY_FOCUS_MODE } },
+    { &QualcommCameraHardware::setOrientation, false,
+      { "orientation" } },
+    { &QualcommCameraHardware::setPrepareCapture, false,
+      { "prepare-capture" } },
+    { NULL }
+};
+
 status_t QualcommCameraHardware::setParameters(const CameraParameters& params)
 {
     LOGV("setParameters: E params = %p", &params);
@@ -1674,33 +3157,207 @@ status_t QualcommCameraHardware::setParameters(const CameraParameters& params)
     Mutex::Autolock l(&mLock);
     status_t rc, final_rc = NO_ERROR;
 
-    if ((rc = setPreviewSize(params)))  final_rc = rc;
-    if ((rc = setPictureSize(params)))  final_rc = rc;
-    if ((rc = setJpegQuality(params)))  final_rc = rc;
-    if ((rc = setAntibanding(params)))  final_rc = rc;
-    if ((rc = setEffect(params)))       final_rc = rc;
-    if ((rc = setWhiteBalance(params))) final_rc = rc;
-    if ((rc = setFlash(params)))        final_rc = rc;
-    if ((rc = setGpsLocation(params)))  final_rc = rc;
-    if ((rc = setRotation(params)))     final_rc = rc;
-    if ((rc = setZoom(params)))         final_rc = rc;
-    if ((rc = setFocusMode(params)))    final_rc = rc;
-    if ((rc = setOrientation(params)))  final_rc = rc;
+    bool changed_any = false;
+    mParameterStats.calls++;
+    for (const ParameterSetter *setter = kParameterSetters;
+         setter->set != NULL; setter++) {
+        bool changed = mParmsForceApply;
+        for (int i = 0; !changed && setter->keys[i] != NULL; i++) {
+            const char *value = params.get(setter->keys[i]);
+            const char *current = mParameters.get(setter->keys[i]);
+            changed = (value == NULL || current == NULL) ?
+                value != current : strcmp(value, current) != 0;
+        }
+        if (!changed) {
+            mParameterStats.settersSkipped++;
+            if (setter->sendsCommand)
+                mParameterStats.commandsSkipped++;
+            continue;
+        }
+        mParameterStats.settersRun++;
+        changed_any = true;
+        if ((rc = (this->*setter->set)(params))) final_rc = rc;
+    }
+    mParmsForceApply = false;
+
+    if (changed_any)
+        publishParameters();
+
+    if ((rc = flushParmCommands(true))) final_rc = rc;
 
     LOGV("setParameters: X");
     return final_rc;
 }
 
+void QualcommCameraHardware::publishParameters()
+{
+    Mutex::Autolock l(&mParametersSnapshotLock);
+    mParametersSnapshot = mParameters;
+    mParametersVersion++;
+}
+
 CameraParameters QualcommCameraHardware::getParameters() const
 {
     LOGV("getParameters: EX");
-    return mParameters;
+    Mutex::Autolock l(&mParametersSnapshotLock);
+    return mParametersSnapshot;
+}
+
+void *smooth_zoom_thread(void *user)
+{
+    LOGV("smooth_zoom_thread E");
+    sp<QualcommCameraHardware> obj = QualcommCameraHardware::getInstance();
+    if (obj != 0) {
+        obj->runSmoothZoom();
+    }
+    else LOGW("not starting smooth zoom: the object went away!");
+    LOGV("smooth_zoom_thread X");
+    return NULL;
+}
+
+// Sends one driver zoom value, and publishes the zoom level whenever the
+// value lands on a whole level.  Goes through the parameter command queue
+// so that setParameters() knows what the driver was last sent; if the
+// driver falls behind, the queued steps coalesce.
+bool QualcommCameraHardware::applySmoothZoomStep(int value)
+{
+    Mutex::Autolock l(&mLock);
+    if (mCameraControlFd < 0)
+        return false;
+    queueParm(CAMERA_SET_PARM_ZOOM, value);
+    flushParmCommands(false);
+    if (value % ZOOM_STEP == 0) {
+        mParameters.set("zoom", value / ZOOM_STEP);
+        publishParameters();
+    }
+    return true;
+}
+
+void QualcommCameraHardware::notifySmoothZoom(int level, bool stopped)
+{
+    mCallbackLock.lock();
+    bool zoomEnabled = mNotifyCallback && (mMsgEnabled & QCAMERA_MSG_ZOOM);
+    notify_callback cb = mNotifyCallback;
+    void *data = mCallbackCookie;
+    mCallbackLock.unlock();
+    if (zoomEnabled)
+        cb(QCAMERA_MSG_ZOOM, level, stopped, data);
+}
+
+void QualcommCameraHardware::runSmoothZoom()
+{
+    mLock.lock();
+    int value = mParameters.getInt("zoom") * ZOOM_STEP;
+    mLock.unlock();
+
+    bool failed = false;
+    mSmoothZoomLock.lock();
+    while (!failed) {
+        for (;;) {
+            int target = mSmoothZoomTarget * ZOOM_STEP;
+            if (mSmoothZoomStopping) {
+                // Finish at the next whole level in the direction of travel
+                // rather than jumping back.
+                int level = value / ZOOM_STEP;
+                if (value % ZOOM_STEP && target > value)
+                    level++;
+                target = level * ZOOM_STEP;
+            }
+            if (value == target)
+                break;
+            mSmoothZoomLock.unlock();
+
+            int next = value + (target > value ? 1 : -1);
+            if (!applySmoothZoomStep(next)) {
+                LOGE("smooth zoom: failed to set zoom value %d", next);
+                failed = true;
+                mSmoothZoomLock.lock();
+                break;
+            }
+            value = next;
+            if (value % ZOOM_STEP == 0 && value != target)
+                notifySmoothZoom(value / ZOOM_STEP, false);
+
+            mSmoothZoomLock.lock();
+            if (value != target)
+                mSmoothZoomWait.waitRelative(mSmoothZoomLock,
+                                             ms2ns(SMOOTH_ZOOM_STEP_MS));
+        }
+        mSmoothZoomLock.unlock();
+
+        notifySmoothZoom(value / ZOOM_STEP, true);
+
+        // startSmoothZoom() may have picked a new target while the last
+        // notification was delivered.
+        mSmoothZoomLock.lock();
+        if (mSmoothZoomStopping || mSmoothZoomTarget * ZOOM_STEP == value)
+            break;
+    }
+    mSmoothZoomRunning = false;
+    mSmoothZoomStopping = false;
+    mSmoothZoomWait.broadcast();
+    mSmoothZoomLock.unlock();
+}
+
+status_t QualcommCameraHardware::startSmoothZoom(int level)
+{
+    if (level < 0 || level > MAX_ZOOM_LEVEL) {
+        LOGE("startSmoothZoom: invalid zoom level %d", level);
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock l(&mSmoothZoomLock);
+    mSmoothZoomTarget = level;
+    mSmoothZoomStopping = false;
+    if (mSmoothZoomRunning) {
+        LOGV("startSmoothZoom: retargeting to %d", level);
+        mSmoothZoomWait.broadcast();
+        return NO_ERROR;
+    }
+
+    // Detached, like the autofocus thread; release() waits for
+    // mSmoothZoomRunning to clear instead of joining it.
+    pthread_t thr;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    mSmoothZoomRunning =
+        !pthread_create(&thr, &attr, smooth_zoom_thread, NULL);
+    if (!mSmoothZoomRunning) {
+        LOGE("failed to start smooth zoom thread");
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+void QualcommCameraHardware::stopSmoothZoom(bool wait)
+{
+    Mutex::Autolock l(&mSmoothZoomLock);
+    if (!mSmoothZoomRunning)
+        return;
+    mSmoothZoomStopping = true;
+    mSmoothZoomWait.broadcast();
+    while (wait && mSmoothZoomRunning) {
+        LOGV("stopSmoothZoom: waiting for smooth zoom thread to complete.");
+        mSmoothZoomWait.wait(mSmoothZoomLock);
+    }
 }
 
 status_t QualcommCameraHardware::sendCommand(int32_t command, int32_t arg1,
                                              int32_t arg2)
 {
-    LOGV("sendCommand: EX");
+    LOGV("sendCommand: command %d arg1 %d arg2 %d", command, arg1, arg2);
+
+    if (mCameraControlFd < 0)
+        return INVALID_OPERATION;
+
+    switch (command) {
+    case QCAMERA_CMD_START_SMOOTH_ZOOM:
+        return startSmoothZoom(arg1);
+    case QCAMERA_CMD_STOP_SMOOTH_ZOOM:
+        stopSmoothZoom(false);
+        return NO_ERROR;
+    }
     return BAD_VALUE;
 }
 
@@ -1718,6 +3375,7 @@ wp<QualcommCameraHardware> QualcommCameraHardware::singleton;
 sp<CameraHardwareInterface> QualcommCameraHardware::createInstance()
 {
     LOGD("createInstance: E");
+    nsecs_t start = systemTime();
 
     Mutex::Autolock lock(&singleton_lock);
 
@@ -1726,6 +3384,18 @@ sp<CameraHardwareInterface> QualcommCameraHardware::createInstance()
         LOGD("Wait for previous release.");
         singleton_wait.wait(singleton_lock);
     }
+    nsecs_t waited = systemTime() - start;
+
+    if (standby_instance != 0) {
+        sp<QualcommCameraHardware> hardware = standby_instance;
+        standby_instance.clear();
+        standby_wait.signal();
+        standby_stats.resumed++;
+        hardware->resume();
+        record_open_time(systemTime() - start, waited);
+        LOGD("createInstance: X resumed hardware=%p", &(*hardware));
+        return hardware;
+    }
 
     if (singleton != 0) {
         sp<CameraHardwareInterface> hardware = singleton.promote();
@@ -1735,13 +3405,15 @@ sp<CameraHardwareInterface> QualcommCameraHardware::createInstance()
         }
     }
 
-    {
+    static bool oncrpc_present;
+    if (!oncrpc_present) {
         struct stat st;
         int rc = stat("/dev/oncrpc", &st);
         if (rc < 0) {
             LOGD("createInstance: X failed to create hardware: %s", strerror(errno));
             return NULL;
         }
+        oncrpc_present = true;
     }
 
     QualcommCameraHardware *cam = new QualcommCameraHardware();
@@ -1754,6 +3426,9 @@ sp<CameraHardwareInterface> QualcommCameraHardware::createInstance()
     }
 
     cam->initDefaultParameters();
+
+    record_open_time(systemTime() - start, waited);
+
     LOGD("createInstance: X created hardware=%p", &(*hardware));
     return hardware;
 }
@@ -1792,6 +3467,10 @@ void QualcommCameraHardware::receivePreviewFrame(struct msm_frame *frame)
     ssize_t offset =
         (ssize_t)frame->buffer - (ssize_t)mPreviewHeap->mHeap->base();
     offset /= mPreviewHeap->mAlignedBufferSize;
+    CAMERA_TRACE_SCOPE("previewFrame", offset);
+
+    if (mContinuousFocus)
+        updateFocusScene((const uint8_t *)frame->buffer + frame->y_off);
 
     mInPreviewCallback = true;
     if (pcb != NULL && (msgEnabled & CAMERA_MSG_PREVIEW_FRAME))
@@ -1856,9 +3535,13 @@ bool QualcommCameraHardware::recordingEnabled()
     return mCameraRunning && mDataCallbackTimestamp && (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME);
 }
 
+// Called from the config thread and from receiveRawPicture(), neither of
+// which holds mCallbackLock.  It is held across the callback, so that
+// release() cannot detach the client under it.
 void QualcommCameraHardware::notifyShutter(common_crop_t *crop)
 {
     mShutterLock.lock();
+    mCallbackLock.lock();
     image_rect_type size;
 
     if (mShutterPending && mNotifyCallback && (mMsgEnabled & CAMERA_MSG_SHUTTER)) {
@@ -1872,11 +3555,11 @@ void QualcommCameraHardware::notifyShutter(common_crop_t *crop)
         mDisplayHeap = mRawHeap;
         if (crop->in1_w == 0 || crop->in1_h == 0) {
             // Full size
-            size.width = mDimension.picture_width;
-            size.height = mDimension.picture_height;
+            size.width = mCaptureDimension.picture_width;
+            size.height = mCaptureDimension.picture_height;
             if (size.width > 2048 || size.height > 2048) {
-                size.width = mDimension.ui_thumbnail_width;
-                size.height = mDimension.ui_thumbnail_height;
+                size.width = mCaptureDimension.ui_thumbnail_width;
+                size.height = mCaptureDimension.ui_thumbnail_height;
                 mDisplayHeap = mThumbnailHeap;
             }
         } else {
@@ -1893,7 +3576,9 @@ void QualcommCameraHardware::notifyShutter(common_crop_t *crop)
         mNotifyCallback(CAMERA_MSG_SHUTTER, (int32_t)&size, 0,
                         mCallbackCookie);
         mShutterPending = false;
+        profileStage(STAGE_SHUTTER);
     }
+    mCallbackLock.unlock();
     mShutterLock.unlock();
 }
 
@@ -1939,16 +3624,24 @@ static void crop_yuv420(uint32_t width, uint32_t height,
                cropped_width);
 }
 
-void QualcommCameraHardware::receiveRawPicture()
+bool QualcommCameraHardware::receiveRawPicture()
 {
     LOGV("receiveRawPicture: E");
 
-    Mutex::Autolock cbLock(&mCallbackLock);
-    if (mDataCallback && (mMsgEnabled & CAMERA_MSG_RAW_IMAGE)) {
+    // mCallbackLock is only held to look at the callbacks and while one
+    // runs, so that release() never waits for native_get_picture().
+    mCallbackLock.lock();
+    bool rawEnabled = mDataCallback && (mMsgEnabled & CAMERA_MSG_RAW_IMAGE);
+    mCallbackLock.unlock();
+
+    if (rawEnabled) {
         if(native_get_picture(mCameraControlFd, &mCrop) == false) {
             LOGE("getPicture failed!");
-            return;
+            notifyCaptureError();
+            deinitRaw();
+            return false;
         }
+        profileStage(STAGE_GET_PICTURE);
         mCrop.in1_w &= ~1;
         mCrop.in1_h &= ~1;
         mCrop.in2_w &= ~1;
@@ -1967,32 +3660,67 @@ void QualcommCameraHardware::receiveRawPicture()
             // We do not need jpeg encoder to upscale the image. Set the new
             // dimension for encoder.
 	    // FIXME: Fill these in
-            //mDimension.orig_picture_dx = mCrop.in2_w;
-            //mDimension.orig_picture_dy = mCrop.in2_h;
-            //mDimension.thumbnail_width = mCrop.in1_w;
-            //mDimension.thumbnail_height = mCrop.in1_h;
+            //mCaptureDimension.orig_picture_dx = mCrop.in2_w;
+            //mCaptureDimension.orig_picture_dy = mCrop.in2_h;
+            //mCaptureDimension.thumbnail_width = mCrop.in1_w;
+            //mCaptureDimension.thumbnail_height = mCrop.in1_h;
             memset(&mCrop, 0, sizeof(mCrop));
+            profileStage(STAGE_CROP);
+        }
+
+        if (captureCancelled()) {
+            LOGV("receiveRawPicture X: picture cancelled");
+            deinitRaw();
+            return false;
         }
 
-        mDataCallback(CAMERA_MSG_RAW_IMAGE, mDisplayHeap->mBuffers[0],
-                            mCallbackCookie);
+        mCallbackLock.lock();
+        if (mDataCallback && (mMsgEnabled & CAMERA_MSG_RAW_IMAGE))
+            mDataCallback(CAMERA_MSG_RAW_IMAGE, mDisplayHeap->mBuffers[0],
+                          mCallbackCookie);
+        mCallbackLock.unlock();
+        profileStage(STAGE_RAW_CALLBACK);
     }
     else LOGV("Raw-picture callback was canceled--skipping.");
 
-    if (mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)) {
+    // receiveJpegPicture() checks the callback again before delivering.
+    mCallbackLock.lock();
+    bool jpegEnabled =
+        mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE);
+    mCallbackLock.unlock();
+
+    if (jpegEnabled) {
+        if (!advanceCapture(CAPTURE_ENCODING)) {
+            LOGV("receiveRawPicture X: picture cancelled");
+            deinitRaw();
+            return false;
+        }
         mJpegSize = 0;
-        if (LINK_jpeg_encoder_init()) {
+        bool initialized = LINK_jpeg_encoder_init();
+#if DLOPEN_LIBMMCAMERA
+        if (!initialized && !soft_jpeg_encoder_selected) {
+            LOGW("DSP jpeg_encoder_init failed, falling back to software");
+            select_soft_jpeg_encoder();
+            initialized = LINK_jpeg_encoder_init();
+        }
+#endif
+        if (initialized) {
             if(native_jpeg_encode()) {
+                profileStage(STAGE_JPEG_START);
                 LOGV("receiveRawPicture: X (success)");
-                return;
+                return true;
             }
             LOGE("jpeg encoding failed");
         }
         else LOGE("receiveRawPicture X: jpeg_encoder_init failed.");
     }
-    else LOGV("JPEG callback is NULL, not encoding image.");
+    else {
+        LOGV("JPEG callback is NULL, not encoding image.");
+        profileEnd();
+    }
     deinitRaw();
     LOGV("receiveRawPicture: X");
+    return false;
 }
 
 void QualcommCameraHardware::receiveJpegPictureFragment(
@@ -2010,19 +3738,30 @@ void QualcommCameraHardware::receiveJpegPictureFragment(
              remaining);
         buff_size = remaining;
     }
+    CAMERA_TRACE_SCOPE("jpegFragment", buff_size);
+    nsecs_t start = systemTime();
     memcpy(base + mJpegSize, buff_ptr, buff_size);
     mJpegSize += buff_size;
+    profileFragment(systemTime() - start);
 }
 
-void QualcommCameraHardware::receiveJpegPicture(void)
+void QualcommCameraHardware::receiveJpegPicture(jpeg_event_t status)
 {
-    LOGV("receiveJpegPicture: E image (%d uint8_ts out of %d)",
-         mJpegSize, mJpegHeap->mBufferSize);
+    LOGV("receiveJpegPicture: E status %d image (%d uint8_ts out of %d)",
+         status, mJpegSize, mJpegHeap->mBufferSize);
+    profileStage(STAGE_JPEG_DONE);
     Mutex::Autolock cbLock(&mCallbackLock);
 
     int index = 0, rc;
 
-    if (mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)) {
+    if (status != JPEG_EVENT_DONE) {
+        LOGE("receiveJpegPicture: encoding failed (%d)", status);
+        notifyCaptureErrorLocked();
+    }
+    else if (captureCancelled()) {
+        LOGV("receiveJpegPicture: picture cancelled--not delivering image.");
+    }
+    else if (mDataCallback && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)) {
         // The reason we do not allocate into mJpegHeap->mBuffers[offset] is
         // that the JPEG image's size will probably change from one snapshot
         // to the next, so we cannot reuse the MemoryBase object.
@@ -2033,11 +3772,14 @@ void QualcommCameraHardware::receiveJpegPicture(void)
                        mJpegSize);
         mDataCallback(CAMERA_MSG_COMPRESSED_IMAGE, buffer, mCallbackCookie);
         buffer = NULL;
+        profileStage(STAGE_JPEG_CALLBACK);
     }
     else LOGV("JPEG callback was cancelled--not delivering image.");
+    profileEnd();
 
     LINK_jpeg_encoder_join();
     deinitRaw();
+    finishCapture(true);
 
     LOGV("receiveJpegPicture: X callback done.");
 }
@@ -2054,14 +3796,12 @@ status_t QualcommCameraHardware::setPreviewSize(const CameraParameters& params)
     LOGV("requested preview size %d x %d", width, height);
 
     // Validate the preview size
-    for (size_t i = 0; i < PREVIEW_SIZE_COUNT; ++i) {
-        if (width == preview_sizes[i].width
-           && height == preview_sizes[i].height) {
-            mParameters.setPreviewSize(width, height);
-            mDimension.display_width = width;
-            mDimension.display_height = height;
-            return NO_ERROR;
-        }
+    if (lookup_size(&preview_size_index, preview_sizes, PREVIEW_SIZE_COUNT,
+                    width, height) != NOT_FOUND) {
+        mParameters.setPreviewSize(width, height);
+        mDimension.display_width = width;
+        mDimension.display_height = height;
+        return NO_ERROR;
     }
     LOGE("Invalid preview size requested: %dx%d", width, height);
     return BAD_VALUE;
@@ -2074,14 +3814,15 @@ status_t QualcommCameraHardware::setPictureSize(const CameraParameters& params)
     LOGV("requested picture size %d x %d", width, height);
 
     // Validate the picture size
-    for (int i = 0; i < PICTURE_SIZE_COUNT; ++i) {
-        if (width == picture_sizes[i].width
-          && height == picture_sizes[i].height) {
-            mParameters.setPictureSize(width, height);
-            mDimension.picture_width = width;
-            mDimension.picture_height = height;
-            return NO_ERROR;
-        }
+    if (lookup_size(&picture_size_index, picture_sizes, PICTURE_SIZE_COUNT,
+                    width, height) != NOT_FOUND) {
+        if (width != mDimension.picture_width ||
+            height != mDimension.picture_height)
+            unstageCapture();
+        mParameters.setPictureSize(width, height);
+        mDimension.picture_width = width;
+        mDimension.picture_height = height;
+        return NO_ERROR;
     }
     LOGE("Invalid picture size requested: %dx%d", width, height);
     return BAD_VALUE;
@@ -2111,12 +3852,11 @@ status_t QualcommCameraHardware::setEffect(const CameraParameters& params)
 {
     const char *str = params.get(CameraParameters::KEY_EFFECT);
     if (str != NULL) {
-        int32_t value = attr_lookup(effects, sizeof(effects) / sizeof(str_map), str);
+        int32_t value = lookup_str_param(PARAM_EFFECT, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_EFFECT, str);
-            bool ret = native_set_parm(CAMERA_SET_PARM_EFFECT, sizeof(value),
-                                       (void *)&value);
-            return ret ? NO_ERROR : UNKNOWN_ERROR;
+            queueParm(CAMERA_SET_PARM_EFFECT, value);
+            return NO_ERROR;
         }
     }
     LOGE("Invalid effect value: %s", (str == NULL) ? "NULL" : str);
@@ -2127,12 +3867,11 @@ status_t QualcommCameraHardware::setWhiteBalance(const CameraParameters& params)
 {
     const char *str = params.get(CameraParameters::KEY_WHITE_BALANCE);
     if (str != NULL) {
-        int32_t value = attr_lookup(whitebalance, sizeof(whitebalance) / sizeof(str_map), str);
+        int32_t value = lookup_str_param(PARAM_WHITE_BALANCE, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_WHITE_BALANCE, str);
-            bool ret = native_set_parm(CAMERA_SET_PARM_WB, sizeof(value),
-                                       (void *)&value);
-            return ret ? NO_ERROR : UNKNOWN_ERROR;
+            queueParm(CAMERA_SET_PARM_WB, value);
+            return NO_ERROR;
         }
     }
     LOGE("Invalid whitebalance value: %s", (str == NULL) ? "NULL" : str);
@@ -2148,12 +3887,11 @@ status_t QualcommCameraHardware::setFlash(const CameraParameters& params)
 
     const char *str = params.get(CameraParameters::KEY_FLASH_MODE);
     if (str != NULL) {
-        int32_t value = attr_lookup(flash, sizeof(flash) / sizeof(str_map), str);
+        int32_t value = lookup_str_param(PARAM_FLASH, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_FLASH_MODE, str);
-            bool ret = native_set_parm(CAMERA_SET_PARM_LED_MODE,
-                                       sizeof(value), (void *)&value);
-            return ret ? NO_ERROR : UNKNOWN_ERROR;
+            queueParm(CAMERA_SET_PARM_LED_MODE, value);
+            return NO_ERROR;
         }
     }
     LOGE("Invalid flash mode value: %s", (str == NULL) ? "NULL" : str);
@@ -2164,8 +3902,7 @@ status_t QualcommCameraHardware::setAntibanding(const CameraParameters& params)
 {
     const char *str = params.get(CameraParameters::KEY_ANTIBANDING);
     if (str != NULL) {
-        int value = (camera_antibanding_type)attr_lookup(
-          antibanding, sizeof(antibanding) / sizeof(str_map), str);
+        int value = lookup_str_param(PARAM_ANTIBANDING, str);
         if (value != NOT_FOUND) {
             camera_antibanding_type temp = (camera_antibanding_type) value;
             // We don't have auto antibanding now, and simply set the frequency by country.
@@ -2173,7 +3910,7 @@ status_t QualcommCameraHardware::setAntibanding(const CameraParameters& params)
                 temp = camera_get_location();
             }
             mParameters.set(CameraParameters::KEY_ANTIBANDING, str);
-            native_set_parm(CAMERA_SET_PARM_ANTIBANDING, sizeof(camera_antibanding_type), (void *)&temp);
+            queueParm(CAMERA_SET_PARM_ANTIBANDING, temp);
             return NO_ERROR;
         }
     }
@@ -2233,16 +3970,22 @@ status_t QualcommCameraHardware::setZoom(const CameraParameters& params)
     // size is. Ex: zoom level 1 is always 1.2x, zoom level 2 is 1.44x, etc. So,
     // we need to have a fixed maximum zoom value and do read it from the
     // driver.
-    static const int ZOOM_STEP = 6;
     int32_t zoom_level = params.getInt("zoom");
 
+    // The smooth zoom worker owns the zoom while it runs, and a client
+    // that only changed other parameters may echo back a stale level.
+    mSmoothZoomLock.lock();
+    bool smoothZoomRunning = mSmoothZoomRunning;
+    mSmoothZoomLock.unlock();
+    if (smoothZoomRunning) {
+        LOGW("Ignoring zoom=%d during smooth zoom", zoom_level);
+        return NO_ERROR;
+    }
+
     LOGI("Set zoom=%d", zoom_level);
     if(zoom_level >= 0 && zoom_level <= MAX_ZOOM_LEVEL) {
         mParameters.set("zoom", zoom_level);
-        int32_t zoom_value = ZOOM_STEP * zoom_level;
-        bool ret = native_set_parm(CAMERA_SET_PARM_ZOOM,
-            sizeof(zoom_value), (void *)&zoom_value);
-        rc = ret ? NO_ERROR : UNKNOWN_ERROR;
+        queueParm(CAMERA_SET_PARM_ZOOM, ZOOM_STEP * zoom_level);
     } else {
         rc = BAD_VALUE;
     }
@@ -2254,12 +3997,14 @@ status_t QualcommCameraHardware::setFocusMode(const CameraParameters& params)
 {
     const char *str = params.get(CameraParameters::KEY_FOCUS_MODE);
     if (str != NULL) {
-        int32_t value = attr_lookup(focus_modes,
-                                    sizeof(focus_modes) / sizeof(str_map), str);
+        int32_t value = lookup_str_param(PARAM_FOCUS_MODE, str);
         if (value != NOT_FOUND) {
             mParameters.set(CameraParameters::KEY_FOCUS_MODE, str);
             // Focus step is reset to infinity when preview is started. We do
-            // not need to do anything now.
+            // not need to do anything now, other than to start or stop
+            // continuous focus.
+            mContinuousFocusMode = value == FOCUS_CONTINUOUS;
+            updateContinuousFocus();
             return NO_ERROR;
         }
     }
@@ -2284,6 +4029,24 @@ status_t QualcommCameraHardware::setOrientation(const CameraParameters& params)
     return NO_ERROR;
 }
 
+status_t QualcommCameraHardware::setPrepareCapture(const CameraParameters& params)
+{
+    const char *str = params.get("prepare-capture");
+    if (str == NULL || !strcmp(str, "false")) {
+        mParameters.set("prepare-capture", "false");
+        mPrepareCaptureMode = false;
+        unstageCapture();
+        return NO_ERROR;
+    }
+    if (!strcmp(str, "true")) {
+        mParameters.set("prepare-capture", "true");
+        mPrepareCaptureMode = true;
+        return NO_ERROR;
+    }
+    LOGE("Invalid prepare-capture value: %s", str);
+    return BAD_VALUE;
+}
+
 QualcommCameraHardware::MemPool::MemPool(int buffer_size, int num_buffers,
                                          int frame_size,
                                          const char *name) :
@@ -2332,6 +4095,7 @@ QualcommCameraHardware::AshmemPool::AshmemPool(int buffer_size, int num_buffers,
     ashmem_size += page_mask;
     ashmem_size &= ~page_mask;
 
+    CAMERA_TRACE_SCOPE("ashmemAlloc", ashmem_size);
     mHeap = new MemoryHeapBase(ashmem_size);
 
     completeInitialization();
@@ -2374,6 +4138,7 @@ QualcommCameraHardware::PmemPool::PmemPool(const char *pmem_pool,
     // Make a new mmap'ed heap that can be shared across processes.
     // mAlignedBufferSize is already in 4k aligned. (do we need total size necessary to be in power of 2??)
     mAlignedSize = mAlignedBufferSize * num_buffers;
+    CAMERA_TRACE_SCOPE("pmemAlloc", mAlignedSize);
 
     sp<MemoryHeapBase> masterHeap =
         new MemoryHeapBase(pmem_pool, mAlignedSize, flags);
@@ -2426,6 +4191,7 @@ QualcommCameraHardware::PmemPool::PmemPool(const char *pmem_pool,
 
 QualcommCameraHardware::PmemPool::~PmemPool()
 {
+    CAMERA_TRACE_SCOPE("pmemFree", mNumBuffers);
     LOGV("%s: %s E", __FUNCTION__, mName);
     if (mHeap != NULL) {
         // Unregister preview buffers with the camera drivers.
@@ -2539,11 +4305,9 @@ static void receive_jpeg_fragment_callback(uint8_t *buff_ptr, uint32_t buff_size
 static void receive_jpeg_callback(jpeg_event_t status)
 {
     LOGV("receive_jpeg_callback E (completion status %d)", status);
-    if (status == JPEG_EVENT_DONE) {
-        sp<QualcommCameraHardware> obj = QualcommCameraHardware::getInstance();
-        if (obj != 0) {
-            obj->receiveJpegPicture();
-        }
+    sp<QualcommCameraHardware> obj = QualcommCameraHardware::getInstance();
+    if (obj != 0) {
+        obj->receiveJpegPicture(status);
     }
     LOGV("receive_jpeg_callback X");
 }
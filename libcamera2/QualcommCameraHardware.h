@@ -22,6 +22,8 @@
 #include <binder/MemoryHeapBase.h>
 #include <stdint.h>
 
+#include "CameraControlQueue.h"
+
 extern "C" {
 #include <linux/android_pmem.h>
 #include <media/msm_camera.h>
@@ -29,6 +31,7 @@ extern "C" {
 
 #define MSM_CAMERA_CONTROL "/dev/msm_camera/control0"
 #define JPEG_EVENT_DONE 0 /* guess */
+#define JPEG_EVENT_ERROR 1 /* guess */
 
 #define CAM_CTRL_SUCCESS 1
 
@@ -50,6 +53,15 @@ extern "C" {
 
 #define AF_MODE_AUTO 2
 
+/* sendCommand() commands and the zoom progress message.  These match the
+   values later framework headers use for smooth zoom. */
+#define QCAMERA_CMD_START_SMOOTH_ZOOM 1
+#define QCAMERA_CMD_STOP_SMOOTH_ZOOM 2
+#define QCAMERA_MSG_ZOOM 0x200
+
+/* Continuous focus, named as later framework headers name it. */
+#define QCAMERA_FOCUS_MODE_CONTINUOUS "continuous-picture"
+
 typedef enum
 {
     CAMERA_WB_MIN_MINUS_1,
@@ -178,7 +190,7 @@ public:
     static sp<QualcommCameraHardware> getInstance();
 
     void receivePreviewFrame(struct msm_frame *frame);
-    void receiveJpegPicture(void);
+    void receiveJpegPicture(jpeg_event_t status);
     void jpeg_set_location();
     void receiveJpegPictureFragment(uint8_t *buf, uint32_t size);
     void notifyShutter(common_crop_t *crop);
@@ -189,8 +201,14 @@ private:
     status_t startPreviewInternal();
     void stopPreviewInternal();
     friend void *auto_focus_thread(void *user);
-    void runAutoFocus();
+    bool startAutoFocusWorker();
+    void stopAutoFocusWorker();
+    void runAutoFocusWorker(void *libhandle);
+    bool runAutoFocus(isp3a_af_mode_t mode);
     status_t cancelAutoFocusInternal();
+    void updateContinuousFocus();
+    void updateFocusScene(const uint8_t *luma);
+    void waitForContinuousFocus();
     bool native_set_dimension (int camfd);
     bool native_jpeg_encode (void);
     bool native_set_parm(cam_ctrl_type type, uint16_t length, void *value);
@@ -206,6 +224,17 @@ private:
     static const int kJpegBufferCount = 1;
 
     CameraParameters mParameters;
+
+    // getParameters() hands out this snapshot rather than mParameters,
+    // which setParameters() may be modifying at the same time.  It is
+    // republished only when a setParameters() call changed something, and
+    // shares its storage with mParameters until the next change, since
+    // KeyedVector is copy-on-write; a copy of it is a reference count bump.
+    CameraParameters mParametersSnapshot;
+    int mParametersVersion;
+    mutable Mutex mParametersSnapshotLock;
+    void publishParameters();
+
     unsigned int frame_size;
     bool mCameraRunning;
     bool mPreviewInitialized;
@@ -280,13 +309,150 @@ private:
     Mutex mShutterLock;
 
     bool mSnapshotThreadRunning;
+    bool mSnapshotThreadRestart;    // a capture was handed to the thread
     Mutex mSnapshotThreadWaitLock;
     Condition mSnapshotThreadWait;
     friend void *snapshot_thread(void *user);
     void runSnapshotThread(void *data);
 
+    // takePicture() only validates the request and hands it to the snapshot
+    // thread, which walks the capture through these states.  The JPEG
+    // encoder callback completes a capture that reaches CAPTURE_ENCODING.
+    // cancelPicture() may be called in any state; the capture is abandoned
+    // at the next state transition.  One further takePicture() may be
+    // queued while a capture is in flight.
+    //
+    // With the prepare-capture parameter set, autoFocus() also starts the
+    // snapshot thread on native_prepare_snapshot() and initRaw() while
+    // preview runs and the lens sweeps (CAPTURE_STAGING).  The capture then
+    // waits in CAPTURE_STAGED for takePicture(), which is left with
+    // stopping preview and the exposure.  Stopping preview, changing the
+    // picture size, cancelAutoFocus() and cancelPicture() drop a staged
+    // capture.
+    enum CaptureState {
+        CAPTURE_IDLE,
+        CAPTURE_QUEUED,     // accepted, snapshot thread starting
+        CAPTURE_PREPARING,  // native_prepare_snapshot()
+        CAPTURE_ALLOCATING, // stopping preview, initRaw()
+        CAPTURE_EXPOSING,   // native_start_snapshot(), native_get_picture()
+        CAPTURE_ENCODING,   // raw picture delivered, waiting for the JPEG
+        CAPTURE_STAGING,    // preparing ahead of takePicture()
+        CAPTURE_STAGED      // prepared, waiting for takePicture()
+    };
+
+    CaptureState mCaptureState;
+    bool mCaptureCancelled;
+    bool mCaptureQueued;
+    Mutex mCaptureLock;
+
+    bool mPrepareCaptureMode;   // prepare-capture parameter; under mLock
+    bool mCaptureStaged;        // the next capture was staged
+    bool mStagedJpegHeap;       // initRaw() was asked for the JPEG heap
+    nsecs_t mStageStart;
+    nsecs_t mStageEnd;
+    nsecs_t mStageRequested;    // when takePicture() came in while staging
+    nsecs_t mStageSaved;        // duration of staging before takePicture()
+
+    struct PrepareStats {
+        int staged;
+        int used;
+        int discarded;
+        nsecs_t saved;
+    };
+    PrepareStats mPrepareStats;
+
+    bool startCaptureWorkerLocked();
+    void stageCaptureLocked();
+    bool runStaging();
+    void unstageCapture();
+    bool advanceCapture(CaptureState next);
+    bool captureCancelled();
+    bool finishCapture(bool startQueued);
+    bool runCapture();
+    void stopPreviewForCapture();
+    void notifyCaptureError();
+    void notifyCaptureErrorLocked();
+
     void initDefaultParameters();
 
+    // Warm standby.  With persist.camera.standby.ms set, release() stops
+    // all activity but parks the instance with its driver session, config
+    // thread and liboemcamera still up.  createInstance() resumes a parked
+    // instance; standby_thread shuts it down for real once the standby
+    // time runs out or memory runs low.
+    bool mParked;
+    friend void *standby_thread(void *user);
+    void park(int standbyMs);
+    void resume();
+    void shutdown();
+
+    // release() only detaches the client; release_thread stops everything
+    // and ends the driver session (or parks).  createInstance() waits only
+    // for that, not for the last reference to go away.  Both under
+    // singleton_lock.
+    bool mReleasing;
+    nsecs_t mReleaseStart;
+    friend void *release_thread(void *user);
+    void runRelease();
+    void endRelease();
+
+    // Smooth zoom ramps the driver zoom value one step at a time (there are
+    // ZOOM_STEP driver values per zoom level) on a worker thread.  Each
+    // zoom level reached is reported with QCAMERA_MSG_ZOOM, and the last
+    // one also carries the stopped flag.  A stop request ends the ramp at
+    // the next whole zoom level.
+    bool mSmoothZoomRunning;
+    bool mSmoothZoomStopping;
+    int mSmoothZoomTarget;      // zoom level
+    Mutex mSmoothZoomLock;
+    Condition mSmoothZoomWait;
+    friend void *smooth_zoom_thread(void *user);
+    void runSmoothZoom();
+    bool applySmoothZoomStep(int value);
+    void notifySmoothZoom(int level, bool stopped);
+    status_t startSmoothZoom(int level);
+    void stopSmoothZoom(bool wait);
+
+    // Shot-to-shot latency profile.  Every capture records a monotonic
+    // timestamp as it leaves each stage of the snapshot pipeline, and the
+    // last kProfiledShots captures are kept so that dump() can break the
+    // shot-to-shot time down per stage.  A stage that does not run for a
+    // given capture (e.g. crop when not zoomed) keeps a zero timestamp.
+    enum SnapshotStage {
+        STAGE_TAKE_PICTURE,     // takePicture() called
+        STAGE_PREPARE_SNAPSHOT, // native_prepare_snapshot() returned
+        STAGE_STOP_PREVIEW,     // stopPreviewInternal() returned
+        STAGE_INIT_RAW,         // initRaw() returned
+        STAGE_START_SNAPSHOT,   // native_start_snapshot() returned
+        STAGE_SHUTTER,          // shutter callback delivered
+        STAGE_GET_PICTURE,      // native_get_picture() returned
+        STAGE_CROP,             // crop_yuv420() of a zoomed picture done
+        STAGE_RAW_CALLBACK,     // raw picture delivered
+        STAGE_JPEG_START,       // native_jpeg_encode() returned
+        STAGE_JPEG_DONE,        // encoder reported completion
+        STAGE_JPEG_CALLBACK,    // receiveJpegPicture() delivered the JPEG
+        STAGE_COUNT
+    };
+
+    static const int kProfiledShots = 16;
+
+    struct ShotProfile {
+        nsecs_t stamp[STAGE_COUNT];
+        nsecs_t fragmentCopyTime;   // memcpy()s in receiveJpegPictureFragment
+        int fragments;
+        bool complete;
+    };
+
+    ShotProfile mShotProfiles[kProfiledShots];
+    int mShotCount;                 // captures started since open
+    mutable Mutex mProfileLock;
+
+    void profileBegin();
+    void profileStage(SnapshotStage stage);
+    void profileFragment(nsecs_t copyTime);
+    void profileEnd();
+    void dumpProfile(String8& result) const;
+
     status_t setPreviewSize(const CameraParameters& params);
     status_t setPictureSize(const CameraParameters& params);
     status_t setJpegQuality(const CameraParameters& params);
@@ -299,11 +465,56 @@ private:
     status_t setZoom(const CameraParameters& params);
     status_t setFocusMode(const CameraParameters& params);
     status_t setOrientation(const CameraParameters& params);
+    status_t setPrepareCapture(const CameraParameters& params);
+
+    // setParameters() only runs the setters whose keys differ from
+    // mParameters (all of them after open and after preview restarts, in
+    // case the driver reset its state).  Driver parameter commands issued
+    // by the setters are queued and handed to mControlQueue together by
+    // flushParmCommands(); a command carrying the value the driver was last
+    // sent is dropped, and one that failed is sent again by the next call.
+    // They share the queue's lane with preview and snapshot sequencing, so
+    // they reach the driver in submission order.  setParameters() waits
+    // for them to report driver errors; smooth zoom steps do not wait.
+    struct ParameterSetter {
+        status_t (QualcommCameraHardware::*set)(const CameraParameters&);
+        bool sendsCommand;
+        const char *keys[4];
+    };
+    static const ParameterSetter kParameterSetters[];
+
+    struct ParmCommand {
+        cam_ctrl_type type;
+        int32_t value;
+        sp<CameraControlQueue::Command> result;   // sent commands only
+    };
+    static const int kMaxParmCommands = 8;
+
+    ParmCommand mPendingParms[kMaxParmCommands];
+    int mPendingParmCount;
+    ParmCommand mSentParms[kMaxParmCommands];
+    int mSentParmCount;
+    bool mParmsForceApply;
+
+    struct ParameterStats {
+        int calls;
+        int settersRun;
+        int settersSkipped;
+        int commandsSent;
+        int commandsUnchanged;
+        int commandsCoalesced;
+        int commandsSkipped;    // not queued because the setter was skipped
+    };
+    ParameterStats mParameterStats;
+
+    void queueParm(cam_ctrl_type type, int32_t value);
+    status_t flushParmCommands(bool wait);
+    void invalidateSentParms();
 
     Mutex mLock;
     bool mReleasedRecordingFrame;
 
-    void receiveRawPicture(void);
+    bool receiveRawPicture(void);
 
     Mutex mCallbackLock;
 	Mutex mRecordLock;
@@ -325,14 +536,65 @@ private:
 #endif
 
     int mCameraControlFd;
+    CameraControlQueue mControlQueue;
     struct msm_camsensor_info mSensorInfo;
     cam_ctrl_dimension_t mDimension;
+    // The snapshot thread's copy of mDimension, taken under mLock when a
+    // capture allocates its heaps and filled in by the driver, so that
+    // setParameters() cannot change it under the capture or the encoder.
+    cam_ctrl_dimension_t mCaptureDimension;
+
+    // The autofocus worker runs from the first autoFocus() or continuous
+    // focus until release(), with a control fd of its own, since an AF
+    // sweep blocks in the driver until the lens settles, and its own
+    // reference to liboemcamera.  autoFocus() posts a request, which the
+    // worker runs and reports through CAMERA_MSG_FOCUS; a request made while
+    // one is pending or running is folded into it.  cancelAutoFocus() drops
+    // a pending request and stops a running sweep.
+    //
+    // In continuous focus mode the worker also sweeps on its own while
+    // preview runs: once when preview starts, and again whenever the
+    // preview frames show that the scene changed, at most once every
+    // CAF_MIN_INTERVAL_MS.  autoFocus() then reports a converged focus
+    // straight away, and takePicture() only waits for a sweep that is
+    // already running.
     bool mAutoFocusThreadRunning;
+    bool mAutoFocusExiting;
+    bool mAutoFocusPending;
+    bool mAutoFocusActive;
+    bool mAutoFocusNotify;      // report the running sweep
+    int mAutoFocusMode;         // isp3a_af_mode_t, or -1 to report focused
     Mutex mAutoFocusThreadLock;
+    Condition mAutoFocusWait;
     int mAutoFocusFd;
 
+    bool mContinuousFocusMode;  // focus mode parameter; under mLock
+    bool mContinuousFocus;      // ... and preview running
+    bool mFocusConverged;
+    nsecs_t mLastFocusSweep;
+
+    // Scene change detection for continuous focus.  The frame thread
+    // compares the mean luma of a grid of zones against the zones seen
+    // when focus converged.
+    static const int kFocusZones = 16;
+    uint8_t mFocusZones[kFocusZones];
+    bool mFocusZonesValid;
+    int mSceneChangeFrames;
+    int mFocusFrameCount;
+
+    struct FocusStats {
+        int sweeps;             // continuous sweeps run
+        int converged;          // ... that converged
+        int sceneChanges;
+        int requestsSkipped;    // autoFocus() answered without a sweep
+        int capturesSkipped;    // takePicture() found focus converged
+        int capturesWaited;     // ... or waited for a running sweep
+    };
+    FocusStats mFocusStats;
+
     pthread_t mFrameThread;
     pthread_t mSnapshotThread;
+    pthread_t mAutoFocusThread;
 
     common_crop_t mCrop;
 
@@ -0,0 +1,104 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SoftJpegAdapter"
+#include <utils/Log.h>
+
+#include "SoftJpegAdapter.h"
+
+namespace android {
+
+SoftJpegAdapter::SoftJpegAdapter(SoftJpegEncoder::fragment_callback fragment_cb,
+                                 SoftJpegEncoder::done_callback done_cb)
+{
+    mEncoder.setCallbacks(fragment_cb, done_cb, NULL);
+}
+
+bool SoftJpegAdapter::init(int threads)
+{
+    if (mEncoder.busy()) {
+        LOGE("init: previous encode not joined");
+        return false;
+    }
+    mEncoder.setThreadCount(threads);
+    mEncoder.setLocation(NULL);
+    return true;
+}
+
+void SoftJpegAdapter::join()
+{
+    mEncoder.join();
+}
+
+bool SoftJpegAdapter::encode(const cam_ctrl_dimension_t *dimen,
+                             const uint8_t *thumbnailbuf,
+                             const uint8_t *snapshotbuf,
+                             const common_crop_t *scaling_parms)
+{
+    SoftJpegEncoder::Image main, thumbnail;
+
+    main.width = dimen->picture_width;
+    main.height = dimen->picture_height;
+    thumbnail.width = dimen->ui_thumbnail_width;
+    thumbnail.height = dimen->ui_thumbnail_height;
+    if (scaling_parms && scaling_parms->in2_w && scaling_parms->in2_h) {
+        main.width = scaling_parms->in2_w;
+        main.height = scaling_parms->in2_h;
+        thumbnail.width = scaling_parms->in1_w;
+        thumbnail.height = scaling_parms->in1_h;
+    }
+
+    main.y = snapshotbuf;
+    main.cbcr = snapshotbuf + main.width * main.height;
+    main.stride = main.width;
+    main.crcb = true;
+
+    thumbnail.y = thumbnailbuf;
+    thumbnail.cbcr = thumbnailbuf + thumbnail.width * thumbnail.height;
+    thumbnail.stride = thumbnail.width;
+    thumbnail.crcb = true;
+
+    return mEncoder.encode(main, thumbnailbuf ? &thumbnail : NULL);
+}
+
+int8_t SoftJpegAdapter::setMainImageQuality(uint32_t quality)
+{
+    return mEncoder.setMainImageQuality(quality);
+}
+
+int8_t SoftJpegAdapter::setThumbnailQuality(uint32_t quality)
+{
+    return mEncoder.setThumbnailQuality(quality);
+}
+
+int8_t SoftJpegAdapter::setRotation(uint32_t rotation)
+{
+    return mEncoder.setRotation(rotation);
+}
+
+int8_t SoftJpegAdapter::setLocation(const camera_position_type *pt)
+{
+    SoftJpegEncoder::Location location;
+    location.timestamp = pt->timestamp;
+    location.latitude = pt->latitude;
+    location.longitude = pt->longitude;
+    location.altitude = pt->altitude;
+    mEncoder.setLocation(&location);
+    return true;
+}
+
+}; // namespace android
@@ -0,0 +1,56 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_SOFT_JPEG_ADAPTER_H
+#define ANDROID_HARDWARE_SOFT_JPEG_ADAPTER_H
+
+#include "QualcommCameraHardware.h"
+#include "SoftJpegEncoder.h"
+
+namespace android {
+
+// The jpeg_encoder_* entry points of liboemcamera on top of SoftJpegEncoder.
+// The HAL's software fallback and the fake liboemcamera each own one and
+// forward the entry points to it.
+class SoftJpegAdapter {
+public:
+    SoftJpegAdapter(SoftJpegEncoder::fragment_callback fragment_cb,
+                    SoftJpegEncoder::done_callback done_cb);
+
+    // Readies the encoder for the next picture, spread over threads cores.
+    // Fails while the previous encode has not been joined.
+    bool init(int threads);
+    void join();
+    // A non-zero crop means the buffers were already cropped in place.
+    bool encode(const cam_ctrl_dimension_t *dimen,
+                const uint8_t *thumbnailbuf,
+                const uint8_t *snapshotbuf,
+                const common_crop_t *scaling_parms);
+    int8_t setMainImageQuality(uint32_t quality);
+    int8_t setThumbnailQuality(uint32_t quality);
+    int8_t setRotation(uint32_t rotation);
+    int8_t setLocation(const camera_position_type *pt);
+
+private:
+    SoftJpegEncoder mEncoder;
+
+    SoftJpegAdapter(const SoftJpegAdapter &);
+    SoftJpegAdapter &operator=(const SoftJpegAdapter &);
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,1145 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SoftJpegEncoder"
+#include <utils/Log.h>
+
+#include "SoftJpegEncoder.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MAX_ENCODER_THREADS 8
+// Worst case for one 8x8 block: 64 codes of 16 + 11 bits, all byte-stuffed.
+#define MAX_BLOCK_BYTES 512
+
+namespace android {
+
+// ITU-T T.81 Annex K tables.
+static const uint8_t std_luma_quant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const uint8_t std_chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Natural-order index of the k-th coefficient in zigzag order.
+static const uint8_t zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static const uint8_t dc_luma_bits[16] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+};
+static const uint8_t dc_chroma_bits[16] = {
+    0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0
+};
+static const uint8_t dc_vals[12] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const uint8_t ac_luma_bits[16] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d
+};
+static const uint8_t ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const uint8_t ac_chroma_bits[16] = {
+    0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77
+};
+static const uint8_t ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+struct huff_table {
+    uint16_t code[256];
+    uint8_t size[256];
+};
+
+// Quantization by multiplication: q = ((|x| + bias) * recip) >> 16.  The
+// same arithmetic is used by the scalar and the SIMD paths, so the output is
+// bit-exact whichever one is compiled in.
+struct quant_table {
+    uint8_t q[64];          // natural order, as written to DQT
+    uint16_t recip[64];
+    uint16_t bias[64];
+};
+
+// DCT basis scaled by 2^13: 0.5 * c(k) * cos((2n + 1) * k * pi / 16).
+static int16_t dct_matrix[8][8];
+static huff_table dc_luma_huff, ac_luma_huff, dc_chroma_huff, ac_chroma_huff;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void build_huff_table(const uint8_t *bits, const uint8_t *vals,
+                             huff_table *table)
+{
+    memset(table, 0, sizeof(*table));
+    uint16_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++, k++) {
+            table->code[vals[k]] = code++;
+            table->size[vals[k]] = len;
+        }
+        code <<= 1;
+    }
+}
+
+static void init_tables(void)
+{
+    for (int k = 0; k < 8; k++) {
+        double ck = k ? 1.0 : M_SQRT1_2;
+        for (int n = 0; n < 8; n++) {
+            double v = 0.5 * ck * cos((2 * n + 1) * k * M_PI / 16);
+            dct_matrix[k][n] = (int16_t)floor(v * 8192 + 0.5);
+        }
+    }
+    build_huff_table(dc_luma_bits, dc_vals, &dc_luma_huff);
+    build_huff_table(ac_luma_bits, ac_luma_vals, &ac_luma_huff);
+    build_huff_table(dc_chroma_bits, dc_vals, &dc_chroma_huff);
+    build_huff_table(ac_chroma_bits, ac_chroma_vals, &ac_chroma_huff);
+}
+
+static void build_quant_table(const uint8_t *base, uint32_t quality,
+                              quant_table *table)
+{
+    // Same scaling as the IJG reference encoder.
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    for (int i = 0; i < 64; i++) {
+        int q = (base[i] * scale + 50) / 100;
+        if (q < 1) q = 1;
+        if (q > 255) q = 255;
+        table->q[i] = q;
+        if (q == 1) {
+            // 65536 does not fit; (x + 1) * 0xffff >> 16 == x instead.
+            table->recip[i] = 0xffff;
+            table->bias[i] = 1;
+        } else {
+            table->recip[i] = (65536 + q - 1) / q;
+            table->bias[i] = q / 2;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Forward DCT and quantization.  Both passes are a multiply by dct_matrix; the
+// first keeps two extra fractional bits.  Input is level-shifted samples,
+// output is quantized coefficients in natural order.
+
+#if defined(__ARM_NEON__)
+
+static inline void transpose_8x8(int16x8_t r[8])
+{
+    int16x8x2_t t01 = vtrnq_s16(r[0], r[1]);
+    int16x8x2_t t23 = vtrnq_s16(r[2], r[3]);
+    int16x8x2_t t45 = vtrnq_s16(r[4], r[5]);
+    int16x8x2_t t67 = vtrnq_s16(r[6], r[7]);
+
+    int32x4x2_t u02 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]),
+                                vreinterpretq_s32_s16(t23.val[0]));
+    int32x4x2_t u13 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]),
+                                vreinterpretq_s32_s16(t23.val[1]));
+    int32x4x2_t u46 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]),
+                                vreinterpretq_s32_s16(t67.val[0]));
+    int32x4x2_t u57 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]),
+                                vreinterpretq_s32_s16(t67.val[1]));
+
+#define LO(x) vget_low_s16(vreinterpretq_s16_s32(x))
+#define HI(x) vget_high_s16(vreinterpretq_s16_s32(x))
+    r[0] = vcombine_s16(LO(u02.val[0]), LO(u46.val[0]));
+    r[1] = vcombine_s16(LO(u13.val[0]), LO(u57.val[0]));
+    r[2] = vcombine_s16(LO(u02.val[1]), LO(u46.val[1]));
+    r[3] = vcombine_s16(LO(u13.val[1]), LO(u57.val[1]));
+    r[4] = vcombine_s16(HI(u02.val[0]), HI(u46.val[0]));
+    r[5] = vcombine_s16(HI(u13.val[0]), HI(u57.val[0]));
+    r[6] = vcombine_s16(HI(u02.val[1]), HI(u46.val[1]));
+    r[7] = vcombine_s16(HI(u13.val[1]), HI(u57.val[1]));
+#undef LO
+#undef HI
+}
+
+// out[k] = sum_n dct_matrix[k][n] * in[n], eight lanes at a time.
+template <int SHIFT>
+static inline void dct_pass(const int16x8_t in[8], int16x8_t out[8])
+{
+    for (int k = 0; k < 8; k++) {
+        int32x4_t lo = vmull_n_s16(vget_low_s16(in[0]), dct_matrix[k][0]);
+        int32x4_t hi = vmull_n_s16(vget_high_s16(in[0]), dct_matrix[k][0]);
+        for (int n = 1; n < 8; n++) {
+            lo = vmlal_n_s16(lo, vget_low_s16(in[n]), dct_matrix[k][n]);
+            hi = vmlal_n_s16(hi, vget_high_s16(in[n]), dct_matrix[k][n]);
+        }
+        out[k] = vcombine_s16(vrshrn_n_s32(lo, SHIFT), vrshrn_n_s32(hi, SHIFT));
+    }
+}
+
+static void fdct_quantize(const int16_t *in, int16_t *out,
+                          const quant_table *qt)
+{
+    int16x8_t rows[8], tmp[8];
+    for (int i = 0; i < 8; i++)
+        rows[i] = vld1q_s16(in + i * 8);
+
+    dct_pass<11>(rows, tmp);        // vertical
+    transpose_8x8(tmp);
+    dct_pass<15>(tmp, rows);        // horizontal
+    transpose_8x8(rows);
+
+    for (int i = 0; i < 8; i++) {
+        int16x8_t x = rows[i];
+        int16x8_t sign = vshrq_n_s16(x, 15);
+        uint16x8_t a = vaddq_u16(vreinterpretq_u16_s16(vabsq_s16(x)),
+                                 vld1q_u16(qt->bias + i * 8));
+        uint16x8_t r = vld1q_u16(qt->recip + i * 8);
+        uint16x8_t q = vcombine_u16(
+            vshrn_n_u32(vmull_u16(vget_low_u16(a), vget_low_u16(r)), 16),
+            vshrn_n_u32(vmull_u16(vget_high_u16(a), vget_high_u16(r)), 16));
+        int16x8_t v = vreinterpretq_s16_u16(q);
+        vst1q_s16(out + i * 8, vsubq_s16(veorq_s16(v, sign), sign));
+    }
+}
+
+#elif defined(__SSE2__)
+
+static inline void transpose_8x8(__m128i r[8])
+{
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// out[k] = sum_n dct_matrix[k][n] * in[n], using pmaddwd on interleaved
+// pairs of input rows.
+template <int SHIFT>
+static inline void dct_pass(const __m128i in[8], __m128i out[8])
+{
+    __m128i lo[4], hi[4];
+    for (int j = 0; j < 4; j++) {
+        lo[j] = _mm_unpacklo_epi16(in[2 * j], in[2 * j + 1]);
+        hi[j] = _mm_unpackhi_epi16(in[2 * j], in[2 * j + 1]);
+    }
+    const __m128i round = _mm_set1_epi32(1 << (SHIFT - 1));
+    for (int k = 0; k < 8; k++) {
+        __m128i sl = round, sh = round;
+        for (int j = 0; j < 4; j++) {
+            __m128i c = _mm_set1_epi32(
+                (uint16_t)dct_matrix[k][2 * j] |
+                ((uint32_t)(uint16_t)dct_matrix[k][2 * j + 1] << 16));
+            sl = _mm_add_epi32(sl, _mm_madd_epi16(lo[j], c));
+            sh = _mm_add_epi32(sh, _mm_madd_epi16(hi[j], c));
+        }
+        out[k] = _mm_packs_epi32(_mm_srai_epi32(sl, SHIFT),
+                                 _mm_srai_epi32(sh, SHIFT));
+    }
+}
+
+static void fdct_quantize(const int16_t *in, int16_t *out,
+                          const quant_table *qt)
+{
+    __m128i rows[8], tmp[8];
+    for (int i = 0; i < 8; i++)
+        rows[i] = _mm_loadu_si128((const __m128i *)(in + i * 8));
+
+    dct_pass<11>(rows, tmp);        // vertical
+    transpose_8x8(tmp);
+    dct_pass<15>(tmp, rows);        // horizontal
+    transpose_8x8(rows);
+
+    for (int i = 0; i < 8; i++) {
+        __m128i x = rows[i];
+        __m128i sign = _mm_srai_epi16(x, 15);
+        __m128i a = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+        a = _mm_add_epi16(a,
+            _mm_loadu_si128((const __m128i *)(qt->bias + i * 8)));
+        __m128i q = _mm_mulhi_epu16(a,
+            _mm_loadu_si128((const __m128i *)(qt->recip + i * 8)));
+        _mm_storeu_si128((__m128i *)(out + i * 8),
+                         _mm_sub_epi16(_mm_xor_si128(q, sign), sign));
+    }
+}
+
+#else
+
+static void fdct_quantize(const int16_t *in, int16_t *out,
+                          const quant_table *qt)
+{
+    int16_t tmp[64];
+
+    // Vertical pass.
+    for (int k = 0; k < 8; k++) {
+        for (int c = 0; c < 8; c++) {
+            int32_t sum = 0;
+            for (int n = 0; n < 8; n++)
+                sum += dct_matrix[k][n] * in[n * 8 + c];
+            tmp[k * 8 + c] = (int16_t)((sum + (1 << 10)) >> 11);
+        }
+    }
+
+    // Horizontal pass and quantization.
+    for (int r = 0; r < 8; r++) {
+        for (int k = 0; k < 8; k++) {
+            int32_t sum = 0;
+            for (int n = 0; n < 8; n++)
+                sum += dct_matrix[k][n] * tmp[r * 8 + n];
+            int v = (sum + (1 << 14)) >> 15;
+            int i = r * 8 + k;
+            uint32_t a = (uint32_t)((v < 0 ? -v : v) + qt->bias[i]);
+            int q = (int)((a * qt->recip[i]) >> 16);
+            out[i] = (int16_t)(v < 0 ? -q : q);
+        }
+    }
+}
+
+#endif
+
+// ---------------------------------------------------------------------------
+// Output buffers and entropy coding.
+
+struct out_buffer {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+    bool failed;
+
+    out_buffer() : data(NULL), size(0), capacity(0), failed(false) {}
+    ~out_buffer() { free(data); }
+
+    bool reserve(uint32_t extra) {
+        if (size + extra <= capacity)
+            return true;
+        uint32_t cap = capacity ? capacity : 4096;
+        while (cap < size + extra)
+            cap *= 2;
+        uint8_t *p = (uint8_t *)realloc(data, cap);
+        if (p == NULL) {
+            failed = true;
+            return false;
+        }
+        data = p;
+        capacity = cap;
+        return true;
+    }
+
+    void put8(uint8_t v) {
+        if (reserve(1))
+            data[size++] = v;
+    }
+
+    void put16(uint16_t v) {
+        put8(v >> 8);
+        put8(v & 0xff);
+    }
+
+    void put32(uint32_t v) {
+        put16(v >> 16);
+        put16(v & 0xffff);
+    }
+
+    void append(const void *p, uint32_t len) {
+        if (reserve(len)) {
+            memcpy(data + size, p, len);
+            size += len;
+        }
+    }
+};
+
+// Callers reserve MAX_BLOCK_BYTES before each block, so put() does not need
+// to check for room.
+struct bit_writer {
+    out_buffer *out;
+    uint32_t acc;
+    int bits;
+
+    bit_writer(out_buffer *o) : out(o), acc(0), bits(0) {}
+
+    inline void put(uint32_t code, int size) {
+        acc = (acc << size) | (code & ((1u << size) - 1));
+        bits += size;
+        while (bits >= 8) {
+            bits -= 8;
+            uint8_t c = (uint8_t)(acc >> bits);
+            out->data[out->size++] = c;
+            if (c == 0xff)
+                out->data[out->size++] = 0;
+        }
+    }
+
+    void flush() {
+        if (bits > 0)
+            put(0x7f, 8 - bits);    // pad with ones
+        acc = 0;
+        bits = 0;
+    }
+};
+
+static inline int bit_length(uint32_t v)
+{
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+static inline int ctz64(uint64_t v)
+{
+    uint32_t lo = (uint32_t)v;
+    return lo ? __builtin_ctz(lo) : 32 + __builtin_ctz((uint32_t)(v >> 32));
+}
+
+static void encode_block(bit_writer &bw, const int16_t *coef, int *last_dc,
+                         const huff_table *dc, const huff_table *ac)
+{
+    int16_t zz[64];
+    uint64_t nonzero = 0;
+
+    zz[0] = coef[0];
+    for (int k = 1; k < 64; k++) {
+        zz[k] = coef[zigzag[k]];
+        nonzero |= (uint64_t)(zz[k] != 0) << k;
+    }
+
+    int diff = zz[0] - *last_dc;
+    *last_dc = zz[0];
+    int mag = diff < 0 ? -diff : diff;
+    int nbits = bit_length(mag);
+    bw.put(dc->code[nbits], dc->size[nbits]);
+    if (nbits)
+        bw.put(diff < 0 ? diff - 1 : diff, nbits);
+
+    // Walk only the non-zero coefficients; runs of zeros fall out of the
+    // distance between set bits.
+    int prev = 0;
+    while (nonzero) {
+        int k = ctz64(nonzero);
+        nonzero &= nonzero - 1;
+        int run = k - prev - 1;
+        while (run > 15) {
+            bw.put(ac->code[0xf0], ac->size[0xf0]);
+            run -= 16;
+        }
+        int v = zz[k];
+        mag = v < 0 ? -v : v;
+        nbits = bit_length(mag);
+        int sym = (run << 4) | nbits;
+        bw.put(ac->code[sym], ac->size[sym]);
+        bw.put(v < 0 ? v - 1 : v, nbits);
+        prev = k;
+    }
+    if (prev != 63)
+        bw.put(ac->code[0x00], ac->size[0x00]);
+}
+
+// Loads an 8x8 block with level shift, replicating the right and bottom
+// edges when the block straddles them.  step is 2 for interleaved chroma.
+static void load_block(const uint8_t *plane, int stride, int step,
+                       int width, int height, int x0, int y0, int16_t *blk)
+{
+    for (int r = 0; r < 8; r++) {
+        int y = y0 + r < height ? y0 + r : height - 1;
+        const uint8_t *row = plane + y * stride;
+        if (x0 + 8 <= width) {
+            const uint8_t *p = row + x0 * step;
+            for (int c = 0; c < 8; c++)
+                blk[r * 8 + c] = (int16_t)p[c * step] - 128;
+        } else {
+            for (int c = 0; c < 8; c++) {
+                int x = x0 + c < width ? x0 + c : width - 1;
+                blk[r * 8 + c] = (int16_t)row[x * step] - 128;
+            }
+        }
+    }
+}
+
+struct encode_params {
+    const SoftJpegEncoder::Image *image;
+    const quant_table *luma_qt;
+    const quant_table *chroma_qt;
+    int mcu_cols;
+    int mcu_rows;
+    bool restart;           // RST after every MCU row
+};
+
+struct stripe_job {
+    const encode_params *params;
+    int first_row;
+    int last_row;           // exclusive
+    out_buffer out;
+    pthread_t thread;
+    bool started;
+};
+
+static bool encode_stripe(const encode_params *p, int first_row, int last_row,
+                          out_buffer *out)
+{
+    const SoftJpegEncoder::Image *img = p->image;
+    // YUV420SP carries floor(w/2) x floor(h/2) chroma samples.
+    int cw = img->width > 1 ? img->width / 2 : 1;
+    int ch = img->height > 1 ? img->height / 2 : 1;
+    const uint8_t *cb = img->cbcr + (img->crcb ? 1 : 0);
+    const uint8_t *cr = img->cbcr + (img->crcb ? 0 : 1);
+
+    int16_t blk[64], coef[64];
+    int dc_y = 0, dc_cb = 0, dc_cr = 0;
+    bit_writer bw(out);
+
+    for (int my = first_row; my < last_row; my++) {
+        for (int mx = 0; mx < p->mcu_cols; mx++) {
+            if (!out->reserve(6 * MAX_BLOCK_BYTES))
+                return false;
+            int x0 = mx * 16, y0 = my * 16;
+            for (int b = 0; b < 4; b++) {
+                load_block(img->y, img->stride, 1, img->width, img->height,
+                           x0 + (b & 1) * 8, y0 + (b >> 1) * 8, blk);
+                fdct_quantize(blk, coef, p->luma_qt);
+                encode_block(bw, coef, &dc_y, &dc_luma_huff, &ac_luma_huff);
+            }
+            load_block(cb, img->stride, 2, cw, ch, mx * 8, my * 8, blk);
+            fdct_quantize(blk, coef, p->chroma_qt);
+            encode_block(bw, coef, &dc_cb, &dc_chroma_huff, &ac_chroma_huff);
+            load_block(cr, img->stride, 2, cw, ch, mx * 8, my * 8, blk);
+            fdct_quantize(blk, coef, p->chroma_qt);
+            encode_block(bw, coef, &dc_cr, &dc_chroma_huff, &ac_chroma_huff);
+        }
+
+        if (p->restart && my != p->mcu_rows - 1) {
+            bw.flush();
+            out->put8(0xff);
+            out->put8(0xd0 + (my & 7));
+            dc_y = dc_cb = dc_cr = 0;
+        }
+    }
+    bw.flush();
+    return !out->failed;
+}
+
+static void *stripe_thread(void *user)
+{
+    stripe_job *job = (stripe_job *)user;
+    encode_stripe(job->params, job->first_row, job->last_row, &job->out);
+    return NULL;
+}
+
+static void write_tables(out_buffer *out, const quant_table *luma_qt,
+                         const quant_table *chroma_qt,
+                         int width, int height, int restart_interval)
+{
+    // DQT
+    out->put16(0xffdb);
+    out->put16(2 + 2 * 65);
+    out->put8(0x00);
+    for (int k = 0; k < 64; k++)
+        out->put8(luma_qt->q[zigzag[k]]);
+    out->put8(0x01);
+    for (int k = 0; k < 64; k++)
+        out->put8(chroma_qt->q[zigzag[k]]);
+
+    // SOF0: 8-bit, 3 components, 4:2:0
+    out->put16(0xffc0);
+    out->put16(17);
+    out->put8(8);
+    out->put16(height);
+    out->put16(width);
+    out->put8(3);
+    out->put8(1); out->put8(0x22); out->put8(0);
+    out->put8(2); out->put8(0x11); out->put8(1);
+    out->put8(3); out->put8(0x11); out->put8(1);
+
+    // DHT
+    static const struct {
+        uint8_t id;
+        const uint8_t *bits;
+        const uint8_t *vals;
+    } tables[] = {
+        { 0x00, dc_luma_bits,   dc_vals },
+        { 0x10, ac_luma_bits,   ac_luma_vals },
+        { 0x01, dc_chroma_bits, dc_vals },
+        { 0x11, ac_chroma_bits, ac_chroma_vals },
+    };
+    int len = 2;
+    for (int t = 0; t < 4; t++) {
+        len += 17;
+        for (int i = 0; i < 16; i++)
+            len += tables[t].bits[i];
+    }
+    out->put16(0xffc4);
+    out->put16(len);
+    for (int t = 0; t < 4; t++) {
+        int count = 0;
+        out->put8(tables[t].id);
+        for (int i = 0; i < 16; i++) {
+            out->put8(tables[t].bits[i]);
+            count += tables[t].bits[i];
+        }
+        out->append(tables[t].vals, count);
+    }
+
+    if (restart_interval) {
+        out->put16(0xffdd);
+        out->put16(4);
+        out->put16(restart_interval);
+    }
+
+    // SOS
+    out->put16(0xffda);
+    out->put16(12);
+    out->put8(3);
+    out->put8(1); out->put8(0x00);
+    out->put8(2); out->put8(0x11);
+    out->put8(3); out->put8(0x11);
+    out->put8(0);
+    out->put8(63);
+    out->put8(0);
+}
+
+// Encodes the scan of an image whose header (up to and including SOS) has
+// already been written to out.  With a single thread the scan and EOI are
+// appended to out.  Otherwise stripe 0 is appended to out and the remaining
+// *njobs - 1 stripes are left in jobs[1..]; the caller emits them and EOI.
+static bool encode_scan(const encode_params &params, int nthreads,
+                        out_buffer *out, stripe_job *jobs, int *njobs_out)
+{
+    *njobs_out = 1;
+    if (nthreads <= 1) {
+        if (!encode_stripe(&params, 0, params.mcu_rows, out))
+            return false;
+        out->put16(0xffd9);
+        return !out->failed;
+    }
+
+    int rows_per_stripe = (params.mcu_rows + nthreads - 1) / nthreads;
+    int njobs = 0;
+    for (int row = 0; row < params.mcu_rows; row += rows_per_stripe) {
+        stripe_job *job = &jobs[njobs++];
+        job->params = &params;
+        job->first_row = row;
+        job->last_row = row + rows_per_stripe < params.mcu_rows ?
+            row + rows_per_stripe : params.mcu_rows;
+        job->started = false;
+    }
+
+    // Stripe 0 runs on the calling thread.
+    for (int i = 1; i < njobs; i++)
+        jobs[i].started =
+            !pthread_create(&jobs[i].thread, NULL, stripe_thread, &jobs[i]);
+    bool ok = encode_stripe(&params, jobs[0].first_row, jobs[0].last_row, out);
+    for (int i = 1; i < njobs; i++) {
+        if (jobs[i].started)
+            pthread_join(jobs[i].thread, NULL);
+        else
+            encode_stripe(&params, jobs[i].first_row, jobs[i].last_row,
+                          &jobs[i].out);
+        ok = ok && !jobs[i].out.failed;
+    }
+    *njobs_out = njobs;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// EXIF (APP1) with orientation, GPS and the thumbnail.
+
+struct exif_entry {
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    uint32_t size;
+    uint8_t data[24];
+};
+
+enum {
+    EXIF_BYTE = 1,
+    EXIF_ASCII = 2,
+    EXIF_SHORT = 3,
+    EXIF_LONG = 4,
+    EXIF_RATIONAL = 5,
+};
+
+static void exif_set(exif_entry *e, uint16_t tag, uint16_t type,
+                     uint32_t count, const void *data, uint32_t size)
+{
+    e->tag = tag;
+    e->type = type;
+    e->count = count;
+    e->size = size;
+    memset(e->data, 0, sizeof(e->data));
+    memcpy(e->data, data, size);
+}
+
+static void exif_short(exif_entry *e, uint16_t tag, uint16_t v)
+{
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    exif_set(e, tag, EXIF_SHORT, 1, b, 2);
+}
+
+static void exif_long(exif_entry *e, uint16_t tag, uint32_t v)
+{
+    uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16),
+                     (uint8_t)(v >> 8), (uint8_t)v };
+    exif_set(e, tag, EXIF_LONG, 1, b, 4);
+}
+
+static void exif_rationals(exif_entry *e, uint16_t tag,
+                           const uint32_t *v, int count)
+{
+    uint8_t b[24];
+    for (int i = 0; i < count * 2; i++) {
+        b[i * 4] = v[i] >> 24;
+        b[i * 4 + 1] = v[i] >> 16;
+        b[i * 4 + 2] = v[i] >> 8;
+        b[i * 4 + 3] = v[i];
+    }
+    exif_set(e, tag, EXIF_RATIONAL, count, b, count * 8);
+}
+
+static uint32_t exif_ifd_size(const exif_entry *entries, int count)
+{
+    uint32_t size = 2 + 12 * count + 4;
+    for (int i = 0; i < count; i++)
+        if (entries[i].size > 4)
+            size += (entries[i].size + 1) & ~1;
+    return size;
+}
+
+// Writes an IFD at the current end of out; offsets are relative to tiff_base.
+static void exif_write_ifd(out_buffer *out, uint32_t tiff_base,
+                           const exif_entry *entries, int count,
+                           uint32_t next_ifd)
+{
+    uint32_t data_offset = out->size - tiff_base + 2 + 12 * count + 4;
+    out->put16(count);
+    for (int i = 0; i < count; i++) {
+        out->put16(entries[i].tag);
+        out->put16(entries[i].type);
+        out->put32(entries[i].count);
+        if (entries[i].size <= 4) {
+            out->append(entries[i].data, 4);
+        } else {
+            out->put32(data_offset);
+            data_offset += (entries[i].size + 1) & ~1;
+        }
+    }
+    out->put32(next_ifd);
+    for (int i = 0; i < count; i++) {
+        if (entries[i].size > 4) {
+            out->append(entries[i].data, entries[i].size);
+            if (entries[i].size & 1)
+                out->put8(0);
+        }
+    }
+}
+
+static void degrees_to_rationals(double deg, uint32_t *v)
+{
+    if (deg < 0) deg = -deg;
+    uint32_t d = (uint32_t)deg;
+    double m = (deg - d) * 60;
+    uint32_t mi = (uint32_t)m;
+    uint32_t s = (uint32_t)((m - mi) * 60 * 1000 + 0.5);
+    v[0] = d;  v[1] = 1;
+    v[2] = mi; v[3] = 1;
+    v[4] = s;  v[5] = 1000;
+}
+
+static bool write_exif(out_buffer *out, uint32_t rotation,
+                       const SoftJpegEncoder::Location *location,
+                       const out_buffer *thumbnail)
+{
+    exif_entry ifd0[2], gps[9], ifd1[3];
+    int n0 = 0, ngps = 0, n1 = 0;
+
+    uint16_t orientation = 1;
+    switch (rotation) {
+    case 90:  orientation = 6; break;
+    case 180: orientation = 3; break;
+    case 270: orientation = 8; break;
+    }
+    exif_short(&ifd0[n0++], 0x0112, orientation);
+
+    if (location) {
+        static const uint8_t version[4] = { 2, 2, 0, 0 };
+        uint32_t r[6];
+        exif_set(&gps[ngps++], 0x0000, EXIF_BYTE, 4, version, 4);
+        exif_set(&gps[ngps++], 0x0001, EXIF_ASCII, 2,
+                 location->latitude < 0 ? "S" : "N", 2);
+        degrees_to_rationals(location->latitude, r);
+        exif_rationals(&gps[ngps++], 0x0002, r, 3);
+        exif_set(&gps[ngps++], 0x0003, EXIF_ASCII, 2,
+                 location->longitude < 0 ? "W" : "E", 2);
+        degrees_to_rationals(location->longitude, r);
+        exif_rationals(&gps[ngps++], 0x0004, r, 3);
+        uint8_t below = location->altitude < 0;
+        exif_set(&gps[ngps++], 0x0005, EXIF_BYTE, 1, &below, 1);
+        r[0] = below ? -location->altitude : location->altitude;
+        r[1] = 1;
+        exif_rationals(&gps[ngps++], 0x0006, r, 1);
+
+        time_t t = location->timestamp;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        r[0] = tm.tm_hour; r[1] = 1;
+        r[2] = tm.tm_min;  r[3] = 1;
+        r[4] = tm.tm_sec;  r[5] = 1;
+        exif_rationals(&gps[ngps++], 0x0007, r, 3);
+        char date[11];
+        strftime(date, sizeof(date), "%Y:%m:%d", &tm);
+        exif_set(&gps[ngps++], 0x001d, EXIF_ASCII, 11, date, 11);
+    }
+
+    uint32_t ifd0_size = exif_ifd_size(ifd0, n0) + (ngps ? 12 : 0);
+    uint32_t gps_offset = 8 + ifd0_size;
+    uint32_t gps_size = ngps ? exif_ifd_size(gps, ngps) : 0;
+    uint32_t ifd1_offset = gps_offset + gps_size;
+
+    if (thumbnail) {
+        exif_short(&ifd1[n1++], 0x0103, 6);     // JPEG compression
+        exif_long(&ifd1[n1++], 0x0201, 0);      // fixed up below
+        exif_long(&ifd1[n1++], 0x0202, thumbnail->size);
+        uint32_t thumb_offset = ifd1_offset + exif_ifd_size(ifd1, n1);
+        exif_long(&ifd1[1], 0x0201, thumb_offset);
+        if (thumb_offset + thumbnail->size + 8 > 0xffff) {
+            LOGW("thumbnail (%d bytes) does not fit in APP1, dropping it",
+                 thumbnail->size);
+            thumbnail = NULL;
+            n1 = 0;
+        }
+    }
+    if (ngps)
+        exif_long(&ifd0[n0++], 0x8825, gps_offset);
+
+    uint32_t app1_start = out->size;
+    out->put16(0xffe1);
+    out->put16(0);                  // length, fixed up below
+    out->append("Exif\0\0", 6);
+    uint32_t tiff_base = out->size;
+    out->append("MM\0\x2a\0\0\0\x08", 8);
+    exif_write_ifd(out, tiff_base, ifd0, n0, n1 ? ifd1_offset : 0);
+    if (ngps)
+        exif_write_ifd(out, tiff_base, gps, ngps, 0);
+    if (n1) {
+        exif_write_ifd(out, tiff_base, ifd1, n1, 0);
+        out->append(thumbnail->data, thumbnail->size);
+    }
+    if (out->failed)
+        return false;
+
+    uint32_t len = out->size - app1_start - 2;
+    out->data[app1_start + 2] = len >> 8;
+    out->data[app1_start + 3] = len & 0xff;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+
+SoftJpegEncoder::SoftJpegEncoder()
+    : mThreadRunning(false),
+      mFragmentCallback(NULL),
+      mDoneCallback(NULL),
+      mCallbackUser(NULL),
+      mMainQuality(85),
+      mThumbnailQuality(75),
+      mRotation(0),
+      mHaveLocation(false),
+      mThreadCount(1),
+      mHaveThumbnail(false)
+{
+    pthread_mutex_init(&mLock, NULL);
+    memset(&mLocation, 0, sizeof(mLocation));
+    memset(&mMain, 0, sizeof(mMain));
+    memset(&mThumbnail, 0, sizeof(mThumbnail));
+    pthread_once(&tables_once, init_tables);
+}
+
+SoftJpegEncoder::~SoftJpegEncoder()
+{
+    join();
+    pthread_mutex_destroy(&mLock);
+}
+
+void SoftJpegEncoder::setCallbacks(fragment_callback fragment_cb,
+                                   done_callback done_cb, void *user)
+{
+    mFragmentCallback = fragment_cb;
+    mDoneCallback = done_cb;
+    mCallbackUser = user;
+}
+
+bool SoftJpegEncoder::setMainImageQuality(uint32_t quality)
+{
+    if (quality < 1 || quality > 100)
+        return false;
+    mMainQuality = quality;
+    return true;
+}
+
+bool SoftJpegEncoder::setThumbnailQuality(uint32_t quality)
+{
+    if (quality < 1 || quality > 100)
+        return false;
+    mThumbnailQuality = quality;
+    return true;
+}
+
+bool SoftJpegEncoder::setRotation(uint32_t rotation)
+{
+    if (rotation != 0 && rotation != 90 && rotation != 180 && rotation != 270)
+        return false;
+    mRotation = rotation;
+    return true;
+}
+
+void SoftJpegEncoder::setLocation(const Location *location)
+{
+    mHaveLocation = location != NULL;
+    if (location)
+        mLocation = *location;
+}
+
+void SoftJpegEncoder::setThreadCount(int threads)
+{
+    if (threads < 1) threads = 1;
+    if (threads > MAX_ENCODER_THREADS) threads = MAX_ENCODER_THREADS;
+    mThreadCount = threads;
+}
+
+bool SoftJpegEncoder::busy()
+{
+    pthread_mutex_lock(&mLock);
+    bool running = mThreadRunning;
+    pthread_mutex_unlock(&mLock);
+    return running;
+}
+
+bool SoftJpegEncoder::encode(const Image &main, const Image *thumbnail)
+{
+    if (main.y == NULL || main.cbcr == NULL ||
+        main.width <= 0 || main.height <= 0 ||
+        main.width > 0xffff || main.height > 0xffff) {
+        LOGE("encode: invalid main image %dx%d", main.width, main.height);
+        return false;
+    }
+
+    // Reap a previous encode that nobody joined.
+    join();
+
+    pthread_mutex_lock(&mLock);
+    mMain = main;
+    mHaveThumbnail = thumbnail != NULL && thumbnail->y != NULL &&
+        thumbnail->width > 0 && thumbnail->height > 0;
+    if (mHaveThumbnail)
+        mThumbnail = *thumbnail;
+    mThreadRunning = !pthread_create(&mThread, NULL, encoder_thread, this);
+    bool ok = mThreadRunning;
+    pthread_mutex_unlock(&mLock);
+
+    if (!ok)
+        LOGE("encode: could not start encoder thread");
+    return ok;
+}
+
+void SoftJpegEncoder::join()
+{
+    pthread_mutex_lock(&mLock);
+    if (!mThreadRunning) {
+        pthread_mutex_unlock(&mLock);
+        return;
+    }
+    pthread_t thread = mThread;
+    mThreadRunning = false;
+    pthread_mutex_unlock(&mLock);
+
+    // The done callback commonly joins the encoder from the encoder thread
+    // itself; detach instead of deadlocking.
+    if (pthread_equal(thread, pthread_self()))
+        pthread_detach(thread);
+    else
+        pthread_join(thread, NULL);
+}
+
+void *SoftJpegEncoder::encoder_thread(void *user)
+{
+    static_cast<SoftJpegEncoder *>(user)->runEncoder();
+    return NULL;
+}
+
+void SoftJpegEncoder::runEncoder()
+{
+    LOGV("runEncoder E: %dx%d, quality %d, %d threads",
+         mMain.width, mMain.height, mMainQuality, mThreadCount);
+
+    quant_table luma_qt, chroma_qt;
+    out_buffer header, thumbnail;
+    stripe_job jobs[MAX_ENCODER_THREADS];
+    bool ok = true;
+
+    // Thumbnail first; it goes into the EXIF header.
+    if (mHaveThumbnail) {
+        build_quant_table(std_luma_quant, mThumbnailQuality, &luma_qt);
+        build_quant_table(std_chroma_quant, mThumbnailQuality, &chroma_qt);
+        encode_params tp;
+        tp.image = &mThumbnail;
+        tp.luma_qt = &luma_qt;
+        tp.chroma_qt = &chroma_qt;
+        tp.mcu_cols = (mThumbnail.width + 15) / 16;
+        tp.mcu_rows = (mThumbnail.height + 15) / 16;
+        tp.restart = false;
+        thumbnail.put16(0xffd8);
+        write_tables(&thumbnail, &luma_qt, &chroma_qt,
+                     mThumbnail.width, mThumbnail.height, 0);
+        int njobs;
+        if (!encode_scan(tp, 1, &thumbnail, jobs, &njobs)) {
+            LOGW("runEncoder: thumbnail encoding failed, skipping it");
+            mHaveThumbnail = false;
+        }
+    }
+
+    build_quant_table(std_luma_quant, mMainQuality, &luma_qt);
+    build_quant_table(std_chroma_quant, mMainQuality, &chroma_qt);
+    encode_params mp;
+    mp.image = &mMain;
+    mp.luma_qt = &luma_qt;
+    mp.chroma_qt = &chroma_qt;
+    mp.mcu_cols = (mMain.width + 15) / 16;
+    mp.mcu_rows = (mMain.height + 15) / 16;
+
+    int nthreads = mThreadCount < mp.mcu_rows ? mThreadCount : mp.mcu_rows;
+    mp.restart = nthreads > 1;
+
+    header.put16(0xffd8);
+    ok = write_exif(&header, mRotation, mHaveLocation ? &mLocation : NULL,
+                    mHaveThumbnail ? &thumbnail : NULL);
+    write_tables(&header, &luma_qt, &chroma_qt, mMain.width, mMain.height,
+                 mp.restart ? mp.mcu_cols : 0);
+    ok = ok && !header.failed;
+
+    // Stripe 0 (or the whole scan) goes straight after the header.
+    int njobs = 1;
+    if (ok)
+        ok = encode_scan(mp, nthreads, &header, jobs, &njobs);
+
+    if (ok && mFragmentCallback) {
+        mFragmentCallback(header.data, header.size, mCallbackUser);
+        if (njobs > 1) {
+            for (int i = 1; i < njobs; i++)
+                mFragmentCallback(jobs[i].out.data, jobs[i].out.size,
+                                  mCallbackUser);
+            static const uint8_t eoi[2] = { 0xff, 0xd9 };
+            mFragmentCallback(eoi, sizeof(eoi), mCallbackUser);
+        }
+    }
+    if (!ok)
+        LOGE("runEncoder: encoding failed (out of memory?)");
+
+    LOGV("runEncoder X: %d", ok);
+    if (mDoneCallback)
+        mDoneCallback(ok, mCallbackUser);
+}
+
+}; // namespace android
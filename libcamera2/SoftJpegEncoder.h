@@ -0,0 +1,110 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_SOFT_JPEG_ENCODER_H
+#define ANDROID_HARDWARE_SOFT_JPEG_ENCODER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+namespace android {
+
+// Baseline JPEG encoder for YUV420SP frames that follows the same contract
+// as the jpeg_encoder_* entry points of liboemcamera: settings are applied
+// up front, encode() returns immediately, the bitstream is handed out in
+// fragments from the encoder thread, completion is reported through a
+// callback, and join() reaps the encoder thread.
+//
+// It has no dependencies on the camera driver, so it also builds and runs
+// on a Linux host (see softjpeg_bench.cpp).
+class SoftJpegEncoder {
+public:
+    typedef void (*fragment_callback)(const uint8_t *buf, uint32_t size,
+                                      void *user);
+    typedef void (*done_callback)(bool success, void *user);
+
+    // A YUV420SP image: a luma plane followed by an interleaved chroma plane
+    // at half resolution.  Both planes use the same stride.
+    struct Image {
+        const uint8_t *y;
+        const uint8_t *cbcr;
+        int width;
+        int height;
+        int stride;
+        bool crcb;      // chroma is interleaved CrCb (MSM VFE output)
+    };
+
+    struct Location {
+        uint32_t timestamp;  // seconds since the epoch
+        double latitude;     // degrees
+        double longitude;    // degrees
+        int altitude;        // meters
+    };
+
+    SoftJpegEncoder();
+    ~SoftJpegEncoder();
+
+    void setCallbacks(fragment_callback fragment_cb, done_callback done_cb,
+                      void *user);
+    bool setMainImageQuality(uint32_t quality);
+    bool setThumbnailQuality(uint32_t quality);
+    bool setRotation(uint32_t rotation);
+    void setLocation(const Location *location);  // NULL clears it
+
+    // Number of cores to spread the main image over.  When more than one is
+    // used, the scan carries a restart marker after every MCU row so that
+    // horizontal stripes can be entropy-coded independently.
+    void setThreadCount(int threads);
+
+    // Starts encoding on the encoder thread.  The image buffers must stay
+    // valid until the done callback has run.  thumbnail may be NULL.
+    bool encode(const Image &main, const Image *thumbnail);
+
+    // Waits for the encoder thread.  Safe to call from the done callback.
+    void join();
+
+    bool busy();
+
+private:
+    static void *encoder_thread(void *user);
+    void runEncoder();
+
+    pthread_mutex_t mLock;
+    pthread_t mThread;
+    bool mThreadRunning;
+
+    fragment_callback mFragmentCallback;
+    done_callback mDoneCallback;
+    void *mCallbackUser;
+
+    uint32_t mMainQuality;
+    uint32_t mThumbnailQuality;
+    uint32_t mRotation;
+    bool mHaveLocation;
+    Location mLocation;
+    int mThreadCount;
+
+    Image mMain;
+    Image mThumbnail;
+    bool mHaveThumbnail;
+
+    SoftJpegEncoder(const SoftJpegEncoder &);
+    SoftJpegEncoder &operator=(const SoftJpegEncoder &);
+};
+
+}; // namespace android
+
+#endif
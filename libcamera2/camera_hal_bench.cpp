@@ -0,0 +1,281 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// Drives QualcommCameraHardware end to end against the fake MSM driver and
+// liboemcamera (see FakeMsmCamera.h), and reports preview frame rate,
+// preview callback latency and shot-to-shot time:
+//
+//   camera_hal_bench [preview_seconds] [shots] [preview WxH] [picture WxH]
+//                    [zoom]
+//
+// The fake camera is configured through the FAKECAM_* environment
+// variables.  The HAL's own dump() output follows the summary.
+
+#define LOG_TAG "camera_hal_bench"
+#include <utils/Log.h>
+
+#include "FakeMsmCamera.h"
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <ui/CameraHardwareInterface.h>
+#include <ui/CameraParameters.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace android;
+
+extern "C" sp<CameraHardwareInterface> openCameraHardware();
+
+#define MAX_SAMPLES 4096
+
+struct samples {
+    nsecs_t values[MAX_SAMPLES];
+    int count;
+};
+
+struct bench_state {
+    Mutex lock;
+    Condition wait;
+
+    bool counting;
+    int previewFrames;
+    samples callbackLatency;    // liboemcamera delivery to data callback
+    samples captureLatency;     // frame capture to data callback
+
+    nsecs_t shutterTime;
+    nsecs_t jpegTime;
+    size_t jpegSize;
+    bool error;
+};
+
+static void add_sample(samples *s, nsecs_t value)
+{
+    if (s->count < MAX_SAMPLES)
+        s->values[s->count++] = value;
+}
+
+static int compare_nsecs(const void *a, const void *b)
+{
+    nsecs_t x = *(const nsecs_t *)a, y = *(const nsecs_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_samples(const char *name, samples *s)
+{
+    if (s->count == 0) {
+        printf("  %-22s no samples\n", name);
+        return;
+    }
+    qsort(s->values, s->count, sizeof(s->values[0]), compare_nsecs);
+    nsecs_t total = 0;
+    for (int i = 0; i < s->count; i++)
+        total += s->values[i];
+    printf("  %-22s avg %8.2f  p50 %8.2f  p90 %8.2f  max %8.2f ms "
+           "(%d samples)\n", name,
+           total / s->count / 1000000.0,
+           s->values[s->count / 2] / 1000000.0,
+           s->values[s->count * 9 / 10] / 1000000.0,
+           s->values[s->count - 1] / 1000000.0, s->count);
+}
+
+static void notify_cb(int32_t msgType, int32_t ext1, int32_t ext2,
+                      void *user)
+{
+    bench_state *state = (bench_state *)user;
+    Mutex::Autolock l(&state->lock);
+    if (msgType == CAMERA_MSG_SHUTTER) {
+        state->shutterTime = systemTime();
+    } else if (msgType == CAMERA_MSG_ERROR) {
+        state->error = true;
+        state->wait.broadcast();
+    }
+}
+
+static void data_cb(int32_t msgType, const sp<IMemory>& dataPtr, void *user)
+{
+    nsecs_t now = systemTime();
+    bench_state *state = (bench_state *)user;
+    Mutex::Autolock l(&state->lock);
+
+    if (msgType == CAMERA_MSG_PREVIEW_FRAME) {
+        if (!state->counting)
+            return;
+        ssize_t offset;
+        size_t size;
+        sp<IMemoryHeap> heap = dataPtr->getMemory(&offset, &size);
+        int64_t captured, delivered;
+        if (fakecam_frame_time((uint8_t *)heap->base() + offset,
+                               &captured, &delivered)) {
+            add_sample(&state->callbackLatency, now - delivered);
+            add_sample(&state->captureLatency, now - captured);
+        }
+        state->previewFrames++;
+        state->wait.broadcast();
+    } else if (msgType == CAMERA_MSG_COMPRESSED_IMAGE) {
+        ssize_t offset;
+        size_t size;
+        dataPtr->getMemory(&offset, &size);
+        state->jpegSize = size;
+        state->jpegTime = now;
+        state->wait.broadcast();
+    }
+}
+
+static void data_cb_timestamp(nsecs_t timestamp, int32_t msgType,
+                              const sp<IMemory>& dataPtr, void *user)
+{
+}
+
+// Waits for the next preview frame; false on timeout.
+static bool wait_preview_frame(bench_state *state)
+{
+    Mutex::Autolock l(&state->lock);
+    int frames = state->previewFrames;
+    nsecs_t deadline = systemTime() + s2ns(2);
+    while (state->previewFrames == frames) {
+        nsecs_t remaining = deadline - systemTime();
+        if (remaining <= 0)
+            return false;
+        state->wait.waitRelative(state->lock, remaining);
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int previewSeconds = argc > 1 ? atoi(argv[1]) : 5;
+    int shots = argc > 2 ? atoi(argv[2]) : 5;
+    const char *previewSize = argc > 3 ? argv[3] : "480x320";
+    const char *pictureSize = argc > 4 ? argv[4] : "2048x1536";
+    int zoom = argc > 5 ? atoi(argv[5]) : 0;
+
+    bench_state *state = new bench_state();
+    state->counting = false;
+    state->previewFrames = 0;
+    state->callbackLatency.count = 0;
+    state->captureLatency.count = 0;
+    state->error = false;
+
+    sp<CameraHardwareInterface> hardware = openCameraHardware();
+    if (hardware == 0) {
+        fprintf(stderr, "could not open the camera; is the fake "
+                "liboemcamera loaded?\n");
+        return 1;
+    }
+    hardware->setCallbacks(notify_cb, data_cb, data_cb_timestamp, state);
+    hardware->enableMsgType(CAMERA_MSG_PREVIEW_FRAME | CAMERA_MSG_SHUTTER |
+                            CAMERA_MSG_COMPRESSED_IMAGE | CAMERA_MSG_ERROR);
+
+    CameraParameters params = hardware->getParameters();
+    params.set(CameraParameters::KEY_PREVIEW_SIZE, previewSize);
+    params.set(CameraParameters::KEY_PICTURE_SIZE, pictureSize);
+    params.set("zoom", zoom);
+    if (hardware->setParameters(params) != NO_ERROR) {
+        fprintf(stderr, "invalid preview size %s, picture size %s or "
+                "zoom %d\n", previewSize, pictureSize, zoom);
+        return 1;
+    }
+
+    nsecs_t start = systemTime();
+    if (hardware->startPreview() != NO_ERROR) {
+        fprintf(stderr, "startPreview failed\n");
+        return 1;
+    }
+    wait_preview_frame(state);
+    nsecs_t firstFrame = systemTime();
+
+    state->lock.lock();
+    state->counting = true;
+    state->previewFrames = 0;
+    state->lock.unlock();
+    nsecs_t previewStart = systemTime();
+    sleep(previewSeconds);
+    state->lock.lock();
+    state->counting = false;
+    int frames = state->previewFrames;
+    state->lock.unlock();
+    nsecs_t previewTime = systemTime() - previewStart;
+
+    printf("preview %s: first frame %.1f ms after startPreview, "
+           "%.2f fps over %d frames\n", previewSize,
+           (firstFrame - start) / 1000000.0,
+           frames * 1000000000.0 / previewTime, frames);
+    print_samples("callback latency", &state->callbackLatency);
+    print_samples("capture latency", &state->captureLatency);
+
+    // Shot to shot as a camera application sees it: takePicture() until the
+    // JPEG arrives, then restart preview and wait for its first frame before
+    // the next shot.
+    samples shutterLag, jpegLatency, shotToShot;
+    shutterLag.count = jpegLatency.count = shotToShot.count = 0;
+    size_t jpegSize = 0;
+    nsecs_t lastShot = 0;
+    for (int i = 0; i < shots; i++) {
+        state->lock.lock();
+        state->shutterTime = 0;
+        state->jpegTime = 0;
+        state->lock.unlock();
+
+        nsecs_t shot = systemTime();
+        if (lastShot)
+            add_sample(&shotToShot, shot - lastShot);
+        lastShot = shot;
+        if (hardware->takePicture() != NO_ERROR) {
+            fprintf(stderr, "takePicture %d failed\n", i);
+            break;
+        }
+
+        state->lock.lock();
+        while (!state->jpegTime && !state->error)
+            state->wait.waitRelative(state->lock, s2ns(10));
+        bool error = state->error || !state->jpegTime;
+        if (state->shutterTime)
+            add_sample(&shutterLag, state->shutterTime - shot);
+        if (!error)
+            add_sample(&jpegLatency, state->jpegTime - shot);
+        jpegSize = state->jpegSize;
+        state->lock.unlock();
+        if (error) {
+            fprintf(stderr, "picture %d failed\n", i);
+            break;
+        }
+
+        if (hardware->startPreview() != NO_ERROR ||
+            !wait_preview_frame(state)) {
+            fprintf(stderr, "preview did not restart after picture %d\n", i);
+            break;
+        }
+    }
+
+    printf("pictures %s: %d taken, last JPEG %u bytes\n", pictureSize,
+           jpegLatency.count, (unsigned)jpegSize);
+    print_samples("shutter lag", &shutterLag);
+    print_samples("takePicture to JPEG", &jpegLatency);
+    print_samples("shot to shot", &shotToShot);
+    fflush(stdout);
+
+    Vector<String16> args;
+    hardware->dump(STDOUT_FILENO, args);
+
+    hardware->stopPreview();
+    hardware->release();
+    hardware.clear();
+    return 0;
+}
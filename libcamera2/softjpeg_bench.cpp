@@ -0,0 +1,140 @@
+/*
+** Copyright 2008, Google Inc.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// Encodes a raw YUV420SP (CrCb) frame with SoftJpegEncoder and reports the
+// encode time.  Runs on the host as well as on the device:
+//
+//   softjpeg_bench <in.yuv> <width> <height> [quality] [threads] [iterations]
+//                  [out.jpg]
+
+#include "SoftJpegEncoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using android::SoftJpegEncoder;
+
+struct bench_output {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+static void fragment_cb(const uint8_t *buf, uint32_t size, void *user)
+{
+    bench_output *out = (bench_output *)user;
+    if (out->size + size > out->capacity) {
+        uint32_t cap = (out->size + size) * 2;
+        uint8_t *p = (uint8_t *)realloc(out->data, cap);
+        if (p == NULL)
+            return;
+        out->data = p;
+        out->capacity = cap;
+    }
+    memcpy(out->data + out->size, buf, size);
+    out->size += size;
+}
+
+static void done_cb(bool success, void *user __attribute__((unused)))
+{
+    if (!success)
+        fprintf(stderr, "encode failed\n");
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <in.yuv> <width> <height> [quality] "
+                "[threads] [iterations] [out.jpg]\n", argv[0]);
+        return 1;
+    }
+
+    int width = atoi(argv[2]);
+    int height = atoi(argv[3]);
+    int quality = argc > 4 ? atoi(argv[4]) : 85;
+    int threads = argc > 5 ? atoi(argv[5]) : 1;
+    int iterations = argc > 6 ? atoi(argv[6]) : 10;
+    const char *out_path = argc > 7 ? argv[7] : NULL;
+
+    size_t frame_size = width * height * 3 / 2;
+    uint8_t *frame = (uint8_t *)malloc(frame_size);
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL || frame == NULL ||
+        fread(frame, 1, frame_size, f) != frame_size) {
+        fprintf(stderr, "could not read %zu bytes from %s\n",
+                frame_size, argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    SoftJpegEncoder::Image image;
+    image.y = frame;
+    image.cbcr = frame + width * height;
+    image.width = width;
+    image.height = height;
+    image.stride = width;
+    image.crcb = true;
+
+    bench_output out;
+    memset(&out, 0, sizeof(out));
+
+    SoftJpegEncoder encoder;
+    encoder.setCallbacks(fragment_cb, done_cb, &out);
+    if (!encoder.setMainImageQuality(quality)) {
+        fprintf(stderr, "invalid quality %d\n", quality);
+        return 1;
+    }
+    encoder.setThreadCount(threads);
+
+    double total = 0, best = 0;
+    for (int i = 0; i < iterations; i++) {
+        out.size = 0;
+        double start = now_ms();
+        if (!encoder.encode(image, NULL))
+            return 1;
+        encoder.join();
+        double elapsed = now_ms() - start;
+        total += elapsed;
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    printf("%dx%d q%d, %d thread(s): %u bytes, avg %.2f ms, best %.2f ms, "
+           "%.1f Mpixel/s\n", width, height, quality, threads, out.size,
+           total / iterations, best, width * height / (best * 1000.0));
+
+    if (out_path) {
+        f = fopen(out_path, "wb");
+        if (f == NULL || fwrite(out.data, 1, out.size, f) != out.size) {
+            fprintf(stderr, "could not write %s\n", out_path);
+            return 1;
+        }
+        fclose(f);
+    }
+
+    free(out.data);
+    free(frame);
+    return 0;
+}
@@ -4,7 +4,8 @@ include $(CLEAR_VARS)
 
 # Set up the OpenCore variables.
 include external/opencore/Config.mk
-LOCAL_C_INCLUDES := $(PV_INCLUDES)
+LOCAL_C_INCLUDES := $(PV_INCLUDES) \
+    $(LOCAL_PATH)/../libvideohw
 
 LOCAL_SRC_FILES := android_surface_output_msm72xx.cpp
 
@@ -22,7 +23,8 @@ LOCAL_SHARED_LIBRARIES := \
     libskia \
     libopencore_common \
     libicuuc \
-    libopencore_player
+    libopencore_player \
+    libvideohw
 
 LOCAL_MODULE := libopencorehw
 
@@ -21,12 +21,11 @@
 #include <utils/Log.h>
 
 #include "android_surface_output_msm72xx.h"
+#include "QComDisplay.h"
 #include <media/PVPlayer.h>
 
 #include <cutils/properties.h>
 
-#define PLATFORM_PRIVATE_PMEM 1
-
 #if HAVE_ANDROID_OS
 #include <linux/android_pmem.h>
 #endif
@@ -36,26 +35,43 @@ using namespace android;
 static const char* pmem_adsp = "/dev/pmem_adsp";
 static const char* pmem = "/dev/pmem";
 
+// deepest the software frame ring grows when the display holds on to frames
+static const size_t kMaxFrameBuffers = 4;
+
 OSCL_EXPORT_REF AndroidSurfaceOutputMsm72xx::AndroidSurfaceOutputMsm72xx() :
-    AndroidSurfaceOutput()
+    AndroidSurfaceOutput(),
+    mFrameRing(kBufferCount, kMaxFrameBuffers, getDisplayRefreshPeriod()),
+    mVideoStats("AndroidSurfaceOutputMsm72xx")
 {
     mHardwareCodec = false;
+    mFrameSize = 0;
 
     //Statistics profiling
     char value[PROPERTY_VALUE_MAX];
     mStatistics = false;
-    mLastFrame = 0;
-    mLastFpsTime = 0;
-    mFpsSum = 0;
-    iFrameNumber = 0;
-    mNumFpsSamples = 0;
     property_get("persist.debug.pv.statistics", value, "0");
     if(atoi(value)) mStatistics = true;
+
+    // convert software frames while the decoder works on the next one
+    mFrameWorker = NULL;
+    mFrameDone = NULL;
+    mForwardedWrite = false;
+    property_get("persist.debug.pv.pipeline", value, "1");
+    if (atoi(value)) {
+        mFrameDone = new FrameDoneAO(this);
+        mFrameWorker = new QComFrameWorker(this, kBufferCount);
+    }
+
+    // drop software frames that are too late to be worth converting
+    property_get("persist.debug.pv.skiplate", value, "1");
+    mSkipLateFrames = atoi(value) != 0;
 }
 
 OSCL_EXPORT_REF AndroidSurfaceOutputMsm72xx::~AndroidSurfaceOutputMsm72xx()
 {
-    if(mStatistics) AverageFPSPrint();
+    delete mFrameWorker;
+    delete mFrameDone;
+    if(mStatistics) mVideoStats.log();
 }
 
 // create a frame buffer for software codecs
@@ -66,12 +82,18 @@ OSCL_EXPORT_REF bool AndroidSurfaceOutputMsm72xx::initCheck()
     if (((iVideoParameterFlags & VIDEO_SUBFORMAT_VALID) == 0) || !checkVideoParameterFlags())
         return mInitialized;
 
+    nsecs_t setupStart = systemTime();
+
     // release resources if previously initialized
     closeFrameBuf();
 
     // reset flags in case display format changes in the middle of a stream
     resetVideoParameterFlags();
 
+    // start the telemetry over for the new stream
+    if(mStatistics) mVideoStats.log();
+    mVideoStats.reset();
+
     // copy parameters in case we need to adjust them
     int displayWidth = iVideoDisplayWidth;
     int displayHeight = iVideoDisplayHeight;
@@ -83,45 +105,76 @@ OSCL_EXPORT_REF bool AndroidSurfaceOutputMsm72xx::initCheck()
     if (iVideoSubFormat == PVMF_MIME_YUV420_SEMIPLANAR_YVU) {
         LOGV("using hardware codec");
         mHardwareCodec = true;
+
+        // the decoder brings its own buffers, so free the frame heap a
+        // software stream may have kept
+        Mutex::Autolock lock(mFrameLock);
+        mFrameHeap.clear();
+        mBufferHeap = ISurface::BufferHeap();
     } else {
         LOGV("using software codec");
+        mHardwareCodec = false;
 
         // YUV420 frames are 1.5 bytes/pixel
         frameSize = (frameWidth * frameHeight * 3) / 2;
+        mFrameSize = frameSize;
 
-        // create frame buffer heap
-        sp<MemoryHeapBase> master = new MemoryHeapBase(pmem_adsp, frameSize * kBufferCount);
-        if (master->heapID() < 0) {
-            LOGE("Error creating frame buffer heap");
-            return false;
-        }
-        master->setDevice(pmem);
-        sp<MemoryHeapPmem> heap = new MemoryHeapPmem(master, 0);
-        heap->slap();
-        mBufferHeap = ISurface::BufferHeap(displayWidth, displayHeight, 
-                frameWidth, frameHeight, PIXEL_FORMAT_YCbCr_420_SP, heap);
-        master.clear();
-        mSurface->registerBuffers(mBufferHeap);
-
-        // create frame buffers
-        for (int i = 0; i < kBufferCount; i++) {
-            mFrameBuffers[i] = i * frameSize;
-        }
+        // create frame buffer heap, as deep as the last stream needed it,
+        // and register frame buffers with SurfaceFlinger
+        if (!allocateFrameHeap(mFrameRing.wantedSlots())) return false;
 
         LOGV("video = %d x %d", displayWidth, displayHeight);
         LOGV("frame = %d x %d", frameWidth, frameHeight);
         LOGV("frame #bytes = %d", frameSize);
-
-        // register frame buffers with SurfaceFlinger
-        mFrameBufferIndex = 0;
     }
 
     mInitialized = true;
+    mVideoStats.setupDone(systemTime() - setupStart);
     LOGV("sendEvent(MEDIA_SET_VIDEO_SIZE, %d, %d)", iVideoDisplayWidth, iVideoDisplayHeight);
     mPvPlayer->sendEvent(MEDIA_SET_VIDEO_SIZE, iVideoDisplayWidth, iVideoDisplayHeight);
     return mInitialized;
 }
 
+bool AndroidSurfaceOutputMsm72xx::allocateFrameHeap(size_t slots)
+{
+    // reuse the heap of an earlier stream or depth when the frames fit in it
+    // with less than a frame to spare, as contiguous memory is scarce
+    size_t size = mFrameSize * slots;
+    sp<MemoryHeapPmem> heap = mFrameHeap;
+    if (heap == 0 || heap->getSize() < size || heap->getSize() - size >= mFrameSize) {
+        // between streams nothing shows the old heap, so free it first
+        if (!mInitialized) {
+            heap.clear();
+            mFrameHeap.clear();
+            mBufferHeap = ISurface::BufferHeap();
+        }
+
+        sp<MemoryHeapBase> master = new MemoryHeapBase(pmem_adsp, size);
+        if (master->heapID() < 0) {
+            LOGE("Error creating frame buffer heap");
+            return false;
+        }
+        master->setDevice(pmem);
+        heap = new MemoryHeapPmem(master, 0);
+        heap->slap();
+        master.clear();
+        mVideoStats.heapAllocated();
+        LOGV("frame buffer heap of %d frames", slots);
+    } else {
+        LOGV("reusing frame buffer heap for %d frames", slots);
+    }
+
+    Mutex::Autolock lock(mFrameLock);
+    mFrameHeap = heap;
+    mBufferHeap = ISurface::BufferHeap(iVideoDisplayWidth, iVideoDisplayHeight,
+            iVideoWidth, iVideoHeight, PIXEL_FORMAT_YCbCr_420_SP, heap);
+    mSurface->registerBuffers(mBufferHeap);
+    mFrameRing.reset(slots);
+    mFrameBufferIndex = mFrameRing.current();
+    mVideoStats.heapRegistered();
+    return true;
+}
+
 PVMFStatus AndroidSurfaceOutputMsm72xx::writeFrameBuf(uint8* aData, uint32 aDataLen, const PvmiMediaXferHeader& data_header_info)
 {
     // OK to drop frames if no surface
@@ -130,118 +183,225 @@ PVMFStatus AndroidSurfaceOutputMsm72xx::writeFrameBuf(uint8* aData, uint32 aData
     // hardware codec
     if (mHardwareCodec) {
 
-        // initialize frame buffer heap
-        if (mBufferHeap.heap == 0) {
-            LOGV("initializing for hardware");
-            LOGV("private data pointer is 0%p\n", data_header_info.private_data_ptr);
-
-            // check for correct video format
-            if (iVideoSubFormat != PVMF_MIME_YUV420_SEMIPLANAR_YVU) return PVMFFailure;
+        // check for correct video format
+        if (iVideoSubFormat != PVMF_MIME_YUV420_SEMIPLANAR_YVU) return PVMFFailure;
 
-            uint32 fd;
-            if (!getPmemFd(data_header_info.private_data_ptr, &fd)) {
-                LOGE("Error getting pmem heap from private_data_ptr");
-                return PVMFFailure;
-            }
-
-            // ugly hack to pass an sp<MemoryHeapBase> as an int
-            sp<MemoryHeapBase> master = (MemoryHeapBase *) fd;
-            master->setDevice(pmem);
-
-            // create new reference
-            uint32_t heap_flags = master->getFlags() & MemoryHeapBase::NO_CACHING;
-            sp<MemoryHeapPmem> heap = new MemoryHeapPmem(master, heap_flags);
-            heap->slap();
+        QComVideoBuffer buffer;
+        if (!buffer.parse(data_header_info.private_data_ptr)) {
+            LOGE("Error getting pmem buffer from private_data_ptr");
+            return PVMFFailure;
+        }
 
-            // register frame buffers with SurfaceFlinger
-            mBufferHeap = ISurface::BufferHeap(iVideoDisplayWidth, iVideoDisplayHeight, 
+        // register the decoder heap with SurfaceFlinger the first time,
+        // and again whenever the decoder switches heaps
+        bool changed;
+        sp<MemoryHeapPmem> heap = mHeapRegistry.heapFor(buffer, &changed);
+        if (changed) {
+            LOGV("initializing for hardware, heap %p", buffer.heap);
+            mBufferHeap = ISurface::BufferHeap(iVideoDisplayWidth, iVideoDisplayHeight,
                     iVideoWidth, iVideoHeight, PIXEL_FORMAT_YCbCr_420_SP, heap);
-            master.clear();
             mSurface->registerBuffers(mBufferHeap);
+            mVideoStats.heapRegistered();
         }
 
-        // get pmem offset and post to SurfaceFlinger
-        if (!getOffset(data_header_info.private_data_ptr, &mOffset)) {
-            LOGE("Error getting pmem offset from private_data_ptr");
-            return PVMFFailure;
-        }
+        // post to SurfaceFlinger
+        mOffset = buffer.offset;
+        nsecs_t start = systemTime();
         mSurface->postBuffer(mOffset);
+        nsecs_t now = systemTime();
+        mVideoStats.postDone(now - start);
+        mVideoStats.frameShown(now);
     } else {
         // software codec
-        if (++mFrameBufferIndex == kBufferCount) mFrameBufferIndex = 0;
-        convertFrame(aData, static_cast<uint8*>(mBufferHeap.heap->base()) + mFrameBuffers[mFrameBufferIndex], aDataLen);
-        // post to SurfaceFlinger
-        mSurface->postBuffer(mFrameBuffers[mFrameBufferIndex]);
+        writeSoftwareFrame(aData, aDataLen, data_header_info.timestamp);
     }
 
-    //Average FPS profiling
-    if(mStatistics) AverageFPSProfiling();
-
     return PVMFSuccess;
 }
 
+void AndroidSurfaceOutputMsm72xx::writeSoftwareFrame(uint8* aData, uint32 aDataLen, uint32 aTimestamp)
+{
+    // late frames are consumed without being shown
+    if (mSkipLateFrames) {
+        nsecs_t lateness;
+        bool resynced;
+        bool late = mFrameClock.isLate(aTimestamp, systemTime(), &lateness, &resynced);
+        mVideoStats.frameArrived(lateness, resynced);
+        if (late) {
+            mVideoStats.frameLate();
+            return;
+        }
+    }
+
+    // follow the ring to the depth it wants, unless there is no memory for it
+    size_t slots = mFrameRing.wantedSlots();
+    if (slots != mFrameRing.slots() && !allocateFrameHeap(slots)) mFrameRing.capDepth();
+
+    // wait for SurfaceFlinger to be done with the slot before writing it
+    bool stalled;
+    int index = mFrameRing.acquire(&stalled);
+    if (stalled) mVideoStats.stalled();
+
+    nsecs_t start = systemTime();
+    convertFrame(aData, static_cast<uint8*>(mBufferHeap.heap->base()) + index * mFrameSize, aDataLen);
+    nsecs_t converted = systemTime();
+    mVideoStats.conversionDone(converted - start);
+    // post to SurfaceFlinger
+    mSurface->postBuffer(index * mFrameSize);
+    mFrameRing.posted(index);
+    nsecs_t now = systemTime();
+    mVideoStats.postDone(now - converted);
+    mVideoStats.frameShown(now);
+
+    Mutex::Autolock lock(mFrameLock);
+    mFrameBufferIndex = index;
+}
+
+PVMFCommandId AndroidSurfaceOutputMsm72xx::writeAsync(uint8 aFormatType, int32 aFormatIndex, uint8* aData, uint32 aDataLen,
+        const PvmiMediaXferHeader& data_header_info, OsclAny* aContext)
+{
+    if (mFrameWorker == NULL || mHardwareCodec || !mInitialized || mSurface == 0 ||
+            iState != STATE_STARTED || aFormatType != PVMI_MEDIAXFER_FMT_TYPE_DATA ||
+            aFormatIndex != PVMI_MEDIAXFER_FMT_INDEX_DATA || mForwardedWrite) {
+        // the frames before this write complete first, at the top of Run(),
+        // and the frames after it go to the base class too until it has
+        // completed this one
+        if (mFrameWorker) mFrameWorker->drain();
+        mForwardedWrite = true;
+        return AndroidSurfaceOutput::writeAsync(aFormatType, aFormatIndex, aData, aDataLen,
+                data_header_info, aContext);
+    }
+
+    // the decoder keeps aData until the write completes, in Run()
+    QComFrameWorker::Job job;
+    job.data = aData;
+    job.size = aDataLen;
+    job.id = iCommandCounter++;
+    job.timeMs = data_header_info.timestamp;
+    job.context = aContext;
+    mFrameWorker->queue(job);
+    return job.id;
+}
+
+void AndroidSurfaceOutputMsm72xx::Run()
+{
+    // the worker's frames were written before anything the base class has
+    // queued, see writeAsync()
+    completeFrames();
+    AndroidSurfaceOutput::Run();
+    mForwardedWrite = false;
+}
+
+// complete the writes of the frames the worker is done with
+void AndroidSurfaceOutputMsm72xx::completeFrames()
+{
+    if (mFrameWorker == NULL) return;
+    QComFrameWorker::Job job;
+    while (mFrameWorker->takeCompleted(&job)) {
+        if (iPeer) iPeer->writeComplete(PVMFSuccess, job.id, (OsclAny*)job.context);
+    }
+}
+
+void AndroidSurfaceOutputMsm72xx::setParametersSync(PvmiMIOSession aSession, PvmiKvp* aParameters,
+        int num_elements, PvmiKvp * & aRet_kvp)
+{
+    // frames queued before the change were decoded for the old geometry,
+    // and are converted into the heap sized for it
+    if (mFrameWorker) mFrameWorker->drain();
+    AndroidSurfaceOutput::setParametersSync(aSession, aParameters, num_elements, aRet_kvp);
+}
+
+PVMFCommandId AndroidSurfaceOutputMsm72xx::Stop(const OsclAny* aContext)
+{
+    if (mFrameWorker) mFrameWorker->drain();
+    completeFrames();
+    return AndroidSurfaceOutput::Stop(aContext);
+}
+
+PVMFCommandId AndroidSurfaceOutputMsm72xx::Reset(const OsclAny* aContext)
+{
+    if (mFrameWorker) mFrameWorker->drain();
+    completeFrames();
+    return AndroidSurfaceOutput::Reset(aContext);
+}
+
+void AndroidSurfaceOutputMsm72xx::processFrame(const QComFrameWorker::Job& job)
+{
+    writeSoftwareFrame((uint8*)job.data, job.size, job.timeMs);
+}
+
+void AndroidSurfaceOutputMsm72xx::frameCompleted()
+{
+    mFrameDone->Signal();
+}
+
+AndroidSurfaceOutputMsm72xx::FrameDoneAO::FrameDoneAO(AndroidSurfaceOutputMsm72xx* aOwner) :
+    OsclActiveObject(OsclActiveObject::EPriorityNominal, "VideoMioFrameDone"),
+    iOwner(aOwner),
+    iArmed(false)
+{
+    AddToScheduler();
+    Arm();
+}
+
+AndroidSurfaceOutputMsm72xx::FrameDoneAO::~FrameDoneAO()
+{
+    Cancel();
+    RemoveFromScheduler();
+}
+
+// PV thread only
+void AndroidSurfaceOutputMsm72xx::FrameDoneAO::Arm()
+{
+    Mutex::Autolock lock(iLock);
+    iArmed = true;
+    PendForExec();
+}
+
+// any thread
+void AndroidSurfaceOutputMsm72xx::FrameDoneAO::Signal()
+{
+    Mutex::Autolock lock(iLock);
+    if (!iArmed) return;
+    iArmed = false;
+    PendComplete(OSCL_REQUEST_ERR_NONE);
+}
+
+void AndroidSurfaceOutputMsm72xx::FrameDoneAO::Run()
+{
+    // re-arm first, so that a frame finished meanwhile runs this again
+    Arm();
+    iOwner->completeFrames();
+}
+
+void AndroidSurfaceOutputMsm72xx::FrameDoneAO::DoCancel()
+{
+    Mutex::Autolock lock(iLock);
+    if (!iArmed) return;
+    iArmed = false;
+    PendComplete(OSCL_REQUEST_ERR_CANCEL);
+}
+
 // post the last video frame to refresh screen after pause
 void AndroidSurfaceOutputMsm72xx::postLastFrame()
 {
-    // ignore if no surface or heap
+    // ignore if no surface or heap; the worker may be replacing the heap
+    Mutex::Autolock lock(mFrameLock);
     if ((mSurface == NULL) || (mBufferHeap.heap == NULL)) return;
 
     if (mHardwareCodec) {
         mSurface->postBuffer(mOffset);
     } else {
-        mSurface->postBuffer(mFrameBuffers[mFrameBufferIndex]);
+        mSurface->postBuffer(mFrameBufferIndex * mFrameSize);
     }
 }
 
-bool AndroidSurfaceOutputMsm72xx::getPmemFd(OsclAny *private_data_ptr, uint32 *pmemFD)
+void AndroidSurfaceOutputMsm72xx::closeFrameBuf()
 {
-    PLATFORM_PRIVATE_LIST *listPtr = NULL;
-    PLATFORM_PRIVATE_PMEM_INFO *pmemInfoPtr = NULL;
-    bool returnType = false;
-    LOGV("in getPmemfd - privatedataptr=%p\n",private_data_ptr);
-    listPtr = (PLATFORM_PRIVATE_LIST*) private_data_ptr;
-
-    for (uint32 i=0;i<listPtr->nEntries;i++)
-    {
-        if(listPtr->entryList->type == PLATFORM_PRIVATE_PMEM)
-        {
-            LOGV("in getPmemfd - entry type = %d\n",listPtr->entryList->type);
-          pmemInfoPtr = (PLATFORM_PRIVATE_PMEM_INFO*) (listPtr->entryList->entry);
-          returnType = true;
-          if(pmemInfoPtr){
-            *pmemFD = pmemInfoPtr->pmem_fd;
-            LOGV("in getPmemfd - pmemFD = %d\n",*pmemFD);
-          }
-          break;
-        }
-    }
-    return returnType;
-}
-
-bool AndroidSurfaceOutputMsm72xx::getOffset(OsclAny *private_data_ptr, uint32 *offset)
-{
-    PLATFORM_PRIVATE_LIST *listPtr = NULL;
-    PLATFORM_PRIVATE_PMEM_INFO *pmemInfoPtr = NULL;
-    bool returnType = false;
-
-    listPtr = (PLATFORM_PRIVATE_LIST*) private_data_ptr;
-    LOGV("in getOffset: listPtr = %p\n",listPtr);
-    for (uint32 i=0;i<listPtr->nEntries;i++)
-    {
-        if(listPtr->entryList->type == PLATFORM_PRIVATE_PMEM)
-        {
-            LOGV(" in getOffset: entrytype = %d\n",listPtr->entryList->type);
-
-          pmemInfoPtr = (PLATFORM_PRIVATE_PMEM_INFO*) (listPtr->entryList->entry);
-          returnType = true;
-          if(pmemInfoPtr){
-            *offset = pmemInfoPtr->offset;
-            LOGV("in getOffset: offset = %d\n",*offset);
-          }
-          break;
-        }
-    }
-    return returnType;
+    if (mFrameWorker) mFrameWorker->drain();
+    mFrameClock.reset();
+    AndroidSurfaceOutput::closeFrameBuf();
+    mHeapRegistry.clear();
 }
 
 static inline void* byteOffset(void* p, size_t offset) { return (void*)((uint8_t*)p + offset); }
@@ -272,26 +432,3 @@ extern "C" AndroidSurfaceOutputMsm72xx* createVideoMio()
 {
     return new AndroidSurfaceOutputMsm72xx();
 }
-
-void AndroidSurfaceOutputMsm72xx::AverageFPSProfiling()
-{
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-    nsecs_t diff = now - mLastFpsTime;
-    iFrameNumber++;
-
-    if (diff > ms2ns(250)) {
-        float mFps =  ((iFrameNumber - mLastFrame) * float(s2ns(1))) / diff;
-        LOGE("AndroidSurfaceOutputMsm72xx: Frames Per Second: %.4f", mFps);
-        mFpsSum += mFps;
-        mNumFpsSamples++;
-        mLastFpsTime = now;
-        mLastFrame = iFrameNumber;
-    }
-}
-
-void AndroidSurfaceOutputMsm72xx::AverageFPSPrint()
-{
-    LOGE("==========================================================");
-    LOGE("AndroidSurfaceOutputMsm72xx: Average Frames Per Second: %.4f", mFpsSum / mNumFpsSamples);
-    LOGE("==========================================================");
-}
@@ -24,35 +24,15 @@
 // support for shared contiguous physical memory
 #include <binder/MemoryHeapPmem.h>
 
-// data structures for tunneling buffers
-typedef struct PLATFORM_PRIVATE_PMEM_INFO
-{
-    /* pmem file descriptor */
-    uint32 pmem_fd;
-    uint32 offset;
-} PLATFORM_PRIVATE_PMEM_INFO;
-
-typedef struct PLATFORM_PRIVATE_ENTRY
-{
-    /* Entry type */
-    uint32 type;
-
-    /* Pointer to platform specific entry */
-    OsclAny* entry;
-} PLATFORM_PRIVATE_ENTRY;
-
-typedef struct PLATFORM_PRIVATE_LIST
-{
-    /* Number of entries */
-    uint32 nEntries;
-
-    /* Pointer to array of platform specific entries *
-     * Contiguous block of PLATFORM_PRIVATE_ENTRY elements */
-    PLATFORM_PRIVATE_ENTRY* entryList;
-} PLATFORM_PRIVATE_LIST;
-
-
-class AndroidSurfaceOutputMsm72xx : public AndroidSurfaceOutput
+// decoder buffers tunneled through the platform private pointer
+#include "QComVideoBuffer.h"
+#include "QComFrameWorker.h"
+#include "QComFrameClock.h"
+#include "QComFrameRing.h"
+#include "QComVideoStats.h"
+
+class AndroidSurfaceOutputMsm72xx : public AndroidSurfaceOutput,
+                                    public QComFrameWorker::Handler
 {
 public:
     AndroidSurfaceOutputMsm72xx();
@@ -61,27 +41,79 @@ public:
     virtual bool initCheck();
     virtual PVMFStatus writeFrameBuf(uint8* aData, uint32 aDataLen, const PvmiMediaXferHeader& data_header_info);
     virtual void postLastFrame();
+    virtual void closeFrameBuf();
+
+    virtual PVMFCommandId writeAsync(uint8 format_type, int32 format_index, uint8* data, uint32 data_len,
+            const PvmiMediaXferHeader& data_header_info, OsclAny* aContext);
+
+    // the worker reads the frame geometry, so it is changed only while
+    // the worker is idle
+    virtual void setParametersSync(PvmiMIOSession aSession, PvmiKvp* aParameters,
+            int num_elements, PvmiKvp * & aRet_kvp);
+
+    // the worker's frames complete before the command, not after it
+    virtual PVMFCommandId Stop(const OsclAny* aContext = NULL);
+    virtual PVMFCommandId Reset(const OsclAny* aContext = NULL);
 
     OSCL_IMPORT_REF ~AndroidSurfaceOutputMsm72xx();
 
+protected:
+    virtual void Run();
+
 private:
-    bool getPmemFd(OsclAny *private_data_ptr, uint32 *pmemFD);
-    bool getOffset(OsclAny *private_data_ptr, uint32 *offset);
     void convertFrame(void* src, void* dst, size_t len);
+    void writeSoftwareFrame(uint8* aData, uint32 aDataLen, uint32 aTimestamp);
+
+    // software frames are converted and posted by mFrameWorker, and their
+    // writes complete on the PV thread once it is done with them, from
+    // mFrameDone or Run(); writes passed to the base class wait for the
+    // worker, so that writes complete in order
+    virtual void processFrame(const QComFrameWorker::Job& job);
+    virtual void frameCompleted();
+    void completeFrames();
+
+    // kept pending for the worker to complete from its own thread once a
+    // frame is done, which a timer object can't be
+    class FrameDoneAO : public OsclActiveObject
+    {
+    public:
+        FrameDoneAO(AndroidSurfaceOutputMsm72xx* aOwner);
+        ~FrameDoneAO();
+        void Signal();
+    private:
+        void Arm();
+        virtual void Run();
+        virtual void DoCancel();
+        AndroidSurfaceOutputMsm72xx* iOwner;
+        Mutex                       iLock;
+        bool                        iArmed;     // under iLock
+    };
+    friend class FrameDoneAO;
+
+    QComFrameWorker*            mFrameWorker;
+    FrameDoneAO*                mFrameDone;
+    bool                        mForwardedWrite; // base class write not completed yet
+    Mutex                       mFrameLock;     // mFrameBufferIndex, frame buffer heap
+
+    // software frames already past their time are dropped unconverted
+    bool                        mSkipLateFrames;
+    QComFrameClock              mFrameClock;
+
+    // software frame ring, as deep as the display needs it; its heap is
+    // kept for the next stream
+    bool allocateFrameHeap(size_t slots);
+    QComFrameRing               mFrameRing;
+    size_t                      mFrameSize;
+    sp<MemoryHeapPmem>          mFrameHeap;
 
     // hardware frame buffer support
     bool                        mHardwareCodec;
     uint32                      mOffset;
+    PmemHeapRegistry            mHeapRegistry;
 
-    //Average FPS profiling
-    virtual void AverageFPSProfiling();
-    virtual void AverageFPSPrint();
+    // telemetry, logged as each stream ends if statistics are on
+    QComVideoStats              mVideoStats;
     bool                        mStatistics;
-    int                         mLastFrame;
-    float                       mFpsSum;
-    unsigned long               iFrameNumber;
-    unsigned long               mNumFpsSamples;
-    nsecs_t                     mLastFpsTime;
 };
 
 #endif // ANDROID_SURFACE_OUTPUT_MSM72XX_H_INCLUDED
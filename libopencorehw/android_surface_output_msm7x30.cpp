@@ -22,12 +22,11 @@
 #include <utils/Log.h>
 
 #include "android_surface_output_msm7x30.h"
+#include "QComDisplay.h"
 #include <media/PVPlayer.h>
 
 #include <cutils/properties.h>
 
-#define PLATFORM_PRIVATE_PMEM 1
-
 #if HAVE_ANDROID_OS
 #include <linux/android_pmem.h>
 #endif
@@ -37,28 +36,49 @@ using namespace android;
 static const char* pmem_adsp = "/dev/pmem_adsp";
 static const char* pmem = "/dev/pmem";
 
+// deepest the software frame ring grows when the display holds on to frames
+static const size_t kMaxFrameBuffers = 4;
+
 OSCL_EXPORT_REF AndroidSurfaceOutputMsm7x30::AndroidSurfaceOutputMsm7x30() :
-    AndroidSurfaceOutput()
+    AndroidSurfaceOutput(),
+    mFrameRing(kBufferCount, kMaxFrameBuffers, getDisplayRefreshPeriod()),
+    mVideoStats("AndroidSurfaceOutputMsm7x30")
 {
     mHardwareCodec = false;
+    mFrameSize = 0;
     mFd = 0;
     mUseOverlay = false;
+    mOverlayWidth = 0;
+    mOverlayHeight = 0;
+    mOverlayFormat = 0;
 
     //Statistics profiling
     char value[PROPERTY_VALUE_MAX];
     mStatistics = false;
-    mLastFrame = 0;
-    mLastFpsTime = 0;
-    mFpsSum = 0;
-    iFrameNumber = 0;
-    mNumFpsSamples = 0;
     property_get("persist.debug.pv.statistics", value, "0");
     if(atoi(value)) mStatistics = true;
+
+    // convert software frames while the decoder works on the next one
+    mFrameWorker = NULL;
+    mFrameDone = NULL;
+    mForwardedWrite = false;
+    property_get("persist.debug.pv.pipeline", value, "1");
+    if (atoi(value)) {
+        mFrameDone = new FrameDoneAO(this);
+        mFrameWorker = new QComFrameWorker(this, kBufferCount);
+    }
+
+    // drop software frames that are too late to be worth converting
+    property_get("persist.debug.pv.skiplate", value, "1");
+    mSkipLateFrames = atoi(value) != 0;
 }
 
 OSCL_EXPORT_REF AndroidSurfaceOutputMsm7x30::~AndroidSurfaceOutputMsm7x30()
 {
-    if(mStatistics) AverageFPSPrint();
+    delete mFrameWorker;
+    delete mFrameDone;
+    closeOverlay();
+    if(mStatistics) mVideoStats.log();
 }
 
 // create a frame buffer for software codecs
@@ -69,12 +89,18 @@ OSCL_EXPORT_REF bool AndroidSurfaceOutputMsm7x30::initCheck()
     if (((iVideoParameterFlags & VIDEO_SUBFORMAT_VALID) == 0) || !checkVideoParameterFlags())
         return mInitialized;
 
+    nsecs_t setupStart = systemTime();
+
     // release resources if previously initialized
     closeFrameBuf();
 
     // reset flags in case display format changes in the middle of a stream
     resetVideoParameterFlags();
 
+    // start the telemetry over for the new stream
+    if(mStatistics) mVideoStats.log();
+    mVideoStats.reset();
+
     // copy parameters in case we need to adjust them
     int displayWidth = iVideoDisplayWidth;
     int displayHeight = iVideoDisplayHeight;
@@ -87,51 +113,42 @@ OSCL_EXPORT_REF bool AndroidSurfaceOutputMsm7x30::initCheck()
     if ((iVideoSubFormat == PVMF_MIME_YUV420_SEMIPLANAR_YVU) || (iVideoSubFormat == PVMF_MIME_YUV420_SEMIPLANAR)) {
         LOGV("using hardware codec");
         mHardwareCodec = true;
+
+        // the decoder brings its own buffers, so free the frame heap and the
+        // overlay showing it that a software stream may have kept
+        if (mFrameHeap != 0) {
+            closeOverlay();
+            Mutex::Autolock lock(mFrameLock);
+            mFrameHeap.clear();
+            mHeapPmem.clear();
+            mBufferHeap = ISurface::BufferHeap();
+        }
         mUseOverlay = true;
-        sp<OverlayRef> ref = mSurface->createOverlay(frameWidth, frameHeight, OVERLAY_FORMAT_YCrCb_420_SP);
-        mOverlay = new Overlay(ref);
-        if (mOverlay  == 0){
+        if (!openOverlay(frameWidth, frameHeight, OVERLAY_FORMAT_YCrCb_420_SP)){
              mUseOverlay = false;
              LOGE("Create overlay failed\n");
              return false;
         }else {
-             LOGV("Create overlay successful\n");
              mFd = 0;
              mOverlay->setCrop(0,0,displayWidth,displayHeight);
         }
 
     } else {
         LOGV("using software codec");
+        mHardwareCodec = false;
 
         // YUV420 frames are 1.5 bytes/pixel
         frameSize = (frameWidth * frameHeight * 3) / 2;
+        mFrameSize = frameSize;
 
-        // create frame buffer heap
-        sp<MemoryHeapBase> master = new MemoryHeapBase(pmem_adsp, frameSize * kBufferCount);
-        if (master->heapID() < 0) {
-            LOGE("Error creating frame buffer heap");
-            return false;
-        }
-        master->setDevice(pmem);
-        mHeapPmem = new MemoryHeapPmem(master, 0);
-        mHeapPmem->slap();
-        mBufferHeap = ISurface::BufferHeap(displayWidth, displayHeight,
-                frameWidth, frameHeight, PIXEL_FORMAT_YCbCr_420_SP, mHeapPmem);
-        master.clear();
-        //mSurface->registerBuffers(mBufferHeap);
-        // create frame buffers
-        for (int i = 0; i < kBufferCount; i++) {
-            mFrameBuffers[i] = i * frameSize;
-        }
+        // create frame buffer heap, as deep as the last stream needed it
+        if (!allocateFrameHeap(mFrameRing.wantedSlots())) return false;
         mUseOverlay = true;
-        sp<OverlayRef> ref = mSurface->createOverlay(frameWidth, frameHeight, OVERLAY_FORMAT_YCbCr_420_SP);
-        mOverlay = new Overlay(ref);
-        if (mOverlay  == 0){
+        if (!openOverlay(frameWidth, frameHeight, OVERLAY_FORMAT_YCbCr_420_SP)){
              mUseOverlay = false;
              LOGE("Create overlay failed\n");
              return false;
         }else {
-             LOGV("Create overlay successful\n");
              mFd = mHeapPmem->heapID();
              LOGV("Calling setFd \n");
              mOverlay->setFd(mFd);
@@ -141,16 +158,57 @@ OSCL_EXPORT_REF bool AndroidSurfaceOutputMsm7x30::initCheck()
         LOGV("video = %d x %d", displayWidth, displayHeight);
         LOGV("frame = %d x %d", frameWidth, frameHeight);
         LOGV("frame #bytes = %d", frameSize);
-
-        mFrameBufferIndex = 0;
     }
 
     mInitialized = true;
+    mVideoStats.setupDone(systemTime() - setupStart);
     LOGV("sendEvent(MEDIA_SET_VIDEO_SIZE, %d, %d)", iVideoDisplayWidth, iVideoDisplayHeight);
     mPvPlayer->sendEvent(MEDIA_SET_VIDEO_SIZE, iVideoDisplayWidth, iVideoDisplayHeight);
     return mInitialized;
 }
 
+bool AndroidSurfaceOutputMsm7x30::allocateFrameHeap(size_t slots)
+{
+    // reuse the heap of an earlier stream or depth when the frames fit in it
+    // with less than a frame to spare, as contiguous memory is scarce
+    size_t size = mFrameSize * slots;
+    sp<MemoryHeapPmem> heap = mFrameHeap;
+    if (heap == 0 || heap->getSize() < size || heap->getSize() - size >= mFrameSize) {
+        // between streams only a kept overlay shows the old heap, so free
+        // both first
+        if (!mInitialized) {
+            closeOverlay();
+            heap.clear();
+            mFrameHeap.clear();
+            mBufferHeap = ISurface::BufferHeap();
+        }
+
+        sp<MemoryHeapBase> master = new MemoryHeapBase(pmem_adsp, size);
+        if (master->heapID() < 0) {
+            LOGE("Error creating frame buffer heap");
+            return false;
+        }
+        master->setDevice(pmem);
+        heap = new MemoryHeapPmem(master, 0);
+        heap->slap();
+        master.clear();
+        mVideoStats.heapAllocated();
+        LOGV("frame buffer heap of %d frames", slots);
+    } else {
+        LOGV("reusing frame buffer heap for %d frames", slots);
+    }
+
+    Mutex::Autolock lock(mFrameLock);
+    mFrameHeap = heap;
+    mHeapPmem = heap;
+    mBufferHeap = ISurface::BufferHeap(iVideoDisplayWidth, iVideoDisplayHeight,
+            iVideoWidth, iVideoHeight, PIXEL_FORMAT_YCbCr_420_SP, mHeapPmem);
+    mFrameRing.reset(slots);
+    mFrameBufferIndex = mFrameRing.current();
+    mVideoStats.heapRegistered();
+    return true;
+}
+
 PVMFStatus AndroidSurfaceOutputMsm7x30::writeFrameBuf(uint8* aData, uint32 aDataLen, const PvmiMediaXferHeader& data_header_info)
 {
     // OK to drop frames if no surface
@@ -158,54 +216,224 @@ PVMFStatus AndroidSurfaceOutputMsm7x30::writeFrameBuf(uint8* aData, uint32 aData
 
     if (mHardwareCodec) {
        if (mUseOverlay) {
-          if (!mFd){
+           QComVideoBuffer buffer;
+           if (!buffer.parse(data_header_info.private_data_ptr)) {
+               LOGE("Error getting pmem buffer from private_data_ptr");
+               return PVMFFailure;
+           }
+           // hand the overlay the decoder heap the first time, and again
+           // whenever the decoder switches heaps
+           bool changed;
+           sp<MemoryHeapPmem> heap = mHeapRegistry.heapFor(buffer, &changed);
+           if (changed) {
                LOGV("writeFrameBuf:: using hardware codec \n");
-               uint32 fd;
-               if (!getPmemFd(data_header_info.private_data_ptr, &fd)) {
-                   LOGE("Error getting pmem heap from private_data_ptr");
-                   return PVMFFailure;
-               }
-               sp<MemoryHeapBase> master = (MemoryHeapBase *) fd;
-               master->setDevice(pmem);
-               mHeapPmem = new MemoryHeapPmem(master, 0);
-               mHeapPmem->slap();
-               master.clear();
+               mHeapPmem = heap;
                mFd = mHeapPmem->heapID();
                LOGV("Calling setFd \n");
                mOverlay->setFd(mFd);
+               mVideoStats.heapRegistered();
            }
-           // get pmem offset and post to SurfaceFlinger
-           if (!getOffset(data_header_info.private_data_ptr, &mOffset)) {
-               LOGE("Error getting pmem offset from private_data_ptr");
-               return PVMFFailure;
-           }
+           mOffset = buffer.offset;
            LOGV(" mOverlay queueBuffer \n");
+           nsecs_t start = systemTime();
            mOverlay->queueBuffer((void *)mOffset);
+           nsecs_t now = systemTime();
+           mVideoStats.postDone(now - start);
+           mVideoStats.frameShown(now);
        }
     }else {
         LOGV("writeFrameBuf :: software codec \n");
         // software codec
-        if (++mFrameBufferIndex == kBufferCount) mFrameBufferIndex = 0;
-        convertFrame(aData, static_cast<uint8*>(mBufferHeap.heap->base()) + mFrameBuffers[mFrameBufferIndex], aDataLen);
-        // post to SurfaceFlinger
-        //mSurface->postBuffer(mFrameBuffers[mFrameBufferIndex]);
-        if (mUseOverlay){
-            LOGV(" mOverlay queueBuffer \n");
-            mOverlay->queueBuffer((void*)mFrameBuffers[mFrameBufferIndex]);
+        writeSoftwareFrame(aData, aDataLen, data_header_info.timestamp);
+    }
+
+    return PVMFSuccess;
+}
+
+void AndroidSurfaceOutputMsm7x30::writeSoftwareFrame(uint8* aData, uint32 aDataLen, uint32 aTimestamp)
+{
+    // late frames are consumed without being shown
+    if (mSkipLateFrames) {
+        nsecs_t lateness;
+        bool resynced;
+        bool late = mFrameClock.isLate(aTimestamp, systemTime(), &lateness, &resynced);
+        mVideoStats.frameArrived(lateness, resynced);
+        if (late) {
+            mVideoStats.frameLate();
+            return;
         }
     }
 
-    //Average FPS profiling
-    if(mStatistics) AverageFPSProfiling();
+    // follow the ring to the depth it wants, unless there is no memory for it;
+    // the overlay shows the old heap until it is given the new one
+    size_t slots = mFrameRing.wantedSlots();
+    if (slots != mFrameRing.slots()) {
+        sp<MemoryHeapPmem> oldHeap = mFrameHeap;
+        if (!allocateFrameHeap(slots)) {
+            mFrameRing.capDepth();
+        } else if (mUseOverlay) {
+            Mutex::Autolock lock(mFrameLock);
+            mFd = mHeapPmem->heapID();
+            mOverlay->setFd(mFd);
+        }
+        oldHeap.clear();
+    }
 
-    return PVMFSuccess;
+    // wait for the overlay to be done with the slot before writing it
+    bool stalled;
+    int index = mFrameRing.acquire(&stalled);
+    if (stalled) mVideoStats.stalled();
+
+    nsecs_t start = systemTime();
+    convertFrame(aData, static_cast<uint8*>(mBufferHeap.heap->base()) + index * mFrameSize, aDataLen);
+    nsecs_t converted = systemTime();
+    mVideoStats.conversionDone(converted - start);
+    // post to SurfaceFlinger
+    //mSurface->postBuffer(mFrameBuffers[index]);
+    if (mUseOverlay){
+        LOGV(" mOverlay queueBuffer \n");
+        mOverlay->queueBuffer((void*)(index * mFrameSize));
+        mFrameRing.posted(index);
+        nsecs_t now = systemTime();
+        mVideoStats.postDone(now - converted);
+        mVideoStats.frameShown(now);
+    }
+
+    Mutex::Autolock lock(mFrameLock);
+    mFrameBufferIndex = index;
+}
+
+PVMFCommandId AndroidSurfaceOutputMsm7x30::writeAsync(uint8 aFormatType, int32 aFormatIndex, uint8* aData, uint32 aDataLen,
+        const PvmiMediaXferHeader& data_header_info, OsclAny* aContext)
+{
+    if (mFrameWorker == NULL || mHardwareCodec || !mInitialized || mSurface == 0 ||
+            iState != STATE_STARTED || aFormatType != PVMI_MEDIAXFER_FMT_TYPE_DATA ||
+            aFormatIndex != PVMI_MEDIAXFER_FMT_INDEX_DATA || mForwardedWrite) {
+        // the frames before this write complete first, at the top of Run(),
+        // and the frames after it go to the base class too until it has
+        // completed this one
+        if (mFrameWorker) mFrameWorker->drain();
+        mForwardedWrite = true;
+        return AndroidSurfaceOutput::writeAsync(aFormatType, aFormatIndex, aData, aDataLen,
+                data_header_info, aContext);
+    }
+
+    // the decoder keeps aData until the write completes, in Run()
+    QComFrameWorker::Job job;
+    job.data = aData;
+    job.size = aDataLen;
+    job.id = iCommandCounter++;
+    job.timeMs = data_header_info.timestamp;
+    job.context = aContext;
+    mFrameWorker->queue(job);
+    return job.id;
+}
+
+void AndroidSurfaceOutputMsm7x30::Run()
+{
+    // the worker's frames were written before anything the base class has
+    // queued, see writeAsync()
+    completeFrames();
+    AndroidSurfaceOutput::Run();
+    mForwardedWrite = false;
+}
+
+// complete the writes of the frames the worker is done with
+void AndroidSurfaceOutputMsm7x30::completeFrames()
+{
+    if (mFrameWorker == NULL) return;
+    QComFrameWorker::Job job;
+    while (mFrameWorker->takeCompleted(&job)) {
+        if (iPeer) iPeer->writeComplete(PVMFSuccess, job.id, (OsclAny*)job.context);
+    }
+}
+
+void AndroidSurfaceOutputMsm7x30::setParametersSync(PvmiMIOSession aSession, PvmiKvp* aParameters,
+        int num_elements, PvmiKvp * & aRet_kvp)
+{
+    // frames queued before the change were decoded for the old geometry,
+    // and are converted into the heap sized for it
+    if (mFrameWorker) mFrameWorker->drain();
+    AndroidSurfaceOutput::setParametersSync(aSession, aParameters, num_elements, aRet_kvp);
+}
+
+PVMFCommandId AndroidSurfaceOutputMsm7x30::Stop(const OsclAny* aContext)
+{
+    if (mFrameWorker) mFrameWorker->drain();
+    completeFrames();
+    return AndroidSurfaceOutput::Stop(aContext);
+}
+
+PVMFCommandId AndroidSurfaceOutputMsm7x30::Reset(const OsclAny* aContext)
+{
+    if (mFrameWorker) mFrameWorker->drain();
+    completeFrames();
+    return AndroidSurfaceOutput::Reset(aContext);
+}
+
+void AndroidSurfaceOutputMsm7x30::processFrame(const QComFrameWorker::Job& job)
+{
+    writeSoftwareFrame((uint8*)job.data, job.size, job.timeMs);
+}
+
+void AndroidSurfaceOutputMsm7x30::frameCompleted()
+{
+    mFrameDone->Signal();
+}
+
+AndroidSurfaceOutputMsm7x30::FrameDoneAO::FrameDoneAO(AndroidSurfaceOutputMsm7x30* aOwner) :
+    OsclActiveObject(OsclActiveObject::EPriorityNominal, "VideoMioFrameDone"),
+    iOwner(aOwner),
+    iArmed(false)
+{
+    AddToScheduler();
+    Arm();
+}
+
+AndroidSurfaceOutputMsm7x30::FrameDoneAO::~FrameDoneAO()
+{
+    Cancel();
+    RemoveFromScheduler();
+}
+
+// PV thread only
+void AndroidSurfaceOutputMsm7x30::FrameDoneAO::Arm()
+{
+    Mutex::Autolock lock(iLock);
+    iArmed = true;
+    PendForExec();
+}
+
+// any thread
+void AndroidSurfaceOutputMsm7x30::FrameDoneAO::Signal()
+{
+    Mutex::Autolock lock(iLock);
+    if (!iArmed) return;
+    iArmed = false;
+    PendComplete(OSCL_REQUEST_ERR_NONE);
+}
+
+void AndroidSurfaceOutputMsm7x30::FrameDoneAO::Run()
+{
+    // re-arm first, so that a frame finished meanwhile runs this again
+    Arm();
+    iOwner->completeFrames();
+}
+
+void AndroidSurfaceOutputMsm7x30::FrameDoneAO::DoCancel()
+{
+    Mutex::Autolock lock(iLock);
+    if (!iArmed) return;
+    iArmed = false;
+    PendComplete(OSCL_REQUEST_ERR_CANCEL);
 }
 
 // post the last video frame to refresh screen after pause
 void AndroidSurfaceOutputMsm7x30::postLastFrame()
 {
     LOGV("postLastFrame\n");
-    // ignore if no surface or heap
+    // ignore if no surface or heap; the worker may be replacing the heap
+    Mutex::Autolock lock(mFrameLock);
     if ((mSurface == NULL) || (mBufferHeap.heap == NULL)) return;
 
     if(mHardwareCodec) {
@@ -213,75 +441,56 @@ void AndroidSurfaceOutputMsm7x30::postLastFrame()
            mOverlay->queueBuffer((void *)mOffset);
      }else {
         if (mUseOverlay)
-            mOverlay->queueBuffer((void*)mFrameBuffers[mFrameBufferIndex]);
+            mOverlay->queueBuffer((void*)(mFrameBufferIndex * mFrameSize));
     }
 }
 
 void AndroidSurfaceOutputMsm7x30::closeFrameBuf()
 {
+    if (mFrameWorker) mFrameWorker->drain();
+    mFrameClock.reset();
     if (!mInitialized) return;
     LOGV("closeFrameBuf\n");
     mInitialized = false;
-    if (mUseOverlay) {
-         mOverlay->destroy();
-    }
+    // the decoder's heaps go away with the decoder, so its overlay must go
+    // too; a software stream's overlay and frame heap stay for the next one
+    if (mHardwareCodec) closeOverlay();
     // free heaps
     LOGV("free mHeapPmem");
     mHeapPmem.clear();
+    mHeapRegistry.clear();
 }
 
-
-bool AndroidSurfaceOutputMsm7x30::getPmemFd(OsclAny *private_data_ptr, uint32 *pmemFD)
+bool AndroidSurfaceOutputMsm7x30::openOverlay(int width, int height, int format)
 {
-    PLATFORM_PRIVATE_LIST *listPtr = NULL;
-    PLATFORM_PRIVATE_PMEM_INFO *pmemInfoPtr = NULL;
-    bool returnType = false;
-    LOGV("in getPmemfd - privatedataptr=%p\n",private_data_ptr);
-    listPtr = (PLATFORM_PRIVATE_LIST*) private_data_ptr;
-
-    for (uint32 i=0;i<listPtr->nEntries;i++)
-    {
-        if(listPtr->entryList->type == PLATFORM_PRIVATE_PMEM)
-        {
-            LOGV("in getPmemfd - entry type = %d\n",listPtr->entryList->type);
-          pmemInfoPtr = (PLATFORM_PRIVATE_PMEM_INFO*) (listPtr->entryList->entry);
-          returnType = true;
-          if(pmemInfoPtr){
-            *pmemFD = pmemInfoPtr->pmem_fd;
-            LOGV("in getPmemfd - pmemFD = %d\n",*pmemFD);
-          }
-          break;
-        }
+    if ((mOverlay != 0) && (mOverlaySurface == mSurface) && (mOverlayWidth == width) &&
+            (mOverlayHeight == height) && (mOverlayFormat == format)) {
+        LOGV("Reusing overlay\n");
+        return true;
     }
-    return returnType;
+    closeOverlay();
+
+    sp<OverlayRef> ref = mSurface->createOverlay(width, height, format);
+    if (ref == 0) return false;
+    mOverlay = new Overlay(ref);
+    LOGV("Create overlay successful\n");
+    mOverlaySurface = mSurface;
+    mOverlayWidth = width;
+    mOverlayHeight = height;
+    mOverlayFormat = format;
+    return true;
 }
 
-bool AndroidSurfaceOutputMsm7x30::getOffset(OsclAny *private_data_ptr, uint32 *offset)
+void AndroidSurfaceOutputMsm7x30::closeOverlay()
 {
-    PLATFORM_PRIVATE_LIST *listPtr = NULL;
-    PLATFORM_PRIVATE_PMEM_INFO *pmemInfoPtr = NULL;
-    bool returnType = false;
-
-    listPtr = (PLATFORM_PRIVATE_LIST*) private_data_ptr;
-    LOGV("in getOffset: listPtr = %p\n",listPtr);
-    for (uint32 i=0;i<listPtr->nEntries;i++)
-    {
-        if(listPtr->entryList->type == PLATFORM_PRIVATE_PMEM)
-        {
-            LOGV(" in getOffset: entrytype = %d\n",listPtr->entryList->type);
-
-          pmemInfoPtr = (PLATFORM_PRIVATE_PMEM_INFO*) (listPtr->entryList->entry);
-          returnType = true;
-          if(pmemInfoPtr){
-            *offset = pmemInfoPtr->offset;
-            LOGV("in getOffset: offset = %d\n",*offset);
-          }
-          break;
-        }
+    if (mOverlay != 0) {
+        mOverlay->destroy();
+        mOverlay.clear();
     }
-    return returnType;
+    mOverlaySurface.clear();
 }
 
+
 static inline void* byteOffset(void* p, size_t offset) { return (void*)((uint8_t*)p + offset); }
 
 void AndroidSurfaceOutputMsm7x30::convertFrame(void* src, void* dst, size_t len)
@@ -310,26 +519,3 @@ extern "C" AndroidSurfaceOutputMsm7x30* createVideoMio()
 {
     return new AndroidSurfaceOutputMsm7x30();
 }
-
-void AndroidSurfaceOutputMsm7x30::AverageFPSProfiling()
-{
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-    nsecs_t diff = now - mLastFpsTime;
-    iFrameNumber++;
-
-    if (diff > ms2ns(250)) {
-        float mFps =  ((iFrameNumber - mLastFrame) * float(s2ns(1))) / diff;
-        LOGE("AndroidSurfaceOutputMsm7x30: Frames Per Second: %.4f", mFps);
-        mFpsSum += mFps;
-        mNumFpsSamples++;
-        mLastFpsTime = now;
-        mLastFrame = iFrameNumber;
-    }
-}
-
-void AndroidSurfaceOutputMsm7x30::AverageFPSPrint()
-{
-    LOGE("==========================================================");
-    LOGE("AndroidSurfaceOutputMsm7x30: Average Frames Per Second: %.4f", mFpsSum / mNumFpsSamples);
-    LOGE("==========================================================");
-}
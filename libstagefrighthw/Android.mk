@@ -5,18 +5,21 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     stagefright_surface_output_msm72xx.cpp \
-    QComHardwareRenderer.cpp
+    QComHardwareRenderer.cpp \
+    QComPlanarRenderer.cpp
 
 LOCAL_CFLAGS := $(PV_CFLAGS_MINUS_VISIBILITY)
 
 LOCAL_C_INCLUDES:= \
-        $(TOP)/external/opencore/extern_libs_v2/khronos/openmax/include
+        $(TOP)/external/opencore/extern_libs_v2/khronos/openmax/include \
+        $(LOCAL_PATH)/../libvideohw
 
 LOCAL_SHARED_LIBRARIES :=       \
         libbinder               \
         libutils                \
         libcutils               \
         libui                   \
+        libvideohw              \
 
 LOCAL_MODULE := libstagefrighthw
 
@@ -15,101 +15,154 @@
  */
 
 #include "QComHardwareRenderer.h"
+#include "QComDisplay.h"
 
-#include <binder/MemoryHeapBase.h>
 #include <binder/MemoryHeapPmem.h>
 #include <media/stagefright/MediaDebug.h>
 #include <ui/ISurface.h>
+#include <ui/Overlay.h>
 
 namespace android {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-typedef struct PLATFORM_PRIVATE_ENTRY
-{
-    /* Entry type */
-    uint32_t type;
-
-    /* Pointer to platform specific entry */
-    void *entry;
-
-} PLATFORM_PRIVATE_ENTRY;
-
-typedef struct PLATFORM_PRIVATE_LIST
-{
-    /* Number of entries */
-    uint32_t nEntries;
-
-    /* Pointer to array of platform specific entries *
-     * Contiguous block of PLATFORM_PRIVATE_ENTRY elements */
-    PLATFORM_PRIVATE_ENTRY *entryList;
-
-} PLATFORM_PRIVATE_LIST;
-
-// data structures for tunneling buffers
-typedef struct PLATFORM_PRIVATE_PMEM_INFO
-{
-    /* pmem file descriptor */
-    uint32_t pmem_fd;
-    uint32_t offset;
-
-} PLATFORM_PRIVATE_PMEM_INFO;
-
-#define PLATFORM_PRIVATE_PMEM   1
-
 QComHardwareRenderer::QComHardwareRenderer(
         const sp<ISurface> &surface,
         size_t displayWidth, size_t displayHeight,
-        size_t decodedWidth, size_t decodedHeight)
-    : mISurface(surface),
-      mDisplayWidth(displayWidth),
+        size_t decodedWidth, size_t decodedHeight,
+        size_t queueDepth)
+    : mDisplayWidth(displayWidth),
       mDisplayHeight(displayHeight),
       mDecodedWidth(decodedWidth),
       mDecodedHeight(decodedHeight),
-      mFrameSize((mDecodedWidth * mDecodedHeight * 3) / 2) {
+      mFrameSize((mDecodedWidth * mDecodedHeight * 3) / 2),
+      mVideoStats("QComHardwareRenderer"),
+      mISurface(surface),
+      mQueueDepth(queueDepth),
+      mPeriod(getDisplayRefreshPeriod()),
+      mTickBase(0),
+      mFrameInterval(0),
+      mLastDue(0),
+      mLastPost(0),
+      mDone(false),
+      mThreadStarted(false) {
     CHECK(mISurface.get() != NULL);
     CHECK(mDecodedWidth > 0);
     CHECK(mDecodedHeight > 0);
+    CHECK(mQueueDepth > 0);
+
+    mShown.offset = 0;
+    mShown.due = 0;
+    mShown.owned = false;
+
+    initOverlay();
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    mThreadStarted = pthread_create(&mThread, &attr, ThreadWrapper, this) == 0;
+    pthread_attr_destroy(&attr);
+    if (!mThreadStarted) {
+        LOGW("couldn't start presentation thread, posting frames as they come");
+    }
 }
 
 QComHardwareRenderer::~QComHardwareRenderer() {
-    mISurface->unregisterBuffers();
+    {
+        Mutex::Autolock autoLock(mLock);
+        mDone = true;
+        mCondition.signal();
+    }
+
+    if (mThreadStarted) {
+        void *dummy;
+        pthread_join(mThread, &dummy);
+    }
+
+    if (mOverlay.get() != NULL) {
+        mOverlay->destroy();
+    } else {
+        mISurface->unregisterBuffers();
+    }
 }
 
 void QComHardwareRenderer::render(
         const void *data, size_t size, void *platformPrivate) {
-    size_t offset;
-    if (!getOffset(platformPrivate, &offset)) {
+    QComVideoBuffer buffer;
+    if (!buffer.parse(platformPrivate)) {
         LOGE("couldn't get offset");
         return;
     }
 
-    mISurface->postBuffer(offset);
+    bool changed;
+    sp<MemoryHeapPmem> heap = mHeaps.heapFor(buffer, &changed);
+
+    // The player calls us when the frame is due, and drops late frames
+    // itself.  The decoder gets the buffer back once we return, so it is
+    // posted right away rather than on the next refresh.
+    queueBuffer(heap, buffer.offset, systemTime(), false);
 }
 
-bool QComHardwareRenderer::getOffset(void *platformPrivate, size_t *offset) {
-    *offset = 0;
+QComHardwareRenderer::PresentationStats
+QComHardwareRenderer::getPresentationStats() {
+    QComVideoStats::Snapshot snapshot;
+    mVideoStats.getSnapshot(&snapshot);
 
-    PLATFORM_PRIVATE_LIST *list = (PLATFORM_PRIVATE_LIST *)platformPrivate;
-    for (uint32_t i = 0; i < list->nEntries; ++i) {
-        if (list->entryList[i].type != PLATFORM_PRIVATE_PMEM) {
-            continue;
-        }
+    PresentationStats stats;
+    stats.presented = snapshot.shown;
+    stats.dropped = snapshot.dropped;
+    stats.repeated = snapshot.repeated;
+    return stats;
+}
+
+void QComHardwareRenderer::queueBuffer(
+        const sp<MemoryHeapPmem> &heap, size_t offset, nsecs_t due,
+        bool owned) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mLastDue != 0 && due > mLastDue && due - mLastDue < s2ns(1)) {
+        nsecs_t interval = due - mLastDue;
+        mFrameInterval = mFrameInterval == 0 ?
+            interval : (mFrameInterval * 7 + interval) / 8;
+    }
+    mLastDue = due;
 
-        PLATFORM_PRIVATE_PMEM_INFO *info =
-            (PLATFORM_PRIVATE_PMEM_INFO *)list->entryList[i].entry;
+    Frame frame;
+    frame.heap = heap;
+    frame.offset = offset;
+    frame.due = due;
+    frame.owned = owned;
 
-        if (info != NULL) {
-            if (mMemoryHeap.get() == NULL) {
-                publishBuffers(info->pmem_fd);
-            }
+    if (!owned || !mThreadStarted) {
+        presentLocked(frame, due);
+        return;
+    }
 
-            if (mMemoryHeap.get() == NULL) {
-                return false;
-            }
+    if (mQueue.size() >= mQueueDepth) {
+        mQueue.removeAt(0);
+        mVideoStats.framesDropped(1);
+    }
+
+    // Keep the queue in due order.
+    size_t i = mQueue.size();
+    while (i > 0 && mQueue[i - 1].due > due) {
+        --i;
+    }
+    mQueue.insertAt(frame, i);
+
+    mCondition.signal();
+}
 
-            *offset = info->offset;
+bool QComHardwareRenderer::isBufferBusy(
+        const sp<MemoryHeapPmem> &heap, size_t offset) {
+    Mutex::Autolock autoLock(mLock);
 
+    if (mShown.heap == heap && mShown.offset == offset) {
+        return true;
+    }
+
+    for (size_t i = 0; i < mQueue.size(); ++i) {
+        if (mQueue[i].heap == heap && mQueue[i].offset == offset) {
             return true;
         }
     }
@@ -117,15 +170,149 @@ bool QComHardwareRenderer::getOffset(void *platformPrivate, size_t *offset) {
     return false;
 }
 
-void QComHardwareRenderer::publishBuffers(uint32_t pmem_fd) {
-    sp<MemoryHeapBase> master =
-        reinterpret_cast<MemoryHeapBase *>(pmem_fd);
+// static
+void *QComHardwareRenderer::ThreadWrapper(void *me) {
+    static_cast<QComHardwareRenderer *>(me)->threadEntry();
+    return NULL;
+}
+
+void QComHardwareRenderer::threadEntry() {
+    Mutex::Autolock autoLock(mLock);
+
+    for (;;) {
+        while (mQueue.isEmpty() && !mDone) {
+            mCondition.wait(mLock);
+        }
 
-    master->setDevice("/dev/pmem");
+        if (mDone) {
+            break;
+        }
 
-    uint32_t heap_flags = master->getFlags() & MemoryHeapBase::NO_CACHING;
-    mMemoryHeap = new MemoryHeapPmem(master, heap_flags);
-    mMemoryHeap->slap();
+        // The first refresh at or after the oldest frame is due.  There is
+        // no vsync signal to lock to, so the grid's phase is that of the
+        // first frame; its period is the display's.
+        nsecs_t now = systemTime();
+        nsecs_t due = mQueue[0].due > now ? mQueue[0].due : now;
+        if (mTickBase == 0) {
+            mTickBase = due;
+        }
+        nsecs_t tick = mTickBase +
+            (due - mTickBase + mPeriod - 1) / mPeriod * mPeriod;
+
+        // More frames may arrive meanwhile.
+        while (!mDone && (now = systemTime()) < tick) {
+            mCondition.waitRelative(mLock, tick - now);
+        }
+
+        if (mDone) {
+            break;
+        }
+
+        // Of the frames due by this refresh only the newest would be seen.
+        size_t count = 0;
+        while (count < mQueue.size() && mQueue[count].due <= tick) {
+            ++count;
+        }
+
+        if (count == 0) {
+            continue;
+        }
+
+        Frame frame = mQueue[count - 1];
+        mVideoStats.framesDropped(count - 1);
+        mQueue.removeItemsAt(0, count);
+
+        presentLocked(frame, tick);
+    }
+}
+
+// Called with mLock held; drops it while posting.
+void QComHardwareRenderer::presentLocked(const Frame &frame, nsecs_t tick) {
+    // A frame should stay up for as many refreshes as the frame interval
+    // covers; a longer stay means the next one was late.  Longer gaps than
+    // a second are pauses.
+    if (mLastPost != 0 && mFrameInterval > 0
+            && tick - mLastPost < s2ns(1)) {
+        nsecs_t shown = (tick - mLastPost) / mPeriod;
+        nsecs_t share = (mFrameInterval + mPeriod - 1) / mPeriod;
+        if (shown > share) {
+            mVideoStats.framesRepeated(shown - share);
+        }
+    }
+    mLastPost = tick;
+
+    // A buffer that goes back to the decoder is not ours to guard once
+    // render() returns.
+    if (frame.owned) {
+        mShown = frame;
+    } else {
+        mShown.heap.clear();
+    }
+
+    mLock.unlock();
+    if (frame.heap != mMemoryHeap) {
+        publishBuffers(frame.heap);
+    }
+    postBuffer(frame.offset);
+
+    // From render() to the display: the wait for the refresh and the post.
+    nsecs_t now = systemTime();
+    mVideoStats.postDone(now - frame.due);
+    mVideoStats.frameShown(now);
+    mLock.lock();
+}
+
+// The decoder's frames go straight to an MDP overlay when the surface can
+// have one, so SurfaceFlinger does not composite every frame.
+void QComHardwareRenderer::initOverlay() {
+    sp<OverlayRef> ref = mISurface->createOverlay(
+            mDecodedWidth, mDecodedHeight, OVERLAY_FORMAT_YCrCb_420_SP);
+    if (ref.get() == NULL) {
+        LOGV("no overlay, posting to SurfaceFlinger");
+        return;
+    }
+
+    mOverlay = new Overlay(ref);
+    if (mOverlay->getStatus() != NO_ERROR) {
+        LOGW("overlay not usable, posting to SurfaceFlinger");
+        closeOverlay();
+        return;
+    }
+
+    mOverlay->setCrop(0, 0, mDisplayWidth, mDisplayHeight);
+}
+
+void QComHardwareRenderer::closeOverlay() {
+    mOverlay->destroy();
+    mOverlay.clear();
+}
+
+void QComHardwareRenderer::postBuffer(size_t offset) {
+    if (mOverlay.get() != NULL) {
+        if (mOverlay->queueBuffer((overlay_buffer_t)offset) == OK) {
+            return;
+        }
+
+        LOGW("overlay queueBuffer failed, posting to SurfaceFlinger");
+        closeOverlay();
+        publishBuffers(mMemoryHeap);
+    }
+
+    mISurface->postBuffer(offset);
+}
+
+void QComHardwareRenderer::publishBuffers(const sp<MemoryHeapPmem> &heap) {
+    mMemoryHeap = heap;
+    mVideoStats.heapRegistered();
+
+    if (mOverlay.get() != NULL) {
+        if (mOverlay->setFd(mMemoryHeap->heapID()) == OK) {
+            return;
+        }
+
+        LOGW("overlay setFd failed, posting to SurfaceFlinger");
+        closeOverlay();
+    }
 
     ISurface::BufferHeap bufferHeap(
             mDisplayWidth, mDisplayHeight,
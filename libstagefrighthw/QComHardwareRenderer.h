@@ -20,33 +20,99 @@
 
 #include <media/stagefright/VideoRenderer.h>
 #include <utils/RefBase.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <pthread.h>
+
+#include "QComVideoBuffer.h"
+#include "QComVideoStats.h"
 
 namespace android {
 
 class ISurface;
-class MemoryHeapPmem;
+class Overlay;
 
 class QComHardwareRenderer : public VideoRenderer {
 public:
     QComHardwareRenderer(
             const sp<ISurface> &surface,
             size_t displayWidth, size_t displayHeight,
-            size_t decodedWidth, size_t decodedHeight);
+            size_t decodedWidth, size_t decodedHeight,
+            size_t queueDepth = 1);
 
     virtual ~QComHardwareRenderer();
 
     virtual void render(
             const void *data, size_t size, void *platformPrivate);
 
-private:
-    sp<ISurface> mISurface;
+    struct PresentationStats {
+        uint32_t presented;
+        uint32_t dropped;   // superseded before their refresh came
+        uint32_t repeated;  // refreshes a frame stayed on screen too long
+    };
+
+    PresentationStats getPresentationStats();
+
+protected:
     size_t mDisplayWidth, mDisplayHeight;
     size_t mDecodedWidth, mDecodedHeight;
     size_t mFrameSize;
+
+    // Read on demand; see QComVideoStats.
+    QComVideoStats mVideoStats;
+
+    // Queues the frame at offset in heap for the next display refresh at or
+    // after due, if the renderer owns heap.  A buffer that goes back to the
+    // decoder is posted before the call returns, as it can't be kept
+    // queued; it is neither dropped nor held for a refresh.
+    void queueBuffer(
+            const sp<MemoryHeapPmem> &heap, size_t offset, nsecs_t due,
+            bool owned);
+
+    // Whether the frame at offset in an owned heap is queued or on screen,
+    // so it must not be written.
+    bool isBufferBusy(const sp<MemoryHeapPmem> &heap, size_t offset);
+
+private:
+    struct Frame {
+        sp<MemoryHeapPmem> heap;
+        size_t offset;
+        nsecs_t due;
+        bool owned;
+    };
+
+    sp<ISurface> mISurface;
+    PmemHeapRegistry mHeaps;
     sp<MemoryHeapPmem> mMemoryHeap;
+    sp<Overlay> mOverlay;
+
+    // Presentation.  Owned frames are posted on a grid of display refresh
+    // periods by mThread; of the frames due by a refresh only the newest
+    // is posted.  Everything below is under mLock.
+    Mutex mLock;
+    Condition mCondition;
+    Vector<Frame> mQueue;
+    size_t mQueueDepth;
+    nsecs_t mPeriod;
+    nsecs_t mTickBase;
+    nsecs_t mFrameInterval;     // between due times, smoothed
+    nsecs_t mLastDue;
+    nsecs_t mLastPost;
+    Frame mShown;               // owned frames only
+    bool mDone;
+    bool mThreadStarted;
+    pthread_t mThread;
+
+    static void *ThreadWrapper(void *me);
+    void threadEntry();
+    void presentLocked(const Frame &frame, nsecs_t tick);
 
-    bool getOffset(void *platformPrivate, size_t *offset);
-    void publishBuffers(uint32_t pmem_fd);
+    void initOverlay();
+    void closeOverlay();
+    void postBuffer(size_t offset);
+    void publishBuffers(const sp<MemoryHeapPmem> &heap);
 
     QComHardwareRenderer(const QComHardwareRenderer &);
     QComHardwareRenderer &operator=(const QComHardwareRenderer &);
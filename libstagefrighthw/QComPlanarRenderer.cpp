@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "QComPlanarRenderer.h"
+#include "QComColorConvert.h"
+
+#include <binder/MemoryHeapBase.h>
+#include <binder/MemoryHeapPmem.h>
+#include <media/stagefright/MediaDebug.h>
+
+namespace android {
+
+QComPlanarRenderer::QComPlanarRenderer(
+        const sp<ISurface> &surface,
+        size_t displayWidth, size_t displayHeight,
+        size_t decodedWidth, size_t decodedHeight)
+    : QComHardwareRenderer(
+            surface, displayWidth, displayHeight,
+            decodedWidth, decodedHeight, kQueueDepth),
+      mInitCheck(NO_INIT),
+      mIndex(0) {
+    sp<MemoryHeapBase> master =
+        new MemoryHeapBase("/dev/pmem_adsp", mFrameSize * kNumBuffers);
+    if (master->heapID() < 0) {
+        LOGE("couldn't allocate %d frames of %d bytes from pmem",
+             kNumBuffers, mFrameSize);
+        return;
+    }
+
+    master->setDevice("/dev/pmem");
+    mFrameHeap = new MemoryHeapPmem(master, 0);
+    mFrameHeap->slap();
+
+    mInitCheck = OK;
+}
+
+QComPlanarRenderer::~QComPlanarRenderer() {
+}
+
+void QComPlanarRenderer::render(
+        const void *data, size_t size, void *platformPrivate) {
+    if (size < mFrameSize) {
+        LOGE("frame of %d bytes, expected %d", size, mFrameSize);
+        return;
+    }
+
+    // The next frame neither on screen nor waiting for a refresh; with
+    // kQueueDepth + 2 frames there always is one.
+    size_t offset;
+    do {
+        if (++mIndex == kNumBuffers) {
+            mIndex = 0;
+        }
+        offset = mIndex * mFrameSize;
+    } while (isBufferBusy(mFrameHeap, offset));
+
+    nsecs_t start = systemTime();
+    convertYUV420PlanarToYVU420SemiPlanar(
+            (const uint8_t *)data,
+            (uint8_t *)mFrameHeap->getBase() + offset,
+            mDecodedWidth, mDecodedHeight);
+    nsecs_t now = systemTime();
+    mVideoStats.conversionDone(now - start);
+
+    queueBuffer(mFrameHeap, offset, now, true);
+}
+
+}  // namespace android
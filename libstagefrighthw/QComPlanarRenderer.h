@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_PLANAR_RENDERER_H_
+
+#define QCOM_PLANAR_RENDERER_H_
+
+#include "QComHardwareRenderer.h"
+
+#include <utils/Errors.h>
+
+namespace android {
+
+// Renders the YUV420 planar output of the software decoders the way
+// QComHardwareRenderer renders the hardware decoders': each frame is
+// converted into a ring of pmem frames of our own and goes to the overlay,
+// or to SurfaceFlinger without a copy.  As the frames are ours, more of them
+// can wait for a display refresh than the decoder's.
+class QComPlanarRenderer : public QComHardwareRenderer {
+public:
+    QComPlanarRenderer(
+            const sp<ISurface> &surface,
+            size_t displayWidth, size_t displayHeight,
+            size_t decodedWidth, size_t decodedHeight);
+
+    virtual ~QComPlanarRenderer();
+
+    status_t initCheck() const { return mInitCheck; }
+
+    virtual void render(
+            const void *data, size_t size, void *platformPrivate);
+
+private:
+    // Besides the frames waiting for a refresh, one is on screen and one
+    // is being converted.
+    enum { kQueueDepth = 2 };
+    enum { kNumBuffers = kQueueDepth + 2 };
+
+    status_t mInitCheck;
+    sp<MemoryHeapPmem> mFrameHeap;
+    size_t mIndex;
+
+    QComPlanarRenderer(const QComPlanarRenderer &);
+    QComPlanarRenderer &operator=(const QComPlanarRenderer &);
+};
+
+}  // namespace android
+
+#endif  // QCOM_PLANAR_RENDERER_H_
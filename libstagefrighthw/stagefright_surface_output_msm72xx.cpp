@@ -1,6 +1,7 @@
 #include <media/stagefright/HardwareAPI.h>
 
 #include "QComHardwareRenderer.h"
+#include "QComPlanarRenderer.h"
 
 using android::sp;
 using android::ISurface;
@@ -13,6 +14,7 @@ VideoRenderer *createRenderer(
         size_t displayWidth, size_t displayHeight,
         size_t decodedWidth, size_t decodedHeight) {
     using android::QComHardwareRenderer;
+    using android::QComPlanarRenderer;
 
     static const int OMX_QCOM_COLOR_FormatYVU420SemiPlanar = 0x7FA30C00;
 
@@ -23,5 +25,19 @@ VideoRenderer *createRenderer(
                 decodedWidth, decodedHeight);
     }
 
+    // Software decoders.
+    if (colorFormat == OMX_COLOR_FormatYUV420Planar
+        && (decodedWidth & 1) == 0 && (decodedHeight & 1) == 0) {
+        QComPlanarRenderer *renderer = new QComPlanarRenderer(
+                surface, displayWidth, displayHeight,
+                decodedWidth, decodedHeight);
+
+        if (renderer->initCheck() == android::OK) {
+            return renderer;
+        }
+
+        delete renderer;
+    }
+
     return NULL;
 }
@@ -0,0 +1,30 @@
+ifeq ($(BOARD_USES_QCOM_LIBS),true)
+
+LOCAL_PATH := $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    QComVideoBuffer.cpp \
+    QComColorConvert.cpp \
+    QComFrameWorker.cpp \
+    QComFrameClock.cpp \
+    QComFrameRing.cpp \
+    QComDisplay.cpp \
+    QComVideoStats.cpp
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_CFLAGS+= -mfpu=neon
+endif
+
+LOCAL_SHARED_LIBRARIES :=       \
+        libbinder               \
+        libutils                \
+        libcutils
+
+LOCAL_MODULE := libvideohw
+
+LOCAL_PRELINK_MODULE:= false
+
+include $(BUILD_SHARED_LIBRARY)
+
+endif # build_with_qcom_libs
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "QComColorConvert.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace android {
+
+void convertYUV420PlanarToYVU420SemiPlanar(
+        const uint8_t *src, uint8_t *dst, size_t width, size_t height) {
+    size_t ySize = width * height;
+    memcpy(dst, src, ySize);
+
+    const uint8_t *u = src + ySize;
+    const uint8_t *v = u + ySize / 4;
+    uint8_t *vu = dst + ySize;
+    size_t count = ySize / 4;
+    size_t i = 0;
+
+#if defined(__ARM_NEON__)
+    // 16 pairs per iteration; vst2 does the interleaving.
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t pairs;
+        pairs.val[0] = vld1q_u8(v + i);
+        pairs.val[1] = vld1q_u8(u + i);
+        vst2q_u8(vu + 2 * i, pairs);
+    }
+#else
+    // Four pairs per iteration, from one word of each plane into two words
+    // (little endian).
+    if ((((uintptr_t)u | (uintptr_t)v | (uintptr_t)vu) & 3) == 0) {
+        const uint32_t *u32 = (const uint32_t *)u;
+        const uint32_t *v32 = (const uint32_t *)v;
+        uint32_t *vu32 = (uint32_t *)vu;
+        for (; i + 4 <= count; i += 4) {
+            uint32_t uw = *u32++;
+            uint32_t vw = *v32++;
+            *vu32++ = (vw & 0xff) | ((uw & 0xff) << 8) |
+                      ((vw & 0xff00) << 8) | ((uw & 0xff00) << 16);
+            *vu32++ = ((vw >> 16) & 0xff) | ((uw >> 8) & 0xff00) |
+                      (vw & 0xff000000) >> 8 | (uw & 0xff000000);
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        vu[2 * i] = v[i];
+        vu[2 * i + 1] = u[i];
+    }
+}
+
+}  // namespace android
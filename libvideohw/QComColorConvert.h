@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_COLOR_CONVERT_H_
+
+#define QCOM_COLOR_CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Converts a YUV420 planar frame (Y, then U, then V) into the semi-planar
+// layout the MDP and SurfaceFlinger take: Y, then interleaved V/U pairs.
+// Width and height must be even.  Uses NEON where the build has it, and
+// word accesses otherwise.
+void convertYUV420PlanarToYVU420SemiPlanar(
+        const uint8_t *src, uint8_t *dst, size_t width, size_t height);
+
+}  // namespace android
+
+#endif  // QCOM_COLOR_CONVERT_H_
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "QComDisplay.h"
+
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace android {
+
+nsecs_t getDisplayRefreshPeriod() {
+    nsecs_t period = s2ns(1) / 60;
+
+    int fd = open("/dev/graphics/fb0", O_RDONLY);
+    if (fd < 0) {
+        return period;
+    }
+
+    struct fb_var_screeninfo info;
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == 0 && info.pixclock > 0) {
+        // pixclock is in picoseconds.
+        uint64_t frame = (uint64_t)info.pixclock *
+            (info.xres + info.left_margin + info.right_margin +
+             info.hsync_len) *
+            (info.yres + info.upper_margin + info.lower_margin +
+             info.vsync_len) / 1000;
+        if (frame >= (uint64_t)s2ns(1) / 120 &&
+            frame <= (uint64_t)s2ns(1) / 20) {
+            period = frame;
+        }
+    }
+    close(fd);
+
+    return period;
+}
+
+}  // namespace android
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_DISPLAY_H_
+
+#define QCOM_DISPLAY_H_
+
+#include <utils/Timers.h>
+
+namespace android {
+
+// How long the primary display shows each refresh, from the framebuffer
+// timings.  Without a display to ask, assumes 60Hz.
+nsecs_t getDisplayRefreshPeriod();
+
+}  // namespace android
+
+#endif  // QCOM_DISPLAY_H_
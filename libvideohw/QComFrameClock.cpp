@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "QComFrameClock"
+#include <utils/Log.h>
+
+#include "QComFrameClock.h"
+
+namespace android {
+
+// Media time jumping further than this, or frames further apart than this,
+// means a seek, a pause or a stall: lateness is measured afresh.
+static const int64_t kMaxGapUs = 1000000;
+
+QComFrameClock::QComFrameClock(int64_t lateUs, uint32_t maxSkips)
+    : mLateUs(lateUs),
+      mMaxSkips(maxSkips) {
+    reset();
+}
+
+void QComFrameClock::reset() {
+    Mutex::Autolock autoLock(mLock);
+    mAnchored = false;
+    mSkipsInARow = 0;
+}
+
+void QComFrameClock::anchor(uint32_t timeMs, nsecs_t now) {
+    mAnchored = true;
+    mAnchorTimeMs = timeMs;
+    mAnchorNow = now;
+}
+
+bool QComFrameClock::isLate(uint32_t timeMs, nsecs_t now,
+                            nsecs_t *lateness, bool *resynced) {
+    Mutex::Autolock autoLock(mLock);
+
+    bool resync = !mAnchored
+        || timeMs < mLastTimeMs
+        || (int64_t)(timeMs - mLastTimeMs) * 1000 >= kMaxGapUs
+        || ns2us(now - mLastNow) >= kMaxGapUs;
+    mLastTimeMs = timeMs;
+    mLastNow = now;
+
+    if (lateness != NULL) {
+        *lateness = 0;
+    }
+    if (resynced != NULL) {
+        *resynced = resync && mAnchored;
+    }
+
+    if (resync) {
+        if (mAnchored) {
+            LOGV("resync at %u ms", timeMs);
+        }
+        anchor(timeMs, now);
+        mSkipsInARow = 0;
+        return false;
+    }
+
+    nsecs_t due = mAnchorNow + us2ns((int64_t)(timeMs - mAnchorTimeMs) * 1000);
+    int64_t latenessUs = ns2us(now - due);
+
+    // A frame on time or early tells where the clock really is.
+    if (latenessUs < 0) {
+        anchor(timeMs, now);
+        latenessUs = 0;
+    }
+    if (lateness != NULL) {
+        *lateness = us2ns(latenessUs);
+    }
+
+    if (latenessUs > mLateUs && mSkipsInARow < mMaxSkips) {
+        LOGV("skipping frame %u ms, %lld us late", timeMs, latenessUs);
+        ++mSkipsInARow;
+        return true;
+    }
+
+    mSkipsInARow = 0;
+    return false;
+}
+
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_FRAME_CLOCK_H_
+
+#define QCOM_FRAME_CLOCK_H_
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+#include <stdint.h>
+
+namespace android {
+
+// Tells which frames are already past their presentation time, so that a
+// renderer falling behind can skip them instead of converting and posting
+// them.  The output sees no clock of its own, so the playback clock is
+// taken to be the media timestamps anchored at the earliest arrival seen,
+// moving at the rate of the monotonic clock.  Seeks, pauses and stalls
+// start over from the next frame.
+class QComFrameClock {
+public:
+    // Frames later than lateUs are skipped, but never more than maxSkips
+    // in a row, so that the picture still moves.
+    QComFrameClock(int64_t lateUs = kDefaultLateUs,
+                   uint32_t maxSkips = kDefaultMaxSkips);
+
+    // Whether the frame stamped timeMs (media time) arriving now should be
+    // skipped.  *lateness tells how far behind the clock the frame is, and
+    // *resynced whether the clock started over at it.
+    bool isLate(uint32_t timeMs, nsecs_t now,
+                nsecs_t *lateness = NULL, bool *resynced = NULL);
+
+    // Forgets the anchor, at the start of a clip.
+    void reset();
+
+    enum {
+        kDefaultLateUs = 50000,
+        kDefaultMaxSkips = 4,
+    };
+
+private:
+    Mutex mLock;
+    int64_t mLateUs;
+    uint32_t mMaxSkips;
+
+    bool mAnchored;
+    uint32_t mAnchorTimeMs;
+    nsecs_t mAnchorNow;
+    uint32_t mLastTimeMs;
+    nsecs_t mLastNow;
+    uint32_t mSkipsInARow;
+
+    void anchor(uint32_t timeMs, nsecs_t now);
+
+    QComFrameClock(const QComFrameClock &);
+    QComFrameClock &operator=(const QComFrameClock &);
+};
+
+}  // namespace android
+
+#endif  // QCOM_FRAME_CLOCK_H_
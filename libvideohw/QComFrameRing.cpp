@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "QComFrameRing"
+#include <utils/Log.h>
+
+#include "QComFrameRing.h"
+
+#include <unistd.h>
+
+namespace android {
+
+static const nsecs_t kOnScreen = 0x7fffffffffffffffLL;
+
+QComFrameRing::QComFrameRing(size_t minSlots, size_t maxSlots, nsecs_t period)
+    : mMinSlots(minSlots < 2 ? 2 : minSlots),
+      mMaxSlots(maxSlots < mMinSlots ? mMinSlots : maxSlots),
+      mPeriod(period),
+      mCurrent(0),
+      mWanted(mMinSlots) {
+    reset(mMinSlots);
+}
+
+void QComFrameRing::reset(size_t slots) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (slots != mReleaseTime.size() && mReleaseTime.size() > 0) {
+        LOGV("ring of %d slots, was %d", slots, mReleaseTime.size());
+    }
+
+    mReleaseTime.clear();
+    for (size_t i = 0; i < slots; ++i) {
+        mReleaseTime.push(0);
+    }
+    mCurrent = slots - 1;
+    mWanted = slots;
+    mWindowFrames = 0;
+    mWindowStalls = 0;
+    mQuietFrames = 0;
+}
+
+void QComFrameRing::capDepth() {
+    Mutex::Autolock autoLock(mLock);
+    mMaxSlots = mReleaseTime.size();
+    mWanted = mMaxSlots;
+}
+
+size_t QComFrameRing::slots() {
+    Mutex::Autolock autoLock(mLock);
+    return mReleaseTime.size();
+}
+
+size_t QComFrameRing::wantedSlots() {
+    Mutex::Autolock autoLock(mLock);
+    return mWanted;
+}
+
+size_t QComFrameRing::acquire(bool *stalled) {
+    Mutex::Autolock autoLock(mLock);
+
+    // Oldest first: the slot after the one on screen, and so on around.
+    size_t count = mReleaseTime.size();
+    size_t slot = (mCurrent + 1) % count;
+    nsecs_t now = systemTime();
+    bool wait = mReleaseTime[slot] > now;
+    if (wait) {
+        for (size_t i = 2; i < count; ++i) {
+            size_t next = (mCurrent + i) % count;
+            if (mReleaseTime[next] <= now) {
+                slot = next;
+                wait = false;
+                break;
+            }
+        }
+    }
+
+    ++mWindowFrames;
+    if (wait) {
+        // Released by the next refresh at the latest, as a newer slot has
+        // been posted.
+        nsecs_t delay = mReleaseTime[slot] - now;
+        mLock.unlock();
+        usleep(ns2us(delay) + 1);
+        mLock.lock();
+
+        ++mWindowStalls;
+        mQuietFrames = 0;
+    } else {
+        ++mQuietFrames;
+    }
+
+    if (mWindowStalls >= kStallsToGrow) {
+        if (count < mMaxSlots) {
+            mWanted = count + 1;
+        }
+        mWindowFrames = 0;
+        mWindowStalls = 0;
+    } else if (mWindowFrames >= kStallWindow) {
+        mWindowFrames = 0;
+        mWindowStalls = 0;
+    }
+    if (mQuietFrames >= kQuietFrames) {
+        if (count > mMinSlots) {
+            mWanted = count - 1;
+        }
+        mQuietFrames = 0;
+    }
+
+    if (stalled != NULL) {
+        *stalled = wait;
+    }
+    return slot;
+}
+
+void QComFrameRing::posted(size_t slot) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (slot != mCurrent && mCurrent < mReleaseTime.size()) {
+        mReleaseTime.editItemAt(mCurrent) = systemTime() + mPeriod;
+    }
+    mReleaseTime.editItemAt(slot) = kOnScreen;
+    mCurrent = slot;
+}
+
+size_t QComFrameRing::current() {
+    Mutex::Autolock autoLock(mLock);
+    return mCurrent;
+}
+
+}  // namespace android
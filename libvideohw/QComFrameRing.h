@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_FRAME_RING_H_
+
+#define QCOM_FRAME_RING_H_
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Tracks which slots of a ring of frame buffers the display may still be
+// reading, and how deep the ring should be.  Neither postBuffer() nor the
+// MDP overlay tells when it is done with a buffer: a posted slot is taken
+// to be released once a newer one has been posted and the display has
+// refreshed since.  A writer that finds the next slot still on screen
+// waits for it, and the stall asks for a deeper ring; a ring that has not
+// stalled for a long while asks to be shallower again.
+class QComFrameRing {
+public:
+    QComFrameRing(size_t minSlots, size_t maxSlots, nsecs_t period);
+
+    // A new ring of the given number of slots, none of them in flight.
+    void reset(size_t slots);
+
+    // The ring will not be asked to grow past its current depth, after
+    // the memory for a deeper one could not be had.
+    void capDepth();
+
+    size_t slots();
+
+    // The number of slots the ring should have, from the stalls seen.
+    size_t wantedSlots();
+
+    // The slot to write the next frame into, once the display has let go
+    // of it; *stalled tells whether that took a wait.
+    size_t acquire(bool *stalled = NULL);
+
+    // The frame in slot went to the display.
+    void posted(size_t slot);
+
+    // The slot last posted.
+    size_t current();
+
+private:
+    enum {
+        // Grow after this many stalls within kStallWindow frames.
+        kStallsToGrow = 2,
+        kStallWindow = 64,
+
+        // Shrink after this many frames without a stall.
+        kQuietFrames = 900,
+    };
+
+    Mutex mLock;
+    size_t mMinSlots;
+    size_t mMaxSlots;
+    nsecs_t mPeriod;
+
+    // When each slot is free to write again; a slot on screen is never.
+    Vector<nsecs_t> mReleaseTime;
+    size_t mCurrent;
+    size_t mWanted;
+
+    uint32_t mWindowFrames;
+    uint32_t mWindowStalls;
+    uint32_t mQuietFrames;
+
+    QComFrameRing(const QComFrameRing &);
+    QComFrameRing &operator=(const QComFrameRing &);
+};
+
+}  // namespace android
+
+#endif  // QCOM_FRAME_RING_H_
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "QComFrameWorker"
+#include <utils/Log.h>
+
+#include "QComFrameWorker.h"
+
+namespace android {
+
+QComFrameWorker::QComFrameWorker(Handler *handler, size_t depth)
+    : mHandler(handler),
+      mDepth(depth > 0 ? depth : 1),
+      mBusy(false),
+      mDone(false),
+      mThreadStarted(false) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    mThreadStarted = pthread_create(&mThread, &attr, ThreadWrapper, this) == 0;
+    pthread_attr_destroy(&attr);
+    if (!mThreadStarted) {
+        LOGW("couldn't start frame worker, processing frames as they come");
+    }
+}
+
+QComFrameWorker::~QComFrameWorker() {
+    {
+        Mutex::Autolock autoLock(mLock);
+        mDone = true;
+        mWorkCondition.signal();
+    }
+
+    if (mThreadStarted) {
+        void *dummy;
+        pthread_join(mThread, &dummy);
+    }
+}
+
+void QComFrameWorker::queue(const Job &job) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (!mThreadStarted) {
+        mHandler->processFrame(job);
+        mCompleted.push(job);
+        mHandler->frameCompleted();
+        return;
+    }
+
+    while (mPending.size() + (mBusy ? 1 : 0) >= mDepth) {
+        mDoneCondition.wait(mLock);
+    }
+
+    mPending.push(job);
+    mWorkCondition.signal();
+}
+
+bool QComFrameWorker::takeCompleted(Job *job) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mCompleted.isEmpty()) {
+        return false;
+    }
+
+    *job = mCompleted[0];
+    mCompleted.removeAt(0);
+    return true;
+}
+
+size_t QComFrameWorker::outstanding() {
+    Mutex::Autolock autoLock(mLock);
+    return mPending.size() + (mBusy ? 1 : 0);
+}
+
+void QComFrameWorker::drain() {
+    Mutex::Autolock autoLock(mLock);
+    while (!mPending.isEmpty() || mBusy) {
+        mDoneCondition.wait(mLock);
+    }
+}
+
+// static
+void *QComFrameWorker::ThreadWrapper(void *me) {
+    static_cast<QComFrameWorker *>(me)->threadEntry();
+    return NULL;
+}
+
+void QComFrameWorker::threadEntry() {
+    Mutex::Autolock autoLock(mLock);
+
+    for (;;) {
+        while (mPending.isEmpty() && !mDone) {
+            mWorkCondition.wait(mLock);
+        }
+
+        // Frames queued before the end still get processed, as their
+        // owner waits for them to complete.
+        if (mPending.isEmpty()) {
+            break;
+        }
+
+        Job job = mPending[0];
+        mPending.removeAt(0);
+        mBusy = true;
+
+        mLock.unlock();
+        mHandler->processFrame(job);
+        mLock.lock();
+
+        mBusy = false;
+        mCompleted.push(job);
+        mDoneCondition.broadcast();
+        mHandler->frameCompleted();
+    }
+}
+
+}  // namespace android
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_FRAME_WORKER_H_
+
+#define QCOM_FRAME_WORKER_H_
+
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace android {
+
+// Converts and posts decoded frames on a thread of its own, so that the
+// decoder can go on with the next frame meanwhile.  Frames are handled in
+// order, and stay the caller's: it must keep a frame's data alive until
+// takeCompleted() hands the frame back.
+class QComFrameWorker {
+public:
+    struct Job {
+        const void *data;
+        size_t size;
+        uint32_t id;
+        uint32_t timeMs;
+        const void *context;
+    };
+
+    class Handler {
+    public:
+        virtual ~Handler() {}
+
+        // Called on the worker thread, one frame at a time.
+        virtual void processFrame(const Job &job) = 0;
+
+        // Called once the frame can be had from takeCompleted(), on the
+        // worker thread, or on the caller's if there is no thread.  It
+        // must not call back into the worker.
+        virtual void frameCompleted() {}
+    };
+
+    // At most depth frames are queued or being processed at a time.
+    QComFrameWorker(Handler *handler, size_t depth);
+
+    // Finishes the frames queued.
+    ~QComFrameWorker();
+
+    // Blocks while depth frames are outstanding.  Without a thread, the
+    // frame is processed before queue() returns.
+    void queue(const Job &job);
+
+    // The oldest frame processed and not taken yet; false if there is none.
+    bool takeCompleted(Job *job);
+
+    // Frames queued or being processed.
+    size_t outstanding();
+
+    // Waits for the frames queued to be processed.
+    void drain();
+
+private:
+    Handler *mHandler;
+    size_t mDepth;
+
+    Mutex mLock;
+    Condition mWorkCondition;
+    Condition mDoneCondition;
+    Vector<Job> mPending;
+    Vector<Job> mCompleted;
+    bool mBusy;
+    bool mDone;
+    bool mThreadStarted;
+    pthread_t mThread;
+
+    static void *ThreadWrapper(void *me);
+    void threadEntry();
+
+    QComFrameWorker(const QComFrameWorker &);
+    QComFrameWorker &operator=(const QComFrameWorker &);
+};
+
+}  // namespace android
+
+#endif  // QCOM_FRAME_WORKER_H_
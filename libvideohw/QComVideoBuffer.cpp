@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "QComVideoBuffer"
+#include <utils/Log.h>
+
+#include "QComVideoBuffer.h"
+
+namespace android {
+
+bool QComVideoBuffer::parse(const void *platformPrivate) {
+    const PLATFORM_PRIVATE_LIST *list =
+        (const PLATFORM_PRIVATE_LIST *)platformPrivate;
+    if (list == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < list->nEntries; ++i) {
+        const PLATFORM_PRIVATE_ENTRY *entry = &list->entryList[i];
+        if (entry->type != PLATFORM_PRIVATE_PMEM || entry->entry == NULL) {
+            continue;
+        }
+
+        const PLATFORM_PRIVATE_PMEM_INFO *info =
+            (const PLATFORM_PRIVATE_PMEM_INFO *)entry->entry;
+        heap = reinterpret_cast<MemoryHeapBase *>(info->pmem_fd);
+        offset = info->offset;
+        return heap != NULL;
+    }
+
+    return false;
+}
+
+PmemHeapRegistry::PmemHeapRegistry()
+    : mLastMaster(NULL) {
+}
+
+PmemHeapRegistry::~PmemHeapRegistry() {
+    clear();
+}
+
+sp<MemoryHeapPmem> PmemHeapRegistry::heapFor(
+        const QComVideoBuffer &buffer, bool *changed) {
+    *changed = false;
+    if (buffer.heap == mLastMaster && mLastHeap != NULL) {
+        return mLastHeap;
+    }
+
+    if (buffer.heap == NULL) {
+        return NULL;
+    }
+
+    ssize_t index = mHeaps.indexOfKey(buffer.heap);
+    if (index >= 0) {
+        mLastHeap = mHeaps.valueAt(index);
+    } else {
+        if (mHeaps.size() >= kMaxHeaps) {
+            LOGW("more than %d decoder heaps, forgetting the old ones",
+                 kMaxHeaps);
+            mHeaps.clear();
+        }
+
+        sp<MemoryHeapBase> master = buffer.heap;
+        master->setDevice("/dev/pmem");
+
+        uint32_t heap_flags = master->getFlags() & MemoryHeapBase::NO_CACHING;
+        mLastHeap = new MemoryHeapPmem(master, heap_flags);
+        mLastHeap->slap();
+        mHeaps.add(buffer.heap, mLastHeap);
+        LOGV("new decoder heap %p, %d known", buffer.heap, mHeaps.size());
+    }
+
+    mLastMaster = buffer.heap;
+    *changed = true;
+    return mLastHeap;
+}
+
+void PmemHeapRegistry::clear() {
+    mLastMaster = NULL;
+    mLastHeap.clear();
+    mHeaps.clear();
+}
+
+}  // namespace android
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_VIDEO_BUFFER_H_
+
+#define QCOM_VIDEO_BUFFER_H_
+
+#include <binder/MemoryHeapBase.h>
+#include <binder/MemoryHeapPmem.h>
+#include <utils/KeyedVector.h>
+#include <utils/RefBase.h>
+
+#include <stdint.h>
+
+// Buffers the QCOM video decoders hand to the display side, tunneled
+// through the OMX platform private pointer.
+
+typedef struct PLATFORM_PRIVATE_ENTRY
+{
+    /* Entry type */
+    uint32_t type;
+
+    /* Pointer to platform specific entry */
+    void *entry;
+
+} PLATFORM_PRIVATE_ENTRY;
+
+typedef struct PLATFORM_PRIVATE_LIST
+{
+    /* Number of entries */
+    uint32_t nEntries;
+
+    /* Pointer to array of platform specific entries *
+     * Contiguous block of PLATFORM_PRIVATE_ENTRY elements */
+    PLATFORM_PRIVATE_ENTRY *entryList;
+
+} PLATFORM_PRIVATE_LIST;
+
+// data structures for tunneling buffers
+typedef struct PLATFORM_PRIVATE_PMEM_INFO
+{
+    /* pmem file descriptor */
+    uint32_t pmem_fd;
+    uint32_t offset;
+
+} PLATFORM_PRIVATE_PMEM_INFO;
+
+#define PLATFORM_PRIVATE_PMEM   1
+
+namespace android {
+
+// One decoded frame: the decoder's pmem heap and the frame's offset in it.
+// Despite its name, PLATFORM_PRIVATE_PMEM_INFO::pmem_fd carries the
+// decoder's MemoryHeapBase pointer, not a file descriptor.
+struct QComVideoBuffer {
+    MemoryHeapBase *heap;
+    uint32_t offset;
+
+    QComVideoBuffer() : heap(NULL), offset(0) {}
+
+    // Finds the pmem entry in the platform private list; false if there is
+    // none.
+    bool parse(const void *platformPrivate);
+};
+
+// Wraps the decoders' pmem heaps for the display, once per heap.  A stream
+// normally decodes into a single heap, so the previous frame's heap is
+// checked first and the steady state costs a pointer compare.  When the
+// decoder switches heaps mid-stream, only a heap not seen before is wrapped
+// anew.
+//
+// Not thread safe; each display client owns one.
+class PmemHeapRegistry {
+public:
+    PmemHeapRegistry();
+    ~PmemHeapRegistry();
+
+    // Returns the display heap for the buffer, or NULL if it has none.
+    // *changed is set when it is not the heap returned last time, and needs
+    // registering with the display.
+    sp<MemoryHeapPmem> heapFor(const QComVideoBuffer &buffer, bool *changed);
+
+    // Forgets every heap, at the end of a stream.
+    void clear();
+
+private:
+    enum { kMaxHeaps = 8 };
+
+    // Keyed by the decoder's heap; the wrapper holds a strong reference to
+    // it, so the key cannot be reused by another heap while it is here.
+    KeyedVector<MemoryHeapBase *, sp<MemoryHeapPmem> > mHeaps;
+    MemoryHeapBase *mLastMaster;
+    sp<MemoryHeapPmem> mLastHeap;
+
+    PmemHeapRegistry(const PmemHeapRegistry &);
+    PmemHeapRegistry &operator=(const PmemHeapRegistry &);
+};
+
+}  // namespace android
+
+#endif  // QCOM_VIDEO_BUFFER_H_
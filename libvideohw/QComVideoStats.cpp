@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "QComVideoStats"
+#include <utils/Log.h>
+
+#include "QComVideoStats.h"
+
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+namespace android {
+
+static const int32_t kBucketLimitMs[QComVideoStats::kNumBuckets - 1] = {
+    10, 20, 30, 40, 50, 70, 100
+};
+
+// Longer gaps than this between frames are pauses, not intervals.
+static const nsecs_t kMaxInterval = 1000000000LL;
+
+// The live outputs, for dumpAll().
+static Mutex gOutputsLock;
+static Vector<QComVideoStats *> gOutputs;
+
+static int32_t toUnits(nsecs_t t) {
+    return (int32_t)(t / 10000);
+}
+
+static uint32_t mean(int32_t sum, int32_t count) {
+    return count > 0 ? (uint32_t)((uint64_t)(uint32_t)sum * 10 / count) : 0;
+}
+
+static void atomicMax(int32_t value, volatile int32_t *max) {
+    int32_t old;
+    do {
+        old = *max;
+        if (value <= old) {
+            return;
+        }
+    } while (android_atomic_cmpxchg(old, value, max));
+}
+
+QComVideoStats::QComVideoStats(const char *name)
+    : mName(name) {
+    reset();
+
+    Mutex::Autolock autoLock(gOutputsLock);
+    gOutputs.push(this);
+}
+
+QComVideoStats::~QComVideoStats() {
+    Mutex::Autolock autoLock(gOutputsLock);
+    for (size_t i = 0; i < gOutputs.size(); ++i) {
+        if (gOutputs[i] == this) {
+            gOutputs.removeAt(i);
+            break;
+        }
+    }
+}
+
+void QComVideoStats::reset() {
+    android_atomic_write(0, &mShown);
+    android_atomic_write(0, &mLate);
+    android_atomic_write(0, &mDropped);
+    android_atomic_write(0, &mRepeated);
+    android_atomic_write(0, &mMaxLatenessUs);
+    android_atomic_write(0, &mResyncs);
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        android_atomic_write(0, &mIntervals[i]);
+    }
+    android_atomic_write(0, &mIntervalCount);
+    android_atomic_write(0, &mIntervalSum);
+    android_atomic_write(0, &mJitterCount);
+    android_atomic_write(0, &mJitterSum);
+    android_atomic_write(0, &mConversions);
+    android_atomic_write(0, &mConversionSum);
+    android_atomic_write(0, &mMaxConversionUs);
+    android_atomic_write(0, &mPosts);
+    android_atomic_write(0, &mPostSum);
+    android_atomic_write(0, &mMaxPostUs);
+    android_atomic_write(0, &mSetupUs);
+    android_atomic_write(0, &mHeapAllocations);
+    android_atomic_write(0, &mHeapRegistrations);
+    android_atomic_write(0, &mStalls);
+
+    mLastShown = 0;
+    mLastInterval = 0;
+}
+
+void QComVideoStats::frameShown(nsecs_t now) {
+    android_atomic_inc(&mShown);
+
+    nsecs_t interval = now - mLastShown;
+    if (mLastShown != 0 && interval >= 0 && interval < kMaxInterval) {
+        int32_t ms = (int32_t)(interval / 1000000);
+        size_t bucket = 0;
+        while (bucket < kNumBuckets - 1 && ms >= kBucketLimitMs[bucket]) {
+            ++bucket;
+        }
+        android_atomic_inc(&mIntervals[bucket]);
+        android_atomic_add(toUnits(interval), &mIntervalSum);
+
+        if (mLastInterval != 0) {
+            nsecs_t change = interval - mLastInterval;
+            android_atomic_add(toUnits(change < 0 ? -change : change),
+                               &mJitterSum);
+            android_atomic_inc(&mJitterCount);
+        }
+        android_atomic_inc(&mIntervalCount);
+        mLastInterval = interval;
+    } else {
+        mLastInterval = 0;
+    }
+    mLastShown = now;
+}
+
+void QComVideoStats::frameLate() {
+    android_atomic_inc(&mLate);
+}
+
+void QComVideoStats::framesDropped(uint32_t count) {
+    android_atomic_add(count, &mDropped);
+}
+
+void QComVideoStats::framesRepeated(uint32_t count) {
+    android_atomic_add(count, &mRepeated);
+}
+
+void QComVideoStats::frameArrived(nsecs_t lateness, bool resynced) {
+    atomicMax((int32_t)ns2us(lateness), &mMaxLatenessUs);
+    if (resynced) {
+        android_atomic_inc(&mResyncs);
+    }
+}
+
+void QComVideoStats::conversionDone(nsecs_t duration) {
+    android_atomic_inc(&mConversions);
+    android_atomic_add(toUnits(duration), &mConversionSum);
+    atomicMax((int32_t)ns2us(duration), &mMaxConversionUs);
+}
+
+void QComVideoStats::postDone(nsecs_t latency) {
+    android_atomic_inc(&mPosts);
+    android_atomic_add(toUnits(latency), &mPostSum);
+    atomicMax((int32_t)ns2us(latency), &mMaxPostUs);
+}
+
+void QComVideoStats::setupDone(nsecs_t duration) {
+    android_atomic_write((int32_t)ns2us(duration), &mSetupUs);
+}
+
+void QComVideoStats::heapAllocated() {
+    android_atomic_inc(&mHeapAllocations);
+}
+
+void QComVideoStats::heapRegistered() {
+    android_atomic_inc(&mHeapRegistrations);
+}
+
+void QComVideoStats::stalled() {
+    android_atomic_inc(&mStalls);
+}
+
+void QComVideoStats::getSnapshot(Snapshot *snapshot) {
+    snapshot->shown = mShown;
+    snapshot->late = mLate;
+    snapshot->dropped = mDropped;
+    snapshot->repeated = mRepeated;
+    snapshot->maxLatenessUs = mMaxLatenessUs;
+    snapshot->resyncs = mResyncs;
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        snapshot->intervals[i] = mIntervals[i];
+    }
+
+    snapshot->meanIntervalUs = mean(mIntervalSum, mIntervalCount);
+    snapshot->jitterUs = mean(mJitterSum, mJitterCount);
+
+    snapshot->conversions = mConversions;
+    snapshot->meanConversionUs = mean(mConversionSum, mConversions);
+    snapshot->maxConversionUs = mMaxConversionUs;
+    snapshot->posts = mPosts;
+    snapshot->meanPostUs = mean(mPostSum, mPosts);
+    snapshot->maxPostUs = mMaxPostUs;
+    snapshot->setupUs = mSetupUs;
+    snapshot->heapAllocations = mHeapAllocations;
+    snapshot->heapRegistrations = mHeapRegistrations;
+    snapshot->stalls = mStalls;
+}
+
+void QComVideoStats::report(String8 *out) {
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    Snapshot s;
+    getSnapshot(&s);
+
+    snprintf(buffer, SIZE, "%s video output:\n", mName);
+    out->append(buffer);
+    snprintf(buffer, SIZE,
+             "  frames: %u shown, %u late, %u dropped, %u repeated\n",
+             s.shown, s.late, s.dropped, s.repeated);
+    out->append(buffer);
+    snprintf(buffer, SIZE,
+             "  lateness: max %u us, clock resyncs: %u\n",
+             s.maxLatenessUs, s.resyncs);
+    out->append(buffer);
+    snprintf(buffer, SIZE,
+             "  interval: mean %u.%03u ms, jitter %u.%03u ms (%.2f fps)\n",
+             s.meanIntervalUs / 1000, s.meanIntervalUs % 1000,
+             s.jitterUs / 1000, s.jitterUs % 1000,
+             s.meanIntervalUs ? 1e6 / s.meanIntervalUs : 0.0);
+    out->append(buffer);
+    out->append("   ");
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        if (i < kNumBuckets - 1) {
+            snprintf(buffer, SIZE, " <%dms: %u", kBucketLimitMs[i],
+                     s.intervals[i]);
+        } else {
+            snprintf(buffer, SIZE, " more: %u\n", s.intervals[i]);
+        }
+        out->append(buffer);
+    }
+    snprintf(buffer, SIZE,
+             "  conversion: %u, mean %u us, max %u us\n",
+             s.conversions, s.meanConversionUs, s.maxConversionUs);
+    out->append(buffer);
+    snprintf(buffer, SIZE,
+             "  post: %u, mean %u us, max %u us\n",
+             s.posts, s.meanPostUs, s.maxPostUs);
+    out->append(buffer);
+    snprintf(buffer, SIZE,
+             "  setup: %u us, heap allocations: %u, registrations: %u\n",
+             s.setupUs, s.heapAllocations, s.heapRegistrations);
+    out->append(buffer);
+    snprintf(buffer, SIZE, "  buffer stalls: %u\n", s.stalls);
+    out->append(buffer);
+}
+
+void QComVideoStats::dump(int fd) {
+    String8 result;
+    report(&result);
+    write(fd, result.string(), result.size());
+}
+
+// static
+void QComVideoStats::dumpAll(int fd) {
+    Mutex::Autolock autoLock(gOutputsLock);
+    for (size_t i = 0; i < gOutputs.size(); ++i) {
+        gOutputs[i]->dump(fd);
+    }
+}
+
+void QComVideoStats::log() {
+    if (mShown == 0) {
+        return;
+    }
+
+    String8 result;
+    report(&result);
+    LOGI("%s", result.string());
+}
+
+}  // namespace android
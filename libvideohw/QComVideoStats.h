@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef QCOM_VIDEO_STATS_H_
+
+#define QCOM_VIDEO_STATS_H_
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+#include <stdint.h>
+
+namespace android {
+
+class String8;
+
+// Telemetry of one video output, per stream: how regularly frames reached
+// the screen, what converting and posting them cost, and what was lost on
+// the way.  Recording is a few atomic operations, so it is always on;
+// nothing is logged per frame.  Reports are had on demand: dump() and
+// dumpAll() write them to the file descriptor of a dump request, and log()
+// puts one in the log, as the MIOs do at the end of a stream when their
+// statistics are on.
+//
+// frameShown() must be called from one thread at a time; the rest from
+// any thread.
+class QComVideoStats {
+public:
+    // Inter-frame intervals, by upper bound in ms; the last bucket has none.
+    enum { kNumBuckets = 8 };
+
+    struct Snapshot {
+        uint32_t shown;
+        uint32_t late;          // skipped unconverted, past their time
+        uint32_t dropped;       // superseded before they could be shown
+        uint32_t repeated;      // refreshes a frame stayed up too long
+        uint32_t maxLatenessUs; // behind the playback clock, on arrival
+        uint32_t resyncs;       // playback clock started over mid-stream
+        uint32_t intervals[kNumBuckets];
+        uint32_t meanIntervalUs;
+        uint32_t jitterUs;      // mean change between successive intervals
+        uint32_t conversions;
+        uint32_t meanConversionUs;
+        uint32_t maxConversionUs;
+        uint32_t posts;
+        uint32_t meanPostUs;
+        uint32_t maxPostUs;
+        uint32_t setupUs;       // getting the output ready for the stream
+        uint32_t heapAllocations;
+        uint32_t heapRegistrations;
+        uint32_t stalls;        // waits for the display to release a buffer
+    };
+
+    explicit QComVideoStats(const char *name);
+    ~QComVideoStats();
+
+    // Starts over, for a new stream.
+    void reset();
+
+    void frameShown(nsecs_t now);
+    void frameLate();
+    void framesDropped(uint32_t count);
+    void framesRepeated(uint32_t count);
+    void frameArrived(nsecs_t lateness, bool resynced);
+    void conversionDone(nsecs_t duration);
+    void postDone(nsecs_t latency);
+    void setupDone(nsecs_t duration);
+    void heapAllocated();
+    void heapRegistered();
+    void stalled();
+
+    void getSnapshot(Snapshot *snapshot);
+
+    void dump(int fd);
+    static void dumpAll(int fd);
+
+    // Logs the report, if a frame has been shown.
+    void log();
+
+private:
+    const char *mName;
+
+    // Sums of durations are kept in 10us units, so that hours of
+    // playback fit.
+    volatile int32_t mShown;
+    volatile int32_t mLate;
+    volatile int32_t mDropped;
+    volatile int32_t mRepeated;
+    volatile int32_t mMaxLatenessUs;
+    volatile int32_t mResyncs;
+    volatile int32_t mIntervals[kNumBuckets];
+    volatile int32_t mIntervalCount;
+    volatile int32_t mIntervalSum;
+    volatile int32_t mJitterCount;
+    volatile int32_t mJitterSum;
+    volatile int32_t mConversions;
+    volatile int32_t mConversionSum;
+    volatile int32_t mMaxConversionUs;
+    volatile int32_t mPosts;
+    volatile int32_t mPostSum;
+    volatile int32_t mMaxPostUs;
+    volatile int32_t mSetupUs;
+    volatile int32_t mHeapAllocations;
+    volatile int32_t mHeapRegistrations;
+    volatile int32_t mStalls;
+
+    // frameShown()'s own.
+    nsecs_t mLastShown;
+    nsecs_t mLastInterval;
+
+    void report(String8 *out);
+
+    QComVideoStats(const QComVideoStats &);
+    QComVideoStats &operator=(const QComVideoStats &);
+};
+
+}  // namespace android
+
+#endif  // QCOM_VIDEO_STATS_H_